@@ -0,0 +1,1002 @@
+// throughput benchmark of the module without Zabbix server, database or InfluxDB
+// 1] the module is linked with the stubs of zbx_stub.c and the synthetic database of
+//    db_stub.c and loaded the way Zabbix does it: zbx_module_init() with a config
+//    written to a temporary LoadModulePath, the history callbacks, zbx_module_uninit()
+// 2] an HTTP sink on a loopback port stands in for InfluxDB, it takes every write
+//    (gunzipping compressed ones), checks each line is valid line protocol, counts
+//    lines and bytes and answers 204, optionally after a delay; with -T unix it
+//    listens on a Unix socket instead, with -T udp it takes datagrams on the port
+// 3] batches of float, integer, string, text and log values cycle through the
+//    configured number of items per type, so the item cache and the database see
+//    the same pattern as with a real server; text and log values are kilobytes
+//    long with quotes, backslashes, newlines and UTF-8 to escape
+// 4] with -p the batches are also run by forked processes, the way several history
+//    syncers share the module, each process has the items of all the others
+// 5] reported are values/s over the whole run (including what is written out
+//    by zbx_module_uninit with AsyncSend=1), bytes per value and percentiles of
+//    the time a history callback took
+//
+// Any invalid line or a line count other than the number of values makes the
+// benchmark fail, so it also catches formatting regressions.
+
+#include "common.h"
+#include "module.h"
+#include "log.h"
+#include "bench.h"
+#include "../src/lp_format.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+#define BENCH_TYPE_FLOAT	0x01
+#define BENCH_TYPE_INTEGER	0x02
+#define BENCH_TYPE_STRING	0x04
+#define BENCH_TYPE_TEXT		0x08
+#define BENCH_TYPE_LOG		0x10
+
+/* distinct values of each string type */
+#define BENCH_STRINGS	16
+
+/* invalid lines printed at most */
+#define SINK_INVALID_SHOWN	5
+
+/* UDP sink is idle for this long when all datagrams are taken */
+#define SINK_UDP_IDLE_US	200000
+
+extern char	*CONFIG_LOAD_MODULE_PATH;
+
+int	bench_log_level = LOG_LEVEL_ERR;
+
+static int	sink_delay_us = 0;
+static char	*sink_socket_path = NULL;
+static char	*config_dir = NULL;
+
+static zbx_uint64_t	sink_requests = 0;
+static zbx_uint64_t	sink_lines = 0;
+static zbx_uint64_t	sink_invalid = 0;
+static zbx_uint64_t	sink_wire_bytes = 0;
+static zbx_uint64_t	sink_payload_bytes = 0;
+static zbx_uint64_t	sink_last_us = 0;
+
+/* connection of the sink with what was read but not parsed yet */
+typedef struct
+{
+	int	fd;
+	char	*buf;
+	size_t	alloc;
+	size_t	len;
+}
+sink_conn_t;
+
+/* what forked processes report back */
+typedef struct
+{
+	zbx_uint64_t	db_queries;
+	zbx_uint64_t	latencies[1];	/* of every history callback, batches x types per process */
+}
+bench_shared_t;
+
+static void	usage(const char *progname)
+{
+	fprintf(stderr,
+			"usage: %s [-b batches] [-n values] [-c items] [-H hosts] [-t types] [-d us] [-l us]\n"
+			"          [-p processes] [-T transport] [-o Parameter=value]... [-v]...\n"
+			"  -b  history batches per type (default 100)\n"
+			"  -n  values per batch (default 1000)\n"
+			"  -c  distinct items per type (default 1000)\n"
+			"  -H  hosts the items are spread over (default 100)\n"
+			"  -t  comma separated value types: float, integer, string, text, log\n"
+			"      (default float,integer,string)\n"
+			"  -d  delay of every database query in microseconds (default 0)\n"
+			"  -l  delay of every InfluxDB response in microseconds (default 0)\n"
+			"  -p  processes running the batches, like history syncers (default 1)\n"
+			"  -T  InfluxDBTransport: tcp, unix or udp (default tcp)\n"
+			"  -o  module configuration parameter, may be repeated\n"
+			"  -v  more verbose module log, may be repeated\n", progname);
+	exit(EXIT_FAILURE);
+}
+
+/* skips a measurement, tag key or tag value, returns NULL if it is empty */
+static const char	*sink_skip_name(const char *p, const char *end, const char *terminators)
+{
+	const char	*start = p;
+
+	while (p < end && NULL == strchr(terminators, *p))
+	{
+		if ('\\' == *p && p + 1 < end)
+			p++;
+
+		p++;
+	}
+
+	return p == start ? NULL : p;
+}
+
+/* skips a field value: "string", number with optional i or u suffix, or boolean */
+static const char	*sink_skip_value(const char *p, const char *end)
+{
+	const char	*start = p;
+
+	if (p < end && '"' == *p)
+	{
+		for (p++; p < end && '"' != *p; p++)
+		{
+			if ('\\' == *p && p + 1 < end)
+				p++;
+		}
+
+		return p < end ? p + 1 : NULL;
+	}
+
+	while (p < end && NULL != strchr("-+.0123456789eE", *p))
+		p++;
+
+	if (p == start)
+	{
+		while (p < end && NULL != strchr("tTrRuUeEfFaAlLsS", *p))
+			p++;
+
+		return p == start ? NULL : p;
+	}
+
+	if (p < end && ('i' == *p || 'u' == *p))
+		p++;
+
+	return p;
+}
+
+/* checks a line is measurement[,tag=value...] field=value[,field=value...] timestamp */
+static int	sink_check_line(const char *p, const char *end)
+{
+	if (NULL == (p = sink_skip_name(p, end, ", ")))
+		return FAIL;
+
+	while (p < end && ',' == *p)
+	{
+		if (NULL == (p = sink_skip_name(p + 1, end, ",= ")) || p == end || '=' != *p)
+			return FAIL;
+
+		if (NULL == (p = sink_skip_name(p + 1, end, ", ")))
+			return FAIL;
+	}
+
+	do
+	{
+		if (p == end || NULL == (p = sink_skip_name(p + 1, end, ",= ")) || p == end || '=' != *p)
+			return FAIL;
+
+		if (NULL == (p = sink_skip_value(p + 1, end)))
+			return FAIL;
+	}
+	while (p < end && ',' == *p);
+
+	if (p == end || ' ' != *p++ || p == end)
+		return FAIL;
+
+	if ('-' == *p)
+		p++;
+
+	for (; p < end; p++)
+	{
+		if ('0' > *p || '9' < *p)
+			return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+static void	sink_check_payload(const char *data, size_t len)
+{
+	const char	*p = data, *end = data + len, *eol;
+	zbx_uint64_t	lines = 0, invalid = 0;
+
+	for (; p < end; p = eol + 1)
+	{
+		if (NULL == (eol = lp_line_end(p, end)))
+			eol = end;
+
+		if (eol == p)
+			continue;
+
+		lines++;
+
+		if (SUCCEED == sink_check_line(p, eol))
+			continue;
+
+		if (SINK_INVALID_SHOWN > __atomic_fetch_add(&sink_invalid, 1, __ATOMIC_RELAXED))
+			fprintf(stderr, "invalid line: %.*s\n", (int)(eol - p), p);
+
+		invalid++;
+	}
+
+	__atomic_fetch_add(&sink_lines, lines, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sink_payload_bytes, len, __ATOMIC_RELAXED);
+}
+
+/* inflates a gzip body, returns NULL if it is not valid gzip */
+static char	*sink_gunzip(const char *data, size_t len, size_t *out_len)
+{
+	z_stream	stream;
+	char		*out;
+	size_t		alloc = len * 4 + 1024;
+	int		rc;
+
+	memset(&stream, 0, sizeof(stream));
+
+	if (Z_OK != inflateInit2(&stream, 15 + 16))
+		return NULL;
+
+	out = (char *)zbx_malloc(NULL, alloc);
+	stream.next_in = (unsigned char *)data;
+	stream.avail_in = (unsigned int)len;
+
+	do
+	{
+		if (stream.total_out == alloc)
+		{
+			alloc *= 2;
+			out = (char *)zbx_realloc(out, alloc);
+		}
+
+		stream.next_out = (unsigned char *)out + stream.total_out;
+		stream.avail_out = (unsigned int)(alloc - stream.total_out);
+	}
+	while (Z_OK == (rc = inflate(&stream, Z_NO_FLUSH)));
+
+	*out_len = stream.total_out;
+	inflateEnd(&stream);
+
+	if (Z_STREAM_END != rc)
+		zbx_free(out);
+
+	return out;
+}
+
+/* finds a header in the request head, returns its value or NULL */
+static const char	*sink_header(const char *head, const char *name, size_t *len)
+{
+	const char	*p;
+	size_t		name_len = strlen(name);
+
+	for (p = strstr(head, "\r\n"); NULL != p && 0 != strncmp(p, "\r\n\r\n", 4); p = strstr(p + 2, "\r\n"))
+	{
+		if (0 != strncasecmp(p + 2, name, name_len) || ':' != p[2 + name_len])
+			continue;
+
+		for (p += 3 + name_len; ' ' == *p; p++)
+			;
+
+		*len = (size_t)(strstr(p, "\r\n") - p);
+
+		return p;
+	}
+
+	return NULL;
+}
+
+static int	sink_write(int fd, const char *str)
+{
+	size_t	len = strlen(str);
+	ssize_t	n;
+
+	while (0 != len)
+	{
+		if (0 >= (n = write(fd, str, len)))
+			return FAIL;
+
+		str += n;
+		len -= (size_t)n;
+	}
+
+	return SUCCEED;
+}
+
+/* reads until at least len bytes are buffered */
+static int	sink_read(sink_conn_t *conn, size_t len)
+{
+	ssize_t	n;
+
+	while (conn->len < len)
+	{
+		if (conn->alloc < len + 1)
+		{
+			conn->alloc = MAX(len + 1, conn->alloc * 2);
+			conn->buf = (char *)zbx_realloc(conn->buf, conn->alloc);
+		}
+
+		if (0 >= (n = read(conn->fd, conn->buf + conn->len, MAX(len, conn->alloc - 1) - conn->len)))
+			return FAIL;
+
+		conn->len += (size_t)n;
+	}
+
+	conn->buf[conn->len] = '\0';
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: sink_request                                                     *
+ *                                                                            *
+ * Purpose: serves one write request of a keep-alive connection               *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the connection is to be closed            *
+ *                                                                            *
+ ******************************************************************************/
+static int	sink_request(sink_conn_t *conn)
+{
+	const char	*value;
+	char		*head_end, *body, *plain;
+	size_t		head_len, body_len, plain_len, len;
+	int		gzip;
+
+	for (head_end = NULL; NULL == head_end; head_end = strstr(conn->buf, "\r\n\r\n"))
+	{
+		if (0 != conn->len && NULL != (head_end = strstr(conn->buf, "\r\n\r\n")))
+			break;
+
+		if (SUCCEED != sink_read(conn, conn->len + 1))
+			return FAIL;
+	}
+
+	head_len = (size_t)(head_end - conn->buf) + 4;
+
+	if (NULL == (value = sink_header(conn->buf, "Content-Length", &len)))
+		return FAIL;
+
+	body_len = strtoul(value, NULL, 10);
+	gzip = (NULL != (value = sink_header(conn->buf, "Content-Encoding", &len)) && 0 == strncmp(value, "gzip", 4));
+
+	if (NULL != sink_header(conn->buf, "Expect", &len) && conn->len == head_len &&
+			SUCCEED != sink_write(conn->fd, "HTTP/1.1 100 Continue\r\n\r\n"))
+	{
+		return FAIL;
+	}
+
+	if (SUCCEED != sink_read(conn, head_len + body_len))
+		return FAIL;
+
+	body = conn->buf + head_len;
+	__atomic_fetch_add(&sink_wire_bytes, body_len, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sink_requests, 1, __ATOMIC_RELAXED);
+
+	if (0 == gzip)
+		sink_check_payload(body, body_len);
+	else if (NULL != (plain = sink_gunzip(body, body_len, &plain_len)))
+	{
+		sink_check_payload(plain, plain_len);
+		zbx_free(plain);
+	}
+	else
+	{
+		fprintf(stderr, "invalid gzip body of %zu bytes\n", body_len);
+		__atomic_fetch_add(&sink_invalid, 1, __ATOMIC_RELAXED);
+	}
+
+	// the next request may be in the buffer already
+	conn->len -= head_len + body_len;
+	memmove(conn->buf, conn->buf + head_len + body_len, conn->len + 1);
+
+	if (0 != sink_delay_us)
+		usleep((useconds_t)sink_delay_us);
+
+	return sink_write(conn->fd, "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n");
+}
+
+static void	*sink_conn_main(void *arg)
+{
+	sink_conn_t	conn;
+
+	memset(&conn, 0, sizeof(conn));
+	conn.fd = (int)(intptr_t)arg;
+
+	while (SUCCEED == sink_request(&conn))
+		;
+
+	close(conn.fd);
+	zbx_free(conn.buf);
+
+	return NULL;
+}
+
+static void	*sink_main(void *arg)
+{
+	pthread_t	thread;
+	int		listen_fd = (int)(intptr_t)arg, fd;
+
+	for (;;)
+	{
+		if (-1 == (fd = accept(listen_fd, NULL, NULL)))
+			continue;
+
+		if (0 != pthread_create(&thread, NULL, sink_conn_main, (void *)(intptr_t)fd))
+		{
+			close(fd);
+			continue;
+		}
+
+		pthread_detach(thread);
+	}
+
+	return NULL;
+}
+
+static zbx_uint64_t	bench_clock_us(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (zbx_uint64_t)ts.tv_sec * 1000000 + (zbx_uint64_t)ts.tv_nsec / 1000;
+}
+
+static void	*sink_udp_main(void *arg)
+{
+	char	*buf;
+	int	fd = (int)(intptr_t)arg;
+	ssize_t	len;
+
+	buf = (char *)zbx_malloc(NULL, 65536);
+
+	for (;;)
+	{
+		if (0 >= (len = recv(fd, buf, 65536, 0)))
+			continue;
+
+		__atomic_fetch_add(&sink_wire_bytes, (zbx_uint64_t)len, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&sink_requests, 1, __ATOMIC_RELAXED);
+		sink_check_payload(buf, (size_t)len);
+		__atomic_store_n(&sink_last_us, bench_clock_us(), __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/* removes the socket of the sink at exit */
+static void	sink_remove_socket(void)
+{
+	if (NULL == sink_socket_path)
+		return;
+
+	unlink(sink_socket_path);
+	zbx_free(sink_socket_path);
+}
+
+/* starts the sink on a Unix socket */
+static void	sink_start_unix(void)
+{
+	struct sockaddr_un	addr;
+	pthread_t		thread;
+	int			fd;
+
+	sink_socket_path = zbx_dsprintf(NULL, "/tmp/history_influxdb_bench.%d.sock", (int)getpid());
+	unlink(sink_socket_path);
+	atexit(sink_remove_socket);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	zbx_strlcpy(addr.sun_path, sink_socket_path, sizeof(addr.sun_path));
+
+	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0)) || 0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+			0 != listen(fd, 128) || 0 != pthread_create(&thread, NULL, sink_main, (void *)(intptr_t)fd))
+	{
+		zbx_error("cannot start HTTP sink on %s: %s", sink_socket_path, zbx_strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* starts the sink on a free loopback port, returns the port */
+static int	sink_start(int type)
+{
+	struct sockaddr_in	addr;
+	socklen_t		addr_len = sizeof(addr);
+	pthread_t		thread;
+	int			fd, rcvbuf = 64 * ZBX_MEBIBYTE;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (SOCK_DGRAM == type)
+	{
+		/* a large buffer, datagrams the sink cannot take in time are lost (above rmem_max as root) */
+		if (-1 != (fd = socket(AF_INET, SOCK_DGRAM, 0)) &&
+				0 != setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)))
+		{
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		}
+
+		if (-1 == fd || 0 != bind(fd, (struct sockaddr *)&addr, addr_len) ||
+				0 != getsockname(fd, (struct sockaddr *)&addr, &addr_len) ||
+				0 != pthread_create(&thread, NULL, sink_udp_main, (void *)(intptr_t)fd))
+		{
+			zbx_error("cannot start UDP sink: %s", zbx_strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		return ntohs(addr.sin_port);
+	}
+
+	if (-1 == (fd = socket(AF_INET, SOCK_STREAM, 0)) || 0 != bind(fd, (struct sockaddr *)&addr, addr_len) ||
+			0 != listen(fd, 128) || 0 != getsockname(fd, (struct sockaddr *)&addr, &addr_len) ||
+			0 != pthread_create(&thread, NULL, sink_main, (void *)(intptr_t)fd))
+	{
+		zbx_error("cannot start HTTP sink: %s", zbx_strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return ntohs(addr.sin_port);
+}
+
+/* removes the config also when zbx_module_init() exits on a bad parameter */
+static void	bench_remove_config(void)
+{
+	char	*path;
+
+	if (NULL == config_dir)
+		return;
+
+	path = zbx_dsprintf(NULL, "%s/history_influxdb.conf", config_dir);
+	unlink(path);
+	zbx_free(path);
+	rmdir(config_dir);
+	zbx_free(config_dir);
+}
+
+/* writes the module config into a new temporary directory, returns the directory */
+static char	*bench_write_config(const char *transport, int port, char **options, int options_num)
+{
+	char	*dir, *path;
+	FILE	*file;
+	int	i;
+
+	dir = zbx_strdup(NULL, "/tmp/history_influxdb_bench.XXXXXX");
+
+	if (NULL == mkdtemp(dir))
+	{
+		zbx_error("cannot create temporary directory: %s", zbx_strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	path = zbx_dsprintf(NULL, "%s/history_influxdb.conf", dir);
+
+	if (NULL == (file = fopen(path, "w")))
+	{
+		zbx_error("cannot create \"%s\": %s", path, zbx_strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(file, "InfluxDBAddress=%s\nInfluxDBPortNumber=%d\nInfluxDBName=bench\nInfluxDBTransport=%s\n",
+			NULL != sink_socket_path ? sink_socket_path : "127.0.0.1", port, transport);
+
+	for (i = 0; i < options_num; i++)
+		fprintf(file, "%s\n", options[i]);
+
+	fclose(file);
+	zbx_free(path);
+
+	return dir;
+}
+
+static int	bench_parse_types(char *types)
+{
+	char	*type;
+	int	mask = 0;
+
+	for (type = strtok(types, ","); NULL != type; type = strtok(NULL, ","))
+	{
+		if (0 == strcmp(type, "float"))
+			mask |= BENCH_TYPE_FLOAT;
+		else if (0 == strcmp(type, "integer"))
+			mask |= BENCH_TYPE_INTEGER;
+		else if (0 == strcmp(type, "string"))
+			mask |= BENCH_TYPE_STRING;
+		else if (0 == strcmp(type, "text"))
+			mask |= BENCH_TYPE_TEXT;
+		else if (0 == strcmp(type, "log"))
+			mask |= BENCH_TYPE_LOG;
+		else
+			return 0;
+	}
+
+	return mask;
+}
+
+/* gets the value of a module item key[param1,param2] the way a Zabbix poller does */
+static int	bench_module_item(const char *key, char *param1, char *param2, AGENT_RESULT *result)
+{
+	ZBX_METRIC	*metric;
+	AGENT_REQUEST	request;
+	char		*params[2] = {param1, param2};
+
+	memset(result, 0, sizeof(AGENT_RESULT));
+
+	for (metric = zbx_module_item_list(); NULL != metric->key; metric++)
+	{
+		if (0 != strcmp(metric->key, key))
+			continue;
+
+		memset(&request, 0, sizeof(request));
+		request.nparam = NULL == param2 ? 1 : 2;
+		request.params = params;
+
+		if (SYSINFO_RET_OK == metric->function(&request, result))
+			return SUCCEED;
+
+		zbx_free(result->msg);
+		break;
+	}
+
+	return FAIL;
+}
+
+/* reads influxdb.module.latency[write,<percentile>] of the module, in milliseconds */
+static double	bench_module_latency_ms(char *percentile)
+{
+	AGENT_RESULT	result;
+
+	return SUCCEED == bench_module_item("influxdb.module.latency", "write", percentile, &result) ? result.dbl : -1;
+}
+
+static int	bench_compare_uint64(const void *d1, const void *d2)
+{
+	const zbx_uint64_t	*i1 = (const zbx_uint64_t *)d1, *i2 = (const zbx_uint64_t *)d2;
+
+	return *i1 < *i2 ? -1 : *i1 > *i2;
+}
+
+static double	bench_percentile_ms(const zbx_uint64_t *sorted, int num, double percentile)
+{
+	int	i = (int)(num * percentile / 100);
+
+	return (double)sorted[MIN(i, num - 1)] / 1000;
+}
+
+int	main(int argc, char **argv)
+{
+	ZBX_HISTORY_WRITE_CBS	cbs;
+	ZBX_HISTORY_FLOAT	*history_float;
+	ZBX_HISTORY_INTEGER	*history_integer;
+	ZBX_HISTORY_STRING	*history_string;
+	ZBX_HISTORY_TEXT	*history_text;
+	ZBX_HISTORY_LOG		*history_log;
+	bench_shared_t		*shared;
+	size_t			shared_size;
+	pid_t			pid;
+	zbx_uint64_t		*latencies, start, call_start, elapsed, values, filtered = 0, suppressed = 0,
+				rollups = 0, coalesced = 0, truncated = 0, udp_dropped = 0,
+				ring_overflows = 0;
+	AGENT_RESULT		result;
+	double			write_p50, write_p99;
+	char			**options = NULL, **strings, **texts, types_all[] = "float,integer,string";
+	const char		*transport = "tcp";
+	int			batches = 100, n = 1000, items = 1000, types, types_num, calls = 0, opt, options_num = 0;
+	int			b, i, item, clock, processes = 1, process, ret = EXIT_SUCCESS;
+
+	types = bench_parse_types(types_all);
+
+	while (-1 != (opt = getopt(argc, argv, "b:n:c:H:t:d:l:p:T:o:v")))
+	{
+		switch (opt)
+		{
+			case 'b':
+				batches = atoi(optarg);
+				break;
+			case 'n':
+				n = atoi(optarg);
+				break;
+			case 'c':
+				items = atoi(optarg);
+				break;
+			case 'H':
+				bench_hosts = atoi(optarg);
+				break;
+			case 't':
+				types = bench_parse_types(optarg);
+				break;
+			case 'd':
+				bench_db_delay_us = atoi(optarg);
+				break;
+			case 'l':
+				sink_delay_us = atoi(optarg);
+				break;
+			case 'p':
+				processes = atoi(optarg);
+				break;
+			case 'T':
+				transport = optarg;
+				break;
+			case 'o':
+				options = (char **)zbx_realloc(options, sizeof(char *) * (size_t)(options_num + 1));
+				options[options_num++] = optarg;
+				break;
+			case 'v':
+				bench_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (0 >= batches || 0 >= n || 0 >= items || 0 >= bench_hosts || 0 == types || 0 >= processes || optind != argc)
+		usage(argv[0]);
+
+	if (0 != strcmp(transport, "tcp") && 0 != strcmp(transport, "unix") && 0 != strcmp(transport, "udp"))
+		usage(argv[0]);
+
+	types_num = !!(types & BENCH_TYPE_FLOAT) + !!(types & BENCH_TYPE_INTEGER) + !!(types & BENCH_TYPE_STRING) +
+			!!(types & BENCH_TYPE_TEXT) + !!(types & BENCH_TYPE_LOG);
+
+	/* items 1..items are float, then integer, string, text and log */
+	bench_items = items * 5;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (0 == strcmp(transport, "unix"))
+	{
+		sink_start_unix();
+		config_dir = bench_write_config(transport, 0, options, options_num);
+	}
+	else
+	{
+		config_dir = bench_write_config(transport, sink_start(0 == strcmp(transport, "udp") ? SOCK_DGRAM :
+				SOCK_STREAM), options, options_num);
+	}
+
+	CONFIG_LOAD_MODULE_PATH = config_dir;
+	atexit(bench_remove_config);
+
+	if (ZBX_MODULE_OK != zbx_module_init())
+	{
+		zbx_error("zbx_module_init() failed");
+		return EXIT_FAILURE;
+	}
+
+	bench_remove_config();
+	cbs = zbx_module_history_write_cbs();
+
+	history_float = (ZBX_HISTORY_FLOAT *)zbx_malloc(NULL, sizeof(ZBX_HISTORY_FLOAT) * (size_t)n);
+	history_integer = (ZBX_HISTORY_INTEGER *)zbx_malloc(NULL, sizeof(ZBX_HISTORY_INTEGER) * (size_t)n);
+	history_string = (ZBX_HISTORY_STRING *)zbx_malloc(NULL, sizeof(ZBX_HISTORY_STRING) * (size_t)n);
+	history_text = (ZBX_HISTORY_TEXT *)zbx_malloc(NULL, sizeof(ZBX_HISTORY_TEXT) * (size_t)n);
+	history_log = (ZBX_HISTORY_LOG *)zbx_malloc(NULL, sizeof(ZBX_HISTORY_LOG) * (size_t)n);
+	shared_size = sizeof(bench_shared_t) + sizeof(zbx_uint64_t) * (size_t)(batches * types_num * processes);
+
+	if (MAP_FAILED == (shared = (bench_shared_t *)mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+	{
+		zbx_error("cannot map shared memory: %s", zbx_strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* a handful of distinct strings, with spaces and commas but nothing needing escaping in a field */
+	strings = (char **)zbx_malloc(NULL, sizeof(char *) * BENCH_STRINGS);
+
+	for (i = 0; i < BENCH_STRINGS; i++)
+		strings[i] = zbx_dsprintf(NULL, "state %d, all %s", i, 0 == i % 2 ? "good" : "well");
+
+	/* texts of 1 to 16 KB, one line repeated, for text and log values */
+	texts = (char **)zbx_malloc(NULL, sizeof(char *) * BENCH_STRINGS);
+
+	for (i = 0; i < BENCH_STRINGS; i++)
+	{
+		static const char	line[] = "2024-05-01 12:00:00 \"GET /api?q=a\\b\" 200 caf\xc3\xa9 r\xc3\xa9sum\xc3\xa9"
+						" done in 12 ms\n";
+		size_t			alloc = ZBX_KIBIBYTE * (size_t)(i + 1) + sizeof(line), offset = 0;
+
+		texts[i] = (char *)zbx_malloc(NULL, alloc);
+
+		while (offset + sizeof(line) <= ZBX_KIBIBYTE * (size_t)(i + 1))
+		{
+			memcpy(texts[i] + offset, line, sizeof(line) - 1);
+			offset += sizeof(line) - 1;
+		}
+
+		texts[i][offset] = '\0';
+	}
+
+	clock = (int)time(NULL) - batches;
+	start = bench_clock_us();
+	fflush(stdout);
+
+	/* the module is initialised before the processes are forked, as in Zabbix server */
+	for (process = 1; process < processes; process++)
+	{
+		if (-1 == (pid = fork()))
+		{
+			zbx_error("cannot fork: %s", zbx_strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+		if (0 == pid)
+			break;
+	}
+
+	if (process == processes)
+		process = 0;
+
+	latencies = shared->latencies + (size_t)(process * batches * types_num);
+
+	for (b = 0; b < batches; b++)
+	{
+		for (i = 0; i < n; i++)
+		{
+			item = (int)(((zbx_uint64_t)b * (zbx_uint64_t)n + (zbx_uint64_t)i) % (zbx_uint64_t)items);
+
+			history_float[i].itemid = (zbx_uint64_t)item + 1;
+			history_float[i].clock = clock + b;
+			history_float[i].ns = i;
+			history_float[i].value = (item % 100) * 1.25 + i / 1000.0;
+
+			history_integer[i].itemid = (zbx_uint64_t)(items + item) + 1;
+			history_integer[i].clock = clock + b;
+			history_integer[i].ns = i;
+			history_integer[i].value = (zbx_uint64_t)item * 1048576 + (zbx_uint64_t)i;
+
+			history_string[i].itemid = (zbx_uint64_t)(items * 2 + item) + 1;
+			history_string[i].clock = clock + b;
+			history_string[i].ns = i;
+			history_string[i].value = strings[(item + b) % BENCH_STRINGS];
+
+			history_text[i].itemid = (zbx_uint64_t)(items * 3 + item) + 1;
+			history_text[i].clock = clock + b;
+			history_text[i].ns = i;
+			history_text[i].value = texts[(item + b) % BENCH_STRINGS];
+
+			history_log[i].itemid = (zbx_uint64_t)(items * 4 + item) + 1;
+			history_log[i].clock = clock + b;
+			history_log[i].ns = i;
+			history_log[i].value = texts[(item + b) % 4];
+			history_log[i].source = strings[item % BENCH_STRINGS];
+			history_log[i].timestamp = (0 == i % 2 ? clock + b : 0);
+			history_log[i].severity = item % 5;
+			history_log[i].logeventid = item;
+		}
+
+		if (0 != (types & BENCH_TYPE_FLOAT))
+		{
+			call_start = bench_clock_us();
+			cbs.history_float_cb(history_float, n);
+			latencies[calls++] = bench_clock_us() - call_start;
+		}
+
+		if (0 != (types & BENCH_TYPE_INTEGER))
+		{
+			call_start = bench_clock_us();
+			cbs.history_integer_cb(history_integer, n);
+			latencies[calls++] = bench_clock_us() - call_start;
+		}
+
+		if (0 != (types & BENCH_TYPE_STRING))
+		{
+			call_start = bench_clock_us();
+			cbs.history_string_cb(history_string, n);
+			latencies[calls++] = bench_clock_us() - call_start;
+		}
+
+		if (0 != (types & BENCH_TYPE_TEXT))
+		{
+			call_start = bench_clock_us();
+			cbs.history_text_cb(history_text, n);
+			latencies[calls++] = bench_clock_us() - call_start;
+		}
+
+		if (0 != (types & BENCH_TYPE_LOG))
+		{
+			call_start = bench_clock_us();
+			cbs.history_log_cb(history_log, n);
+			latencies[calls++] = bench_clock_us() - call_start;
+		}
+	}
+
+	/* forked processes write out what they have and leave the report to the first */
+	if (0 != process)
+	{
+		zbx_module_uninit();
+		__atomic_fetch_add(&shared->db_queries, bench_db_queries, __ATOMIC_RELAXED);
+		_exit(EXIT_SUCCESS);
+	}
+
+	while (0 < wait(NULL) || EINTR == errno)
+		;
+
+	latencies = shared->latencies;
+	calls *= processes;
+	bench_db_queries += shared->db_queries;
+
+	/* the statistics go with zbx_module_uninit(), writes still queued then are not in them */
+	write_p50 = bench_module_latency_ms("50");
+	write_p99 = bench_module_latency_ms("99");
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "filtered", NULL, &result))
+		filtered = result.ui64;
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "suppressed", NULL, &result))
+		suppressed = result.ui64;
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "rollups", NULL, &result))
+		rollups = result.ui64;
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "coalesced", NULL, &result))
+		coalesced = result.ui64;
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "truncated", NULL, &result))
+		truncated = result.ui64;
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "udp_dropped", NULL, &result))
+		udp_dropped = result.ui64;
+
+	if (SUCCEED == bench_module_item("influxdb.module.stats", "ring_overflows", NULL, &result))
+		ring_overflows = result.ui64;
+
+	zbx_module_uninit();
+	elapsed = MAX(bench_clock_us() - start, 1);
+
+	/* datagrams are not answered, wait for the sink to take what is still in its socket */
+	while (0 == strcmp(transport, "udp") &&
+			bench_clock_us() < __atomic_load_n(&sink_last_us, __ATOMIC_RELAXED) + SINK_UDP_IDLE_US)
+	{
+		usleep(SINK_UDP_IDLE_US / 10);
+	}
+	values = (zbx_uint64_t)calls * (zbx_uint64_t)n;
+
+	qsort(latencies, (size_t)calls, sizeof(zbx_uint64_t), bench_compare_uint64);
+
+	printf("batches:        %d x %d types x %d values, %d items per type on %d hosts, %d processes\n", batches,
+			types_num, n, items, bench_hosts, processes);
+	printf("values:         " ZBX_FS_UI64 " in %.3f s, %.0f values/s\n", values, elapsed / 1e6,
+			values * 1e6 / elapsed);
+	printf("payload:        %.1f bytes/value, %.1f on the wire\n", (double)sink_payload_bytes / values,
+			(double)sink_wire_bytes / values);
+	printf("batch latency:  p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			bench_percentile_ms(latencies, calls, 50), bench_percentile_ms(latencies, calls, 90),
+			bench_percentile_ms(latencies, calls, 99), (double)latencies[calls - 1] / 1000);
+	printf("write latency:  p50 %.3f ms, p99 %.3f ms (influxdb.module.latency)\n", write_p50, write_p99);
+	printf("sink:           " ZBX_FS_UI64 " requests, " ZBX_FS_UI64 " lines, " ZBX_FS_UI64 " invalid\n",
+			sink_requests, sink_lines, sink_invalid);
+	printf("not exported:   " ZBX_FS_UI64 " values filtered out, " ZBX_FS_UI64 " within a deadband\n", filtered,
+			suppressed);
+	printf("rollups:        " ZBX_FS_UI64 " points of closed windows\n", rollups);
+	printf("coalesced:      " ZBX_FS_UI64 " values written as fields of a point shared with others\n", coalesced);
+	printf("truncated:      " ZBX_FS_UI64 " string values longer than MaxValueLength\n", truncated);
+	printf("database:       " ZBX_FS_UI64 " queries\n", bench_db_queries);
+
+	if (0 != ring_overflows)
+		printf("ring overflows: " ZBX_FS_UI64 " batches written by their process, SharedWriter ring full\n", ring_overflows);
+
+	if (0 == strcmp(transport, "udp"))
+		printf("udp dropped:    " ZBX_FS_UI64 " lines the socket could not take\n", udp_dropped);
+
+	if (0 != sink_invalid || values - filtered - suppressed - coalesced + rollups - udp_dropped != sink_lines)
+	{
+		printf("FAILED: expected " ZBX_FS_UI64 " valid lines\n", values - filtered - suppressed - coalesced +
+				rollups - udp_dropped);
+		ret = EXIT_FAILURE;
+	}
+
+	for (i = 0; i < BENCH_STRINGS; i++)
+	{
+		zbx_free(strings[i]);
+		zbx_free(texts[i]);
+	}
+
+	zbx_free(strings);
+	zbx_free(texts);
+	munmap(shared, shared_size);
+	zbx_free(history_log);
+	zbx_free(history_text);
+	zbx_free(history_string);
+	zbx_free(history_integer);
+	zbx_free(history_float);
+	zbx_free(options);
+
+	return ret;
+}
@@ -0,0 +1,17 @@
+#ifndef __ZABBIX_BENCH_H
+#define __ZABBIX_BENCH_H
+
+
+#include "common.h"
+
+/* synthetic Zabbix database, see db_stub.c */
+extern int		bench_items;
+extern int		bench_hosts;
+extern int		bench_db_delay_us;
+extern zbx_uint64_t	bench_db_queries;
+
+/* messages of this level and more important are printed */
+extern int		bench_log_level;
+
+
+#endif /* __ZABBIX_BENCH_H */
@@ -0,0 +1,231 @@
+// synthetic Zabbix database the module reads item metadata from
+// 1] bench_items items spread round robin over bench_hosts hosts, item N is named
+//    "Bench item $1" with key bench.value[N] (so $1 expansion is part of the work)
+//    and belongs to application "Bench", every host is in two host groups
+// 2] the ids a query is restricted to are taken from DBadd_condition_alloc(), no
+//    SQL is parsed, a query without a condition (prewarm) returns all rows
+// 3] every query costs bench_db_delay_us microseconds, to see how much of a batch
+//    is spent waiting for the database
+
+#include "common.h"
+#include "db.h"
+#include "bench.h"
+
+int		bench_items = 1000;
+int		bench_hosts = 100;
+int		bench_db_delay_us = 0;
+zbx_uint64_t	bench_db_queries = 0;
+
+struct zbx_db_result
+{
+	char	**cells;
+	int	cols;
+	int	rows;
+	int	rows_alloc;
+	int	row;
+};
+
+/* ids of the last condition built, consumed by the following query */
+static zbx_uint64_t	*condition_ids = NULL;
+static int		condition_ids_num = -1, condition_ids_alloc = 0;
+
+static void	db_add_row(DB_RESULT result, char **cells)
+{
+	int	i;
+
+	if (result->rows == result->rows_alloc)
+	{
+		result->rows_alloc = (0 == result->rows_alloc ? 64 : result->rows_alloc * 2);
+		result->cells = (char **)zbx_realloc(result->cells, sizeof(char *) *
+				(size_t)(result->rows_alloc * result->cols));
+	}
+
+	for (i = 0; i < result->cols; i++)
+		result->cells[result->rows * result->cols + i] = zbx_strdup(NULL, cells[i]);
+
+	result->rows++;
+}
+
+/* itemid, hostid, name, key_, host name */
+static void	db_item_rows(DB_RESULT result, zbx_uint64_t itemid)
+{
+	char		id[32], hostid[32], key[64], host_name[64], *cells[5];
+	zbx_uint64_t	host = (itemid - 1) % (zbx_uint64_t)bench_hosts + 1;
+
+	if (0 == itemid || itemid > (zbx_uint64_t)bench_items)
+		return;
+
+	snprintf(id, sizeof(id), ZBX_FS_UI64, itemid);
+	snprintf(hostid, sizeof(hostid), ZBX_FS_UI64, host);
+	snprintf(key, sizeof(key), "bench.value[" ZBX_FS_UI64 "]", itemid);
+	snprintf(host_name, sizeof(host_name), "Bench host " ZBX_FS_UI64, host);
+
+	cells[0] = id;
+	cells[1] = hostid;
+	cells[2] = "Bench item $1";
+	cells[3] = key;
+	cells[4] = host_name;
+	db_add_row(result, cells);
+}
+
+/* hostid, group name - in name order */
+static void	db_group_rows(DB_RESULT result, zbx_uint64_t hostid)
+{
+	char	id[32], *cells[2];
+
+	if (0 == hostid || hostid > (zbx_uint64_t)bench_hosts)
+		return;
+
+	snprintf(id, sizeof(id), ZBX_FS_UI64, hostid);
+	cells[0] = id;
+	cells[1] = "Bench servers";
+	db_add_row(result, cells);
+	cells[1] = "Linux servers";
+	db_add_row(result, cells);
+}
+
+/* itemid, application name */
+static void	db_application_rows(DB_RESULT result, zbx_uint64_t itemid)
+{
+	char	id[32], *cells[2];
+
+	if (0 == itemid || itemid > (zbx_uint64_t)bench_items)
+		return;
+
+	snprintf(id, sizeof(id), ZBX_FS_UI64, itemid);
+	cells[0] = id;
+	cells[1] = "Bench";
+	db_add_row(result, cells);
+}
+
+static DB_RESULT	db_query(const char *sql, int limit)
+{
+	DB_RESULT	result;
+	void		(*add_rows)(DB_RESULT, zbx_uint64_t);
+	zbx_uint64_t	id, last;
+	int		i;
+
+	bench_db_queries++;
+
+	if (0 != bench_db_delay_us)
+		usleep((useconds_t)bench_db_delay_us);
+
+	result = (DB_RESULT)zbx_malloc(NULL, sizeof(struct zbx_db_result));
+	memset(result, 0, sizeof(struct zbx_db_result));
+
+	if (NULL != strstr(sql, "items_applications"))
+	{
+		add_rows = db_application_rows;
+		result->cols = 2;
+		last = (zbx_uint64_t)bench_items;
+	}
+	else if (NULL != strstr(sql, "hosts_groups"))
+	{
+		add_rows = db_group_rows;
+		result->cols = 2;
+		last = (zbx_uint64_t)bench_hosts;
+	}
+	else
+	{
+		add_rows = db_item_rows;
+		result->cols = 5;
+		last = (zbx_uint64_t)bench_items;
+	}
+
+	if (-1 == condition_ids_num)
+	{
+		for (id = 1; id <= last && (0 == limit || result->rows < limit); id++)
+			add_rows(result, id);
+	}
+	else
+	{
+		for (i = 0; i < condition_ids_num; i++)
+			add_rows(result, condition_ids[i]);
+	}
+
+	condition_ids_num = -1;
+
+	return result;
+}
+
+int	DBconnect(int flag)
+{
+	ZBX_UNUSED(flag);
+
+	return ZBX_DB_OK;
+}
+
+void	DBclose(void)
+{
+}
+
+DB_RESULT	DBselect(const char *fmt, ...)
+{
+	DB_RESULT	result;
+	va_list		args;
+	char		*sql;
+
+	va_start(args, fmt);
+
+	if (0 > vasprintf(&sql, fmt, args))
+	{
+		zbx_error("DBselect: out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	va_end(args);
+	result = db_query(sql, 0);
+	free(sql);
+
+	return result;
+}
+
+DB_RESULT	DBselectN(const char *query, int n)
+{
+	return db_query(query, n);
+}
+
+DB_ROW	DBfetch(DB_RESULT result)
+{
+	if (NULL == result || result->row >= result->rows)
+		return NULL;
+
+	return &result->cells[result->row++ * result->cols];
+}
+
+void	DBfree_result(DB_RESULT result)
+{
+	int	i;
+
+	if (NULL == result)
+		return;
+
+	for (i = 0; i < result->rows * result->cols; i++)
+		zbx_free(result->cells[i]);
+
+	zbx_free(result->cells);
+	zbx_free(result);
+}
+
+void	DBadd_condition_alloc(char **sql, size_t *sql_alloc, size_t *sql_offset, const char *fieldname,
+		const zbx_uint64_t *values, const int num)
+{
+	int	i;
+
+	if (num > condition_ids_alloc)
+	{
+		condition_ids_alloc = num;
+		condition_ids = (zbx_uint64_t *)zbx_realloc(condition_ids, sizeof(zbx_uint64_t) * (size_t)num);
+	}
+
+	memcpy(condition_ids, values, sizeof(zbx_uint64_t) * (size_t)num);
+	condition_ids_num = num;
+
+	zbx_snprintf_alloc(sql, sql_alloc, sql_offset, " %s in (", fieldname);
+
+	for (i = 0; i < num; i++)
+		zbx_snprintf_alloc(sql, sql_alloc, sql_offset, ZBX_FS_UI64 "%s", values[i], i + 1 < num ? "," : ")");
+
+	if (0 == num)
+		zbx_strcpy_alloc(sql, sql_alloc, sql_offset, "0)");
+}
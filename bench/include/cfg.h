@@ -0,0 +1,34 @@
+/* subset of Zabbix include/cfg.h the module needs, for the benchmark only */
+#ifndef __ZABBIX_CFG_H
+#define __ZABBIX_CFG_H
+
+#include "common.h"
+
+#define TYPE_INT		0
+#define TYPE_STRING		1
+#define TYPE_MULTISTRING	2
+#define TYPE_UINT64		3
+#define TYPE_STRING_LIST	4
+
+#define PARM_OPT	0
+#define PARM_MAND	1
+
+#define ZBX_CFG_FILE_REQUIRED	0
+#define ZBX_CFG_FILE_OPTIONAL	1
+
+#define ZBX_CFG_NOT_STRICT	0
+#define ZBX_CFG_STRICT		1
+
+struct cfg_line
+{
+	const char	*parameter;
+	void		*variable;
+	int		type;
+	int		mandatory;
+	zbx_uint64_t	min;
+	zbx_uint64_t	max;
+};
+
+int	parse_cfg_file(const char *cfg_file, struct cfg_line *cfg, int optional, int strict);
+
+#endif
@@ -0,0 +1,81 @@
+/* subset of Zabbix include/common.h the module needs, for the benchmark only */
+#ifndef __ZABBIX_COMMON_H
+#define __ZABBIX_COMMON_H
+
+#include "sysinc.h"
+
+typedef uint64_t	zbx_uint64_t;
+typedef int64_t		zbx_int64_t;
+
+#define ZBX_FS_UI64	"%" PRIu64
+
+#define ZBX_MAX_UINT64	(~(zbx_uint64_t)0)
+
+#define SUCCEED		0
+#define FAIL		-1
+
+#define ZBX_KIBIBYTE	1024
+#define ZBX_MEBIBYTE	1048576
+#define ZBX_GIBIBYTE	1073741824
+
+#define SEC_PER_MIN	60
+#define SEC_PER_HOUR	3600
+#define SEC_PER_DAY	86400
+#define SEC_PER_WEEK	(7 * SEC_PER_DAY)
+
+#define THIS_SHOULD_NEVER_HAPPEN	zbx_error("ERROR [file:%s,line:%d] Something impossible has just happened.", \
+						__FILE__, __LINE__)
+
+#define ZBX_UNUSED(var)			(void)(var)
+#define ZBX_NULL2EMPTY_STR(str)		(NULL != (str) ? (str) : "")
+#define ZBX_CONST_STRLEN(str)		(sizeof(str) - 1)
+#define ARRSIZE(a)			(sizeof(a) / sizeof(*a))
+
+#ifndef MIN
+#	define MIN(a, b)	((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#	define MAX(a, b)	((a) > (b) ? (a) : (b))
+#endif
+
+void	*zbx_malloc2(const char *filename, int line, void *old, size_t size);
+void	*zbx_realloc2(const char *filename, int line, void *old, size_t size);
+char	*zbx_strdup2(const char *filename, int line, char *old, const char *str);
+
+#define zbx_malloc(old, size)	zbx_malloc2(__FILE__, __LINE__, old, size)
+#define zbx_realloc(src, size)	zbx_realloc2(__FILE__, __LINE__, src, size)
+#define zbx_strdup(old, str)	zbx_strdup2(__FILE__, __LINE__, old, str)
+
+#define zbx_free(ptr)		\
+				\
+do				\
+{				\
+	if (NULL != ptr)	\
+	{			\
+		free(ptr);	\
+		ptr = NULL;	\
+	}			\
+}				\
+while (0)
+
+const char	*zbx_strerror(int errnum);
+void	zbx_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+char	*zbx_dsprintf(char *dest, const char *f, ...) __attribute__((format(printf, 2, 3)));
+size_t	zbx_strlcpy(char *dst, const char *src, size_t siz);
+void	zbx_snprintf_alloc(char **str, size_t *alloc_len, size_t *offset, const char *fmt, ...)
+		__attribute__((format(printf, 4, 5)));
+void	zbx_strncpy_alloc(char **str, size_t *alloc_len, size_t *offset, const char *src, size_t n);
+void	zbx_strcpy_alloc(char **str, size_t *alloc_len, size_t *offset, const char *src);
+void	zbx_chrcpy_alloc(char **str, size_t *alloc_len, size_t *offset, char c);
+void	zbx_lrtrim(char *str, const char *charlist);
+
+void	zbx_strarr_init(char ***arr);
+void	zbx_strarr_add(char ***arr, const char *entry);
+void	zbx_strarr_free(char **arr);
+
+int	is_uint64_n(const char *str, size_t n, zbx_uint64_t *value);
+#define is_uint64(str, value)		is_uint64_n(str, 0x7fffffff, value)
+#define ZBX_STR2UINT64(uint, string)	is_uint64(string, &uint)
+
+#endif
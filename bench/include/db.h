@@ -0,0 +1,23 @@
+/* subset of Zabbix include/db.h the module needs, for the benchmark only */
+#ifndef __ZABBIX_DB_H
+#define __ZABBIX_DB_H
+
+#include "common.h"
+
+#define ZBX_DB_OK		0
+#define ZBX_DB_CONNECT_NORMAL	0
+#define ZBX_DB_CONNECT_ONCE	1
+
+typedef struct zbx_db_result	*DB_RESULT;
+typedef char			**DB_ROW;
+
+int		DBconnect(int flag);
+void		DBclose(void);
+DB_RESULT	DBselect(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+DB_RESULT	DBselectN(const char *query, int n);
+DB_ROW		DBfetch(DB_RESULT result);
+void		DBfree_result(DB_RESULT result);
+void		DBadd_condition_alloc(char **sql, size_t *sql_alloc, size_t *sql_offset, const char *fieldname,
+		const zbx_uint64_t *values, const int num);
+
+#endif
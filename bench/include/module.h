@@ -0,0 +1,124 @@
+/* subset of Zabbix include/module.h the module needs, for the benchmark only */
+#ifndef __ZABBIX_MODULE_H
+#define __ZABBIX_MODULE_H
+
+#include "common.h"
+
+#define ZBX_MODULE_OK	0
+#define ZBX_MODULE_FAIL	-1
+
+#define ZBX_MODULE_API_VERSION	1
+
+#define SYSINFO_RET_OK		0
+#define SYSINFO_RET_FAIL	1
+
+#define CF_HAVEPARAMS	0x01
+
+typedef struct
+{
+	char		*key;
+	int		nparam;
+	char		**params;
+	zbx_uint64_t	lastlogsize;
+	int		mtime;
+}
+AGENT_REQUEST;
+
+typedef struct
+{
+	int		type;
+	zbx_uint64_t	ui64;
+	double		dbl;
+	char		*str;
+	char		*text;
+	char		*msg;
+}
+AGENT_RESULT;
+
+#define AR_UINT64	0x01
+#define AR_DOUBLE	0x02
+#define AR_STRING	0x04
+#define AR_MESSAGE	0x20
+
+#define get_rparam(request, num)	((request)->nparam > (num) ? (request)->params[num] : NULL)
+
+#define SET_UI64_RESULT(res, val)	((res)->type |= AR_UINT64, (res)->ui64 = (zbx_uint64_t)(val))
+#define SET_DBL_RESULT(res, val)	((res)->type |= AR_DOUBLE, (res)->dbl = (double)(val))
+#define SET_STR_RESULT(res, val)	((res)->type |= AR_STRING, (res)->str = (char *)(val))
+#define SET_MSG_RESULT(res, val)	((res)->type |= AR_MESSAGE, (res)->msg = (char *)(val))
+
+typedef struct
+{
+	char		*key;
+	unsigned	flags;
+	int		(*function)(AGENT_REQUEST *request, AGENT_RESULT *result);
+	char		*test_param;
+}
+ZBX_METRIC;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	int		clock;
+	int		ns;
+	double		value;
+}
+ZBX_HISTORY_FLOAT;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	int		clock;
+	int		ns;
+	zbx_uint64_t	value;
+}
+ZBX_HISTORY_INTEGER;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	int		clock;
+	int		ns;
+	const char	*value;
+}
+ZBX_HISTORY_STRING;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	int		clock;
+	int		ns;
+	const char	*value;
+}
+ZBX_HISTORY_TEXT;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	int		clock;
+	int		ns;
+	const char	*value;
+	const char	*source;
+	int		timestamp;
+	int		logeventid;
+	int		severity;
+}
+ZBX_HISTORY_LOG;
+
+typedef struct
+{
+	void	(*history_float_cb)(const ZBX_HISTORY_FLOAT *history, int history_num);
+	void	(*history_integer_cb)(const ZBX_HISTORY_INTEGER *history, int history_num);
+	void	(*history_string_cb)(const ZBX_HISTORY_STRING *history, int history_num);
+	void	(*history_text_cb)(const ZBX_HISTORY_TEXT *history, int history_num);
+	void	(*history_log_cb)(const ZBX_HISTORY_LOG *history, int history_num);
+}
+ZBX_HISTORY_WRITE_CBS;
+
+int			zbx_module_api_version(void);
+int			zbx_module_init(void);
+int			zbx_module_uninit(void);
+ZBX_METRIC		*zbx_module_item_list(void);
+ZBX_HISTORY_WRITE_CBS	zbx_module_history_write_cbs(void);
+
+#endif
@@ -0,0 +1,25 @@
+/* subset of Zabbix include/sysinc.h the module needs, for the benchmark only */
+#ifndef __ZABBIX_SYSINC_H
+#define __ZABBIX_SYSINC_H
+
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#endif
@@ -0,0 +1,95 @@
+/* subset of Zabbix include/zbxalgo.h the module needs, for the benchmark only */
+#ifndef __ZABBIX_ZBXALGO_H
+#define __ZABBIX_ZBXALGO_H
+
+#include "common.h"
+
+typedef zbx_uint64_t	zbx_hash_t;
+
+typedef zbx_hash_t	(*zbx_hash_func_t)(const void *data);
+typedef int		(*zbx_compare_func_t)(const void *d1, const void *d2);
+typedef void		(*zbx_clean_func_t)(void *data);
+
+zbx_hash_t	zbx_hash_modfnv(const void *data, size_t len, zbx_hash_t seed);
+
+#define ZBX_DEFAULT_HASH_ALGO		zbx_hash_modfnv
+#define ZBX_DEFAULT_STRING_HASH_ALGO	zbx_hash_modfnv
+#define ZBX_DEFAULT_HASH_SEED		0
+
+zbx_hash_t	zbx_default_uint64_hash_func(const void *data);
+zbx_hash_t	zbx_default_string_hash_func(const void *data);
+int		zbx_default_uint64_compare_func(const void *d1, const void *d2);
+int		zbx_default_str_compare_func(const void *d1, const void *d2);
+
+#define ZBX_DEFAULT_UINT64_HASH_FUNC	zbx_default_uint64_hash_func
+#define ZBX_DEFAULT_STRING_HASH_FUNC	zbx_default_string_hash_func
+#define ZBX_DEFAULT_UINT64_COMPARE_FUNC	zbx_default_uint64_compare_func
+#define ZBX_DEFAULT_STR_COMPARE_FUNC	zbx_default_str_compare_func
+
+typedef struct ZBX_HASHSET_ENTRY_T
+{
+	struct ZBX_HASHSET_ENTRY_T	*next;
+	zbx_hash_t			hash;
+	char				data[1];
+}
+ZBX_HASHSET_ENTRY_T;
+
+typedef struct
+{
+	ZBX_HASHSET_ENTRY_T	**slots;
+	int			num_slots;
+	int			num_data;
+	zbx_hash_func_t		hash_func;
+	zbx_compare_func_t	compare_func;
+}
+zbx_hashset_t;
+
+typedef struct
+{
+	zbx_hashset_t		*hashset;
+	int			slot;
+	ZBX_HASHSET_ENTRY_T	*entry;
+}
+zbx_hashset_iter_t;
+
+void	zbx_hashset_create(zbx_hashset_t *hs, size_t init_size, zbx_hash_func_t hash_func,
+		zbx_compare_func_t compare_func);
+void	zbx_hashset_destroy(zbx_hashset_t *hs);
+void	*zbx_hashset_insert(zbx_hashset_t *hs, const void *data, size_t size);
+void	*zbx_hashset_search(zbx_hashset_t *hs, const void *data);
+void	zbx_hashset_remove(zbx_hashset_t *hs, const void *data);
+void	zbx_hashset_clear(zbx_hashset_t *hs);
+void	zbx_hashset_iter_reset(zbx_hashset_t *hs, zbx_hashset_iter_t *iter);
+void	*zbx_hashset_iter_next(zbx_hashset_iter_t *iter);
+
+typedef struct
+{
+	zbx_uint64_t	*values;
+	int		values_num;
+	int		values_alloc;
+}
+zbx_vector_uint64_t;
+
+void	zbx_vector_uint64_create(zbx_vector_uint64_t *vector);
+void	zbx_vector_uint64_destroy(zbx_vector_uint64_t *vector);
+void	zbx_vector_uint64_reserve(zbx_vector_uint64_t *vector, size_t size);
+void	zbx_vector_uint64_append(zbx_vector_uint64_t *vector, zbx_uint64_t value);
+void	zbx_vector_uint64_sort(zbx_vector_uint64_t *vector, zbx_compare_func_t compare_func);
+void	zbx_vector_uint64_uniq(zbx_vector_uint64_t *vector, zbx_compare_func_t compare_func);
+void	zbx_vector_uint64_clear(zbx_vector_uint64_t *vector);
+
+typedef struct
+{
+	void	**values;
+	int	values_num;
+	int	values_alloc;
+}
+zbx_vector_ptr_t;
+
+void	zbx_vector_ptr_create(zbx_vector_ptr_t *vector);
+void	zbx_vector_ptr_destroy(zbx_vector_ptr_t *vector);
+void	zbx_vector_ptr_append(zbx_vector_ptr_t *vector, void *value);
+void	zbx_vector_ptr_clear_ext(zbx_vector_ptr_t *vector, zbx_clean_func_t clean_func);
+void	zbx_ptr_free(void *data);
+
+#endif
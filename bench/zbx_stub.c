@@ -0,0 +1,659 @@
+// the few Zabbix library functions the module calls, so that the benchmark links
+// without a built Zabbix tree
+// 1] memory and string helpers behave like their Zabbix counterparts, logging goes
+//    to stderr filtered by bench_log_level
+// 2] parse_cfg_file() reads Parameter=value lines of the types the module uses,
+//    values out of range or unknown parameters end the benchmark like they would
+//    stop Zabbix server
+// 3] zbx_hashset and zbx_vector are plain chained hash table and array, without
+//    the shared memory allocators of the originals
+
+#include "common.h"
+#include "log.h"
+#include "cfg.h"
+#include "zbxalgo.h"
+#include "bench.h"
+
+#include <ctype.h>
+
+char	*CONFIG_LOAD_MODULE_PATH = NULL;
+
+void	*zbx_malloc2(const char *filename, int line, void *old, size_t size)
+{
+	void	*ptr;
+
+	if (NULL != old)
+	{
+		zbx_error("[file:%s,line:%d] zbx_malloc: allocating already allocated memory", filename, line);
+		abort();
+	}
+
+	if (NULL == (ptr = malloc(0 != size ? size : 1)))
+	{
+		zbx_error("[file:%s,line:%d] zbx_malloc: out of memory, requested " ZBX_FS_UI64 " bytes", filename,
+				line, (zbx_uint64_t)size);
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+void	*zbx_realloc2(const char *filename, int line, void *old, size_t size)
+{
+	void	*ptr;
+
+	if (NULL == (ptr = realloc(old, 0 != size ? size : 1)))
+	{
+		zbx_error("[file:%s,line:%d] zbx_realloc: out of memory, requested " ZBX_FS_UI64 " bytes", filename,
+				line, (zbx_uint64_t)size);
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+char	*zbx_strdup2(const char *filename, int line, char *old, const char *str)
+{
+	size_t	len = strlen(str) + 1;
+
+	free(old);
+
+	return (char *)memcpy(zbx_malloc2(filename, line, NULL, len), str, len);
+}
+
+const char	*zbx_strerror(int errnum)
+{
+	return strerror(errnum);
+}
+
+void	zbx_error(const char *fmt, ...)
+{
+	va_list	args;
+
+	va_start(args, fmt);
+	fprintf(stderr, "%d: ", (int)getpid());
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+}
+
+void	__zbx_zabbix_log(int level, const char *fmt, ...)
+{
+	va_list	args;
+
+	if (LOG_LEVEL_INFORMATION == level)
+		level = LOG_LEVEL_WARNING;
+
+	if (level > bench_log_level)
+		return;
+
+	va_start(args, fmt);
+	fprintf(stderr, "%d: ", (int)getpid());
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+}
+
+char	*zbx_dsprintf(char *dest, const char *f, ...)
+{
+	va_list	args;
+	char	*str;
+
+	va_start(args, f);
+
+	if (0 > vasprintf(&str, f, args))
+	{
+		zbx_error("zbx_dsprintf: out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	va_end(args);
+	free(dest);
+
+	return str;
+}
+
+size_t	zbx_strlcpy(char *dst, const char *src, size_t siz)
+{
+	const char	*s = src;
+
+	if (0 != siz)
+	{
+		while (0 != --siz && '\0' != *s)
+			*dst++ = *s++;
+
+		*dst = '\0';
+	}
+
+	return (size_t)(s - src);
+}
+
+void	zbx_strncpy_alloc(char **str, size_t *alloc_len, size_t *offset, const char *src, size_t n)
+{
+	size_t	len = strnlen(src, n);
+
+	if (NULL == *str)
+	{
+		*alloc_len = len + 1;
+		*offset = 0;
+		*str = (char *)zbx_malloc(NULL, *alloc_len);
+	}
+	else if (*offset + len >= *alloc_len)
+	{
+		while (*offset + len >= *alloc_len)
+			*alloc_len *= 2;
+
+		*str = (char *)zbx_realloc(*str, *alloc_len);
+	}
+
+	memcpy(*str + *offset, src, len);
+	*offset += len;
+	(*str)[*offset] = '\0';
+}
+
+void	zbx_strcpy_alloc(char **str, size_t *alloc_len, size_t *offset, const char *src)
+{
+	zbx_strncpy_alloc(str, alloc_len, offset, src, strlen(src));
+}
+
+void	zbx_chrcpy_alloc(char **str, size_t *alloc_len, size_t *offset, char c)
+{
+	zbx_strncpy_alloc(str, alloc_len, offset, &c, 1);
+}
+
+void	zbx_snprintf_alloc(char **str, size_t *alloc_len, size_t *offset, const char *fmt, ...)
+{
+	va_list	args;
+	char	*buf;
+
+	va_start(args, fmt);
+
+	if (0 > vasprintf(&buf, fmt, args))
+	{
+		zbx_error("zbx_snprintf_alloc: out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	va_end(args);
+	zbx_strcpy_alloc(str, alloc_len, offset, buf);
+	free(buf);
+}
+
+void	zbx_lrtrim(char *str, const char *charlist)
+{
+	char	*p;
+	size_t	len;
+
+	for (p = str; '\0' != *p && NULL != strchr(charlist, *p); p++)
+		;
+
+	memmove(str, p, strlen(p) + 1);
+
+	for (len = strlen(str); 0 != len && NULL != strchr(charlist, str[len - 1]); len--)
+		str[len - 1] = '\0';
+}
+
+int	is_uint64_n(const char *str, size_t n, zbx_uint64_t *value)
+{
+	zbx_uint64_t	value_uint64 = 0;
+	size_t		i;
+
+	if ('\0' == *str || 0 == n)
+		return FAIL;
+
+	for (i = 0; '\0' != str[i] && i < n; i++)
+	{
+		if (0 == isdigit((unsigned char)str[i]) || (ZBX_MAX_UINT64 - (str[i] - '0')) / 10 < value_uint64)
+			return FAIL;
+
+		value_uint64 = value_uint64 * 10 + (zbx_uint64_t)(str[i] - '0');
+	}
+
+	if (NULL != value)
+		*value = value_uint64;
+
+	return SUCCEED;
+}
+
+/* parses a number with an optional K, M, G or T suffix like Zabbix does for sizes */
+/* drops spaces next to commas, as Zabbix does with multi-string parameters */
+static void	cfg_trim_list(char *value)
+{
+	char	*in, *out;
+
+	for (in = out = value; '\0' != *in; in++)
+	{
+		if (' ' == *in || '\t' == *in)
+		{
+			char	*next = in;
+
+			while (' ' == *next || '\t' == *next)
+				next++;
+
+			if (',' == *next || (out != value && ',' == out[-1]))
+			{
+				in = next - 1;
+				continue;
+			}
+		}
+
+		*out++ = *in;
+	}
+
+	*out = '\0';
+}
+
+static int	cfg_str2uint64(const char *str, zbx_uint64_t *value)
+{
+	char		*end;
+	zbx_uint64_t	factor = 1;
+
+	if (0 == isdigit((unsigned char)*str))
+		return FAIL;
+
+	*value = strtoull(str, &end, 10);
+
+	switch (*end)
+	{
+		case 'K':
+			factor = ZBX_KIBIBYTE;
+			break;
+		case 'M':
+			factor = ZBX_MEBIBYTE;
+			break;
+		case 'G':
+			factor = ZBX_GIBIBYTE;
+			break;
+		case 'T':
+			factor = (zbx_uint64_t)ZBX_GIBIBYTE * 1024;
+			break;
+		case '\0':
+			return SUCCEED;
+		default:
+			return FAIL;
+	}
+
+	if ('\0' != end[1])
+		return FAIL;
+
+	*value *= factor;
+
+	return SUCCEED;
+}
+
+int	parse_cfg_file(const char *cfg_file, struct cfg_line *cfg, int optional, int strict)
+{
+	FILE		*file;
+	char		line[4096], *parameter, *value;
+	int		lineno = 0, i;
+	zbx_uint64_t	number;
+
+	if (NULL == (file = fopen(cfg_file, "r")))
+	{
+		if (ZBX_CFG_FILE_OPTIONAL == optional)
+			return SUCCEED;
+
+		zbx_error("cannot open config file \"%s\": %s", cfg_file, zbx_strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	while (NULL != fgets(line, sizeof(line), file))
+	{
+		lineno++;
+		zbx_lrtrim(line, " \t\r\n");
+
+		if ('#' == *line || '\0' == *line)
+			continue;
+
+		if (NULL == (value = strchr(line, '=')))
+		{
+			zbx_error("invalid entry in config file \"%s\", line %d", cfg_file, lineno);
+			exit(EXIT_FAILURE);
+		}
+
+		*value++ = '\0';
+		parameter = line;
+		zbx_lrtrim(parameter, " \t");
+		zbx_lrtrim(value, " \t");
+
+		for (i = 0; NULL != cfg[i].parameter && 0 != strcmp(cfg[i].parameter, parameter); i++)
+			;
+
+		if (NULL == cfg[i].parameter)
+		{
+			if (ZBX_CFG_STRICT != strict)
+				continue;
+
+			zbx_error("unknown parameter \"%s\" in config file \"%s\", line %d", parameter, cfg_file, lineno);
+			exit(EXIT_FAILURE);
+		}
+
+		switch (cfg[i].type)
+		{
+			case TYPE_INT:
+			case TYPE_UINT64:
+				if (SUCCEED != cfg_str2uint64(value, &number) || (0 != cfg[i].max &&
+						(number < cfg[i].min || number > cfg[i].max)))
+				{
+					zbx_error("wrong value of \"%s\" in config file \"%s\", line %d", parameter,
+							cfg_file, lineno);
+					exit(EXIT_FAILURE);
+				}
+
+				if (TYPE_INT == cfg[i].type)
+					*(int *)cfg[i].variable = (int)number;
+				else
+					*(zbx_uint64_t *)cfg[i].variable = number;
+				break;
+			case TYPE_STRING:
+			case TYPE_STRING_LIST:
+				*(char **)cfg[i].variable = zbx_strdup(*(char **)cfg[i].variable, value);
+				break;
+			case TYPE_MULTISTRING:
+				cfg_trim_list(value);
+				zbx_strarr_add((char ***)cfg[i].variable, value);
+				break;
+			default:
+				zbx_error("unsupported type of \"%s\" in config file \"%s\"", parameter, cfg_file);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	fclose(file);
+
+	return SUCCEED;
+}
+
+void	zbx_strarr_init(char ***arr)
+{
+	*arr = (char **)zbx_malloc(NULL, sizeof(char *));
+	**arr = NULL;
+}
+
+void	zbx_strarr_add(char ***arr, const char *entry)
+{
+	int	i;
+
+	for (i = 0; NULL != (*arr)[i]; i++)
+		;
+
+	*arr = (char **)zbx_realloc(*arr, sizeof(char *) * (size_t)(i + 2));
+	(*arr)[i] = zbx_strdup(NULL, entry);
+	(*arr)[i + 1] = NULL;
+}
+
+void	zbx_strarr_free(char **arr)
+{
+	char	**p;
+
+	for (p = arr; NULL != *p; p++)
+		zbx_free(*p);
+
+	zbx_free(arr);
+}
+
+zbx_hash_t	zbx_hash_modfnv(const void *data, size_t len, zbx_hash_t seed)
+{
+	const unsigned char	*p = (const unsigned char *)data;
+	zbx_hash_t		hash = 2166136261u ^ seed;
+
+	while (0 != len--)
+		hash = (hash ^ *p++) * 16777619u;
+
+	hash += hash << 13;
+	hash ^= hash >> 7;
+	hash += hash << 3;
+	hash ^= hash >> 17;
+	hash += hash << 5;
+
+	return hash;
+}
+
+zbx_hash_t	zbx_default_uint64_hash_func(const void *data)
+{
+	return ZBX_DEFAULT_HASH_ALGO(data, sizeof(zbx_uint64_t), ZBX_DEFAULT_HASH_SEED);
+}
+
+zbx_hash_t	zbx_default_string_hash_func(const void *data)
+{
+	return ZBX_DEFAULT_STRING_HASH_ALGO(data, strlen((const char *)data), ZBX_DEFAULT_HASH_SEED);
+}
+
+int	zbx_default_uint64_compare_func(const void *d1, const void *d2)
+{
+	const zbx_uint64_t	*i1 = (const zbx_uint64_t *)d1, *i2 = (const zbx_uint64_t *)d2;
+
+	return *i1 < *i2 ? -1 : *i1 > *i2;
+}
+
+int	zbx_default_str_compare_func(const void *d1, const void *d2)
+{
+	return strcmp(*(const char * const *)d1, *(const char * const *)d2);
+}
+
+#define HASHSET_ENTRY_OFFSET	offsetof(ZBX_HASHSET_ENTRY_T, data)
+
+void	zbx_hashset_create(zbx_hashset_t *hs, size_t init_size, zbx_hash_func_t hash_func,
+		zbx_compare_func_t compare_func)
+{
+	hs->num_slots = MAX(16, (int)init_size * 2);
+	hs->slots = (ZBX_HASHSET_ENTRY_T **)calloc((size_t)hs->num_slots, sizeof(ZBX_HASHSET_ENTRY_T *));
+	hs->num_data = 0;
+	hs->hash_func = hash_func;
+	hs->compare_func = compare_func;
+}
+
+void	zbx_hashset_clear(zbx_hashset_t *hs)
+{
+	ZBX_HASHSET_ENTRY_T	*entry, *next;
+	int			i;
+
+	for (i = 0; i < hs->num_slots; i++)
+	{
+		for (entry = hs->slots[i]; NULL != entry; entry = next)
+		{
+			next = entry->next;
+			free(entry);
+		}
+
+		hs->slots[i] = NULL;
+	}
+
+	hs->num_data = 0;
+}
+
+void	zbx_hashset_destroy(zbx_hashset_t *hs)
+{
+	zbx_hashset_clear(hs);
+	zbx_free(hs->slots);
+}
+
+void	*zbx_hashset_search(zbx_hashset_t *hs, const void *data)
+{
+	ZBX_HASHSET_ENTRY_T	*entry;
+	zbx_hash_t		hash = hs->hash_func(data);
+
+	for (entry = hs->slots[hash % hs->num_slots]; NULL != entry; entry = entry->next)
+	{
+		if (entry->hash == hash && 0 == hs->compare_func(entry->data, data))
+			return entry->data;
+	}
+
+	return NULL;
+}
+
+static void	zbx_hashset_grow(zbx_hashset_t *hs)
+{
+	ZBX_HASHSET_ENTRY_T	**slots, *entry, *next;
+	int			i, num_slots = hs->num_slots * 2;
+
+	slots = (ZBX_HASHSET_ENTRY_T **)calloc((size_t)num_slots, sizeof(ZBX_HASHSET_ENTRY_T *));
+
+	for (i = 0; i < hs->num_slots; i++)
+	{
+		for (entry = hs->slots[i]; NULL != entry; entry = next)
+		{
+			next = entry->next;
+			entry->next = slots[entry->hash % num_slots];
+			slots[entry->hash % num_slots] = entry;
+		}
+	}
+
+	free(hs->slots);
+	hs->slots = slots;
+	hs->num_slots = num_slots;
+}
+
+void	*zbx_hashset_insert(zbx_hashset_t *hs, const void *data, size_t size)
+{
+	ZBX_HASHSET_ENTRY_T	*entry;
+	void			*found;
+
+	if (NULL != (found = zbx_hashset_search(hs, data)))
+		return found;
+
+	if (hs->num_data >= hs->num_slots)
+		zbx_hashset_grow(hs);
+
+	entry = (ZBX_HASHSET_ENTRY_T *)zbx_malloc(NULL, HASHSET_ENTRY_OFFSET + size);
+	entry->hash = hs->hash_func(data);
+	memcpy(entry->data, data, size);
+	entry->next = hs->slots[entry->hash % hs->num_slots];
+	hs->slots[entry->hash % hs->num_slots] = entry;
+	hs->num_data++;
+
+	return entry->data;
+}
+
+void	zbx_hashset_remove(zbx_hashset_t *hs, const void *data)
+{
+	ZBX_HASHSET_ENTRY_T	**pentry, *entry;
+	zbx_hash_t		hash = hs->hash_func(data);
+
+	for (pentry = &hs->slots[hash % hs->num_slots]; NULL != (entry = *pentry); pentry = &entry->next)
+	{
+		if (entry->hash == hash && 0 == hs->compare_func(entry->data, data))
+		{
+			*pentry = entry->next;
+			free(entry);
+			hs->num_data--;
+			return;
+		}
+	}
+}
+
+void	zbx_hashset_iter_reset(zbx_hashset_t *hs, zbx_hashset_iter_t *iter)
+{
+	iter->hashset = hs;
+	iter->slot = -1;
+	iter->entry = NULL;
+}
+
+void	*zbx_hashset_iter_next(zbx_hashset_iter_t *iter)
+{
+	if (NULL != iter->entry && NULL != iter->entry->next)
+	{
+		iter->entry = iter->entry->next;
+		return iter->entry->data;
+	}
+
+	while (++iter->slot < iter->hashset->num_slots)
+	{
+		if (NULL != (iter->entry = iter->hashset->slots[iter->slot]))
+			return iter->entry->data;
+	}
+
+	return NULL;
+}
+
+void	zbx_vector_uint64_create(zbx_vector_uint64_t *vector)
+{
+	memset(vector, 0, sizeof(zbx_vector_uint64_t));
+}
+
+void	zbx_vector_uint64_destroy(zbx_vector_uint64_t *vector)
+{
+	zbx_free(vector->values);
+	vector->values_num = vector->values_alloc = 0;
+}
+
+void	zbx_vector_uint64_reserve(zbx_vector_uint64_t *vector, size_t size)
+{
+	if ((int)size <= vector->values_alloc)
+		return;
+
+	vector->values_alloc = (int)size;
+	vector->values = (zbx_uint64_t *)zbx_realloc(vector->values, size * sizeof(zbx_uint64_t));
+}
+
+void	zbx_vector_uint64_append(zbx_vector_uint64_t *vector, zbx_uint64_t value)
+{
+	if (vector->values_num == vector->values_alloc)
+		zbx_vector_uint64_reserve(vector, 0 != vector->values_alloc ? (size_t)vector->values_alloc * 2 : 32);
+
+	vector->values[vector->values_num++] = value;
+}
+
+void	zbx_vector_uint64_sort(zbx_vector_uint64_t *vector, zbx_compare_func_t compare_func)
+{
+	if (1 < vector->values_num)
+		qsort(vector->values, (size_t)vector->values_num, sizeof(zbx_uint64_t), compare_func);
+}
+
+void	zbx_vector_uint64_uniq(zbx_vector_uint64_t *vector, zbx_compare_func_t compare_func)
+{
+	int	i, j = 0;
+
+	if (2 > vector->values_num)
+		return;
+
+	for (i = 1; i < vector->values_num; i++)
+	{
+		if (0 != compare_func(&vector->values[i], &vector->values[j]))
+			vector->values[++j] = vector->values[i];
+	}
+
+	vector->values_num = j + 1;
+}
+
+void	zbx_vector_uint64_clear(zbx_vector_uint64_t *vector)
+{
+	vector->values_num = 0;
+}
+
+void	zbx_vector_ptr_create(zbx_vector_ptr_t *vector)
+{
+	memset(vector, 0, sizeof(zbx_vector_ptr_t));
+}
+
+void	zbx_vector_ptr_destroy(zbx_vector_ptr_t *vector)
+{
+	zbx_free(vector->values);
+	vector->values_num = vector->values_alloc = 0;
+}
+
+void	zbx_vector_ptr_append(zbx_vector_ptr_t *vector, void *value)
+{
+	if (vector->values_num == vector->values_alloc)
+	{
+		vector->values_alloc = (0 != vector->values_alloc ? vector->values_alloc * 2 : 32);
+		vector->values = (void **)zbx_realloc(vector->values, (size_t)vector->values_alloc * sizeof(void *));
+	}
+
+	vector->values[vector->values_num++] = value;
+}
+
+void	zbx_vector_ptr_clear_ext(zbx_vector_ptr_t *vector, zbx_clean_func_t clean_func)
+{
+	int	i;
+
+	for (i = 0; i < vector->values_num; i++)
+		clean_func(vector->values[i]);
+
+	vector->values_num = 0;
+}
+
+void	zbx_ptr_free(void *data)
+{
+	free(data);
+}
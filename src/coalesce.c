@@ -0,0 +1,182 @@
+// merging of the single field lines of a batch into multi-field points
+// 1] with InfluxDBSchema=host the series key of an item is the measurement and
+//    tags of its host followed by its key as the field name, so values of one host
+//    make lines that differ only in the field set and timestamp
+// 2] history_influxdb.c builds those lines here rather than in the batch and
+//    records where the field set and timestamp of each start, at the end of the
+//    batch lines with the same series key and timestamp (as formatted, so with
+//    the configured precision) are sorted together and written as one line with
+//    all of their fields
+// 3] an item with several values for one timestamp (e.g. with HostSchemaInterval)
+//    keeps the last one, a point can have each field only once
+//
+// Only the lines are sorted, the batch is copied once, into the payload.
+
+#include "coalesce.h"
+
+/* lines being sorted, history callbacks are called by one thread of a process */
+static const char	*sort_lines = NULL;
+
+static int	coalesce_compare_span(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int	ret;
+
+	if (0 != (ret = memcmp(a, b, MIN(a_len, b_len))))
+		return ret;
+
+	if (a_len != b_len)
+		return a_len < b_len ? -1 : 1;
+
+	return 0;
+}
+
+/* compares the series keys and timestamps of two lines */
+static int	coalesce_compare_point(const coalesce_point_t *a, const coalesce_point_t *b)
+{
+	int	ret;
+
+	if (0 != (ret = coalesce_compare_span(sort_lines + a->line, a->fields - a->line, sort_lines + b->line,
+			b->fields - b->line)))
+	{
+		return ret;
+	}
+
+	return coalesce_compare_span(sort_lines + a->timestamp, a->end - a->timestamp, sort_lines + b->timestamp,
+			b->end - b->timestamp);
+}
+
+static int	coalesce_compare(const void *d1, const void *d2)
+{
+	const coalesce_point_t	*a = (const coalesce_point_t *)d1, *b = (const coalesce_point_t *)d2;
+	int			ret;
+
+	if (0 != (ret = coalesce_compare_point(a, b)))
+		return ret;
+
+	if (a->itemid != b->itemid)
+		return a->itemid < b->itemid ? -1 : 1;
+
+	return a->index - b->index;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: coalesce_reset                                                   *
+ *                                                                            *
+ * Purpose: empties the lines of the previous batch, keeping the memory       *
+ *                                                                            *
+ ******************************************************************************/
+void	coalesce_reset(coalesce_t *coalesce)
+{
+	line_buffer_reset(&coalesce->lines);
+	coalesce->points_num = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: coalesce_free                                                    *
+ *                                                                            *
+ ******************************************************************************/
+void	coalesce_free(coalesce_t *coalesce)
+{
+	line_buffer_free(&coalesce->lines);
+	zbx_free(coalesce->points);
+	coalesce->points_num = coalesce->points_alloc = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: coalesce_add                                                     *
+ *                                                                            *
+ * Purpose: records the line just appended to coalesce->lines                 *
+ *                                                                            *
+ * Parameters: coalesce  - lines of the batch                                 *
+ *             itemid    - item of the value                                  *
+ *             line      - offset of the start of the line                    *
+ *             fields    - offset of the field set, after the space           *
+ *             timestamp - offset of the timestamp, after the space           *
+ *                                                                            *
+ * Comment: the line must end with a newline                                  *
+ *                                                                            *
+ ******************************************************************************/
+void	coalesce_add(coalesce_t *coalesce, zbx_uint64_t itemid, size_t line, size_t fields, size_t timestamp)
+{
+	coalesce_point_t	*point;
+
+	if (coalesce->points_num == coalesce->points_alloc)
+	{
+		coalesce->points_alloc = MAX(coalesce->points_alloc * 2, 64);
+		coalesce->points = (coalesce_point_t *)zbx_realloc(coalesce->points,
+				sizeof(coalesce_point_t) * (size_t)coalesce->points_alloc);
+	}
+
+	point = &coalesce->points[coalesce->points_num];
+	point->itemid = itemid;
+	point->line = line;
+	point->fields = fields;
+	point->timestamp = timestamp;
+	point->end = coalesce->lines.offset - 1;
+	point->index = coalesce->points_num++;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: coalesce_merge                                                   *
+ *                                                                            *
+ * Purpose: appends the lines of the batch to out, those with the same series *
+ *          key and timestamp merged into one                                 *
+ *                                                                            *
+ * Parameters: coalesce - lines of the batch                                  *
+ *             out      - the payload                                         *
+ *                                                                            *
+ * Return value: number of values not written as a line of their own          *
+ *                                                                            *
+ ******************************************************************************/
+int	coalesce_merge(coalesce_t *coalesce, line_buffer_t *out)
+{
+	const coalesce_point_t	*first, *point;
+	const char		*lines = coalesce->lines.data;
+	int			i, j, fields_num, written = 0;
+
+	if (0 == coalesce->points_num)
+		return 0;
+
+	sort_lines = lines;
+	qsort(coalesce->points, (size_t)coalesce->points_num, sizeof(coalesce_point_t), coalesce_compare);
+
+	for (i = 0; i < coalesce->points_num; i = j)
+	{
+		first = &coalesce->points[i];
+
+		/* series key and the space after it */
+		line_buffer_append(out, lines + first->line, first->fields - first->line);
+
+		for (j = i, fields_num = 0; j < coalesce->points_num; j++)
+		{
+			point = &coalesce->points[j];
+
+			if (j != i && 0 != coalesce_compare_point(first, point))
+				break;
+
+			/* only the last value of an item is kept */
+			if (j + 1 < coalesce->points_num && point->itemid == point[1].itemid &&
+					0 == coalesce_compare_point(point, &point[1]))
+			{
+				continue;
+			}
+
+			if (0 != fields_num++)
+				line_buffer_append(out, ",", 1);
+
+			line_buffer_append(out, lines + point->fields, point->timestamp - 1 - point->fields);
+		}
+
+		/* the space before the timestamp and the newline */
+		line_buffer_append(out, lines + first->timestamp - 1, first->end + 2 - first->timestamp);
+		written++;
+	}
+
+	sort_lines = NULL;
+
+	return coalesce->points_num - written;
+}
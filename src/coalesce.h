@@ -0,0 +1,37 @@
+#ifndef __ZABBIX_COALESCE_H
+#define __ZABBIX_COALESCE_H
+
+
+#include "common.h"
+#include "line_buffer.h"
+
+/* a single field line of a batch, offsets are in the lines of the batch */
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	size_t		line;
+	size_t		fields;		/* start of the field set */
+	size_t		timestamp;	/* start of the timestamp */
+	size_t		end;		/* the newline */
+	int		index;		/* order of the value in the batch */
+}
+coalesce_point_t;
+
+/* lines of one history batch waiting to be merged */
+typedef struct
+{
+	line_buffer_t		lines;
+	coalesce_point_t	*points;
+	int			points_num;
+	int			points_alloc;
+}
+coalesce_t;
+
+extern void coalesce_reset(coalesce_t *coalesce);
+extern void coalesce_free(coalesce_t *coalesce);
+
+extern void coalesce_add(coalesce_t *coalesce, zbx_uint64_t itemid, size_t line, size_t fields, size_t timestamp);
+extern int coalesce_merge(coalesce_t *coalesce, line_buffer_t *out);
+
+
+#endif /* __ZABBIX_COALESCE_H */
@@ -0,0 +1,465 @@
+// change-only export, values within a deadband of the last exported one are not written
+// 1] DeadbandRule is <types> <deadband> [<field>:<pattern>], the first rule for
+//    the value type whose item_filter.c rule the item matched (or that has none)
+//    applies, the deadband is absolute, relative with a % suffix, and 0 exports
+//    changed values only, strings are always compared for a change
+// 2] the last exported value and its time are kept per itemid in one shared
+//    open addressing table (linear probing, at most half full), created before
+//    the history syncers are forked, Zabbix hands an item to any of them and
+//    each must compare with what was really exported last
+// 3] a value is exported anyway once DeadbandHeartbeat seconds passed since the
+//    last exported one, so gaps in graphs stay bounded
+// 4] rules with a pattern need the rules an item matched, item_meta.c passes
+//    them when the item is read from the database and they are kept in the
+//    table, item_cache.c saves them with the snapshot and passes them again
+//    when loading it
+//
+// An item is processed by one history syncer at a time, so its slot has a single
+// writer and no lock is needed, new slots are claimed with compare-and-swap.
+// Only items a rule applies to take a slot, so items no rule is for cannot fill the
+// table. When the table is full values of items without a slot are all exported.
+
+#include "load_config.h"
+#include "deadband.h"
+#include "item_filter.h"
+#include "zbxalgo.h"
+
+#include <math.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+	unsigned char	types;		/* DEADBAND_* */
+	double		deadband;
+	int		relative;
+	int		filter;		/* bit of the item_filter.c rule, -1 - any item */
+}
+deadband_rule_t;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;		/* 0 - free slot */
+	zbx_uint64_t	value;		/* double or integer bits, hash of a string */
+	zbx_uint64_t	match;		/* item_filter.c rules matched */
+	int		clock;		/* of the last exported value */
+	unsigned char	type;		/* DEADBAND_* of the value, 0 - none yet */
+	unsigned char	classified;	/* match is set */
+}
+deadband_slot_t;
+
+typedef struct
+{
+	int		entries;
+	int		entries_max;
+	zbx_uint64_t	mask;
+}
+deadband_shm_t;
+
+static deadband_rule_t	*rules = NULL;
+static int		rules_num = 0;
+static zbx_uint64_t	rules_filtered = 0;	/* item_filter.c rules of rules with a pattern */
+static unsigned char	rules_types = 0;
+
+static deadband_shm_t	*shm = NULL;
+static size_t		shm_size = 0;
+static deadband_slot_t	*slots = NULL;
+
+static int	deadband_parse_types(const char *types, size_t len, unsigned char *mask)
+{
+	static const char	*names[] = {"float", "integer", "string", "text", NULL};
+	const char		*end = types + len, *sep;
+	int			i;
+
+	for (*mask = 0; types < end; types = sep + 1)
+	{
+		if (NULL == (sep = (const char *)memchr(types, ',', (size_t)(end - types))))
+			sep = end;
+
+		for (i = 0; NULL != names[i]; i++)
+		{
+			if (strlen(names[i]) == (size_t)(sep - types) && 0 == strncmp(names[i], types, (size_t)(sep - types)))
+				break;
+		}
+
+		if (NULL == names[i])
+			return FAIL;
+
+		*mask |= (unsigned char)(1 << i);
+	}
+
+	return 0 != *mask ? SUCCEED : FAIL;
+}
+
+static int	deadband_rule_add(const char *rule, char **error)
+{
+	deadband_rule_t	rule_local;
+	const char	*p;
+	char		*end;
+
+	p = rule + strcspn(rule, " \t");
+
+	if (SUCCEED != deadband_parse_types(rule, (size_t)(p - rule), &rule_local.types))
+	{
+		*error = zbx_dsprintf(*error, "invalid DeadbandRule \"%s\": expected value types float, integer,"
+				" string or text separated by ','", rule);
+		return FAIL;
+	}
+
+	p += strspn(p, " \t");
+	rule_local.deadband = strtod(p, &end);
+
+	if (end == p || 0 > rule_local.deadband || 0 == isfinite(rule_local.deadband))
+	{
+		*error = zbx_dsprintf(*error, "invalid DeadbandRule \"%s\": expected a deadband of 0 or more after"
+				" the value types", rule);
+		return FAIL;
+	}
+
+	if (0 != (rule_local.relative = ('%' == *end)))
+	{
+		rule_local.deadband /= 100;
+		end++;
+	}
+
+	if ('\0' != *end && ' ' != *end && '\t' != *end)
+	{
+		*error = zbx_dsprintf(*error, "invalid DeadbandRule \"%s\": unexpected characters after the deadband",
+				rule);
+		return FAIL;
+	}
+
+	p = end + strspn(end, " \t");
+	rule_local.filter = -1;
+
+	if ('\0' != *p)
+	{
+		if (FAIL == (rule_local.filter = item_filter_rule_add(p, "DeadbandRule", error)))
+			return FAIL;
+
+		rules_filtered |= __UINT64_C(1) << rule_local.filter;
+	}
+
+	rules = (deadband_rule_t *)zbx_realloc(rules, sizeof(deadband_rule_t) * (size_t)(rules_num + 1));
+	rules[rules_num++] = rule_local;
+	rules_types |= rule_local.types;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_init                                                    *
+ *                                                                            *
+ * Purpose: compiles the DeadbandRule rules and maps the table of last        *
+ *          exported values if there are any, must be called before any       *
+ *          process is forked                                                 *
+ *                                                                            *
+ * Parameters: rule  - NULL terminated list of rules                          *
+ *             error - the error message of an invalid rule                   *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if a rule is invalid or the table cannot be  *
+ *               mapped                                                       *
+ *                                                                            *
+ ******************************************************************************/
+int	deadband_init(char **rule, char **error)
+{
+	zbx_uint64_t	capacity = 1;
+
+	for (; NULL != rule && NULL != *rule; rule++)
+	{
+		if (SUCCEED != deadband_rule_add(*rule, error))
+			return FAIL;
+	}
+
+	if (0 == rules_num)
+		return SUCCEED;
+
+	while (capacity < (zbx_uint64_t)CONFIG_DEADBAND_SIZE * 2)
+		capacity *= 2;
+
+	shm_size = sizeof(deadband_shm_t) + capacity * sizeof(deadband_slot_t);
+
+	if (MAP_FAILED == (shm = (deadband_shm_t *)mmap(NULL, shm_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+	{
+		*error = zbx_dsprintf(*error, "cannot map " ZBX_FS_UI64 " bytes of shared memory for DeadbandSize %d:"
+				" %s", (zbx_uint64_t)shm_size, CONFIG_DEADBAND_SIZE, zbx_strerror(errno));
+		shm = NULL;
+		return FAIL;
+	}
+
+	slots = (deadband_slot_t *)(shm + 1);
+	shm->entries_max = CONFIG_DEADBAND_SIZE;
+	shm->mask = capacity - 1;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_destroy                                                 *
+ *                                                                            *
+ ******************************************************************************/
+void	deadband_destroy(void)
+{
+	if (NULL != shm)
+	{
+		munmap(shm, shm_size);
+		shm = NULL;
+		slots = NULL;
+	}
+
+	zbx_free(rules);
+	rules_num = 0;
+	rules_filtered = 0;
+	rules_types = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_rules_num                                               *
+ *                                                                            *
+ * Return value: number of rules, 0 - every value is exported                 *
+ *                                                                            *
+ ******************************************************************************/
+int	deadband_rules_num(void)
+{
+	return rules_num;
+}
+
+/* finds the slot of an item, claiming a free one if create is set and the table is not full */
+static deadband_slot_t	*deadband_slot(zbx_uint64_t itemid, int create)
+{
+	zbx_uint64_t	i, id, expected;
+
+	for (i = ZBX_DEFAULT_UINT64_HASH_FUNC(&itemid) & shm->mask;; i = (i + 1) & shm->mask)
+	{
+		if (itemid == (id = __atomic_load_n(&slots[i].itemid, __ATOMIC_ACQUIRE)))
+			return &slots[i];
+
+		if (0 != id)
+			continue;
+
+		if (0 == create || __atomic_load_n(&shm->entries, __ATOMIC_RELAXED) >= shm->entries_max)
+			return NULL;
+
+		expected = 0;
+
+		if (__atomic_compare_exchange_n(&slots[i].itemid, &expected, itemid, 0, __ATOMIC_ACQ_REL,
+				__ATOMIC_ACQUIRE))
+		{
+			__atomic_fetch_add(&shm->entries, 1, __ATOMIC_RELAXED);
+			return &slots[i];
+		}
+
+		/* another process claimed it, for this item or the next one in the probe */
+		if (itemid == expected)
+			return &slots[i];
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_classify                                                *
+ *                                                                            *
+ * Purpose: keeps the item_filter.c rules an item matched, for rules with a   *
+ *          pattern                                                           *
+ *                                                                            *
+ ******************************************************************************/
+void	deadband_classify(zbx_uint64_t itemid, zbx_uint64_t match)
+{
+	deadband_slot_t	*slot;
+
+	/* an item matching none of the patterns only needs its slot updated if it has one */
+	if (0 == rules_filtered || NULL == (slot = deadband_slot(itemid, 0 != (match & rules_filtered))))
+		return;
+
+	__atomic_store_n(&slot->match, match, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->classified, 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_match                                                   *
+ *                                                                            *
+ * Return value: the item_filter.c rules an item matched as far as rules with *
+ *               a pattern are concerned, 0 - none or not known               *
+ *                                                                            *
+ ******************************************************************************/
+zbx_uint64_t	deadband_match(zbx_uint64_t itemid)
+{
+	deadband_slot_t	*slot;
+
+	if (0 == rules_filtered || NULL == (slot = deadband_slot(itemid, 0)) ||
+			0 == __atomic_load_n(&slot->classified, __ATOMIC_ACQUIRE))
+	{
+		return 0;
+	}
+
+	return __atomic_load_n(&slot->match, __ATOMIC_RELAXED) & rules_filtered;
+}
+
+/* the rule for a value of the item in slot (NULL - item has none yet), NULL if none */
+static const deadband_rule_t	*deadband_rule(const deadband_slot_t *slot, unsigned char type)
+{
+	int	i;
+
+	for (i = 0; i < rules_num; i++)
+	{
+		if (0 == (rules[i].types & type))
+			continue;
+
+		if (-1 == rules[i].filter)
+			return &rules[i];
+
+		if (NULL != slot && 0 != __atomic_load_n(&slot->classified, __ATOMIC_ACQUIRE) &&
+				0 != (slot->match & (__UINT64_C(1) << rules[i].filter)))
+		{
+			return &rules[i];
+		}
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_check                                                   *
+ *                                                                            *
+ * Purpose: decides whether a value is exported and if so keeps it as the     *
+ *          last exported one                                                 *
+ *                                                                            *
+ * Parameters: itemid - the item                                              *
+ *             type   - DEADBAND_* type of the value                          *
+ *             clock  - time of the value                                     *
+ *             bits   - value bits compared for a change                      *
+ *             diff   - distance of the value from the last exported one,     *
+ *                      NULL if only a change counts                          *
+ *                                                                            *
+ * Return value: SUCCEED - export the value                                   *
+ *               FAIL    - the value is within the deadband                   *
+ *                                                                            *
+ ******************************************************************************/
+static int	deadband_check(zbx_uint64_t itemid, unsigned char type, int clock, zbx_uint64_t bits,
+		double (*diff)(zbx_uint64_t bits, zbx_uint64_t last_bits, double *last))
+{
+	deadband_slot_t		*slot;
+	const deadband_rule_t	*rule;
+	double			delta, last;
+
+	if (0 == (rules_types & type))
+		return SUCCEED;
+
+	slot = deadband_slot(itemid, 0);
+
+	if (NULL == (rule = deadband_rule(slot, type)) || (NULL == slot && NULL == (slot = deadband_slot(itemid, 1))))
+		return SUCCEED;
+
+	/* older values (e.g. from a proxy catching up) are compared with nothing */
+	if (clock < slot->clock)
+		return SUCCEED;
+
+	if (type == slot->type && (0 == CONFIG_DEADBAND_HEARTBEAT || clock - slot->clock < CONFIG_DEADBAND_HEARTBEAT))
+	{
+		if (bits == slot->value)
+			return FAIL;
+
+		if (NULL != diff && 0 != rule->deadband)
+		{
+			delta = diff(bits, slot->value, &last);
+
+			if (delta <= (0 != rule->relative ? rule->deadband * fabs(last) : rule->deadband))
+				return FAIL;
+		}
+	}
+
+	slot->value = bits;
+	slot->clock = clock;
+	slot->type = type;
+
+	return SUCCEED;
+}
+
+static double	deadband_diff_double(zbx_uint64_t bits, zbx_uint64_t last_bits, double *last)
+{
+	double	value;
+
+	memcpy(&value, &bits, sizeof(value));
+	memcpy(last, &last_bits, sizeof(*last));
+
+	return fabs(value - *last);
+}
+
+static double	deadband_diff_uint64(zbx_uint64_t bits, zbx_uint64_t last_bits, double *last)
+{
+	*last = (double)last_bits;
+
+	return (double)(bits > last_bits ? bits - last_bits : last_bits - bits);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_check_double                                            *
+ *                                                                            *
+ * Return value: SUCCEED - export the value                                   *
+ *               FAIL    - the value is within the deadband                   *
+ *                                                                            *
+ * Comment: non-finite values are not written and not kept either            *
+ *                                                                            *
+ ******************************************************************************/
+int	deadband_check_double(zbx_uint64_t itemid, int clock, double value)
+{
+	zbx_uint64_t	bits;
+
+	if (0 == (rules_types & DEADBAND_FLOAT) || 0 == isfinite(value))
+		return SUCCEED;
+
+	/* 0 and -0 are the same value */
+	if (0 == value)
+		value = 0;
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	return deadband_check(itemid, DEADBAND_FLOAT, clock, bits, deadband_diff_double);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_check_uint64                                            *
+ *                                                                            *
+ * Return value: SUCCEED - export the value                                   *
+ *               FAIL    - the value is within the deadband                   *
+ *                                                                            *
+ ******************************************************************************/
+int	deadband_check_uint64(zbx_uint64_t itemid, int clock, zbx_uint64_t value)
+{
+	return deadband_check(itemid, DEADBAND_INTEGER, clock, value, deadband_diff_uint64);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: deadband_check_str                                               *
+ *                                                                            *
+ * Purpose: exports changed strings only, the deadband of a rule does not     *
+ *          apply                                                             *
+ *                                                                            *
+ * Parameters: type - DEADBAND_STRING or DEADBAND_TEXT                        *
+ *                                                                            *
+ * Return value: SUCCEED - export the value                                   *
+ *               FAIL    - the value did not change                           *
+ *                                                                            *
+ * Comment: strings are compared by a 64 bit FNV-1a hash                      *
+ *                                                                            *
+ ******************************************************************************/
+int	deadband_check_str(zbx_uint64_t itemid, int type, int clock, const char *value)
+{
+	zbx_uint64_t	hash = __UINT64_C(14695981039346656037);
+
+	if (0 == (rules_types & type))
+		return SUCCEED;
+
+	for (; '\0' != *value; value++)
+		hash = (hash ^ (unsigned char)*value) * __UINT64_C(1099511628211);
+
+	return deadband_check(itemid, (unsigned char)type, clock, hash, NULL);
+}
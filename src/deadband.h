@@ -0,0 +1,25 @@
+#ifndef __ZABBIX_DEADBAND_H
+#define __ZABBIX_DEADBAND_H
+
+
+#include "common.h"
+
+/* value types rules apply to */
+#define DEADBAND_FLOAT		0x01
+#define DEADBAND_INTEGER	0x02
+#define DEADBAND_STRING		0x04
+#define DEADBAND_TEXT		0x08
+
+extern int deadband_init(char **rule, char **error);
+extern void deadband_destroy(void);
+
+extern int deadband_rules_num(void);
+extern void deadband_classify(zbx_uint64_t itemid, zbx_uint64_t match);
+extern zbx_uint64_t deadband_match(zbx_uint64_t itemid);
+
+extern int deadband_check_double(zbx_uint64_t itemid, int clock, double value);
+extern int deadband_check_uint64(zbx_uint64_t itemid, int clock, zbx_uint64_t value);
+extern int deadband_check_str(zbx_uint64_t itemid, int type, int clock, const char *value);
+
+
+#endif /* __ZABBIX_DEADBAND_H */
@@ -21,8 +21,8 @@
  *
  *    Module Structure:
  *    	1. Compulsory zabbix module functions 	(60 - 145)
- *      2. write_to_influxdb               	(180)
- *      3. host_item_name_query  		(210)
+ *      2. write_to_influxdb               	(influxdb_writer.c)
+ *      3. host_item_name_query  		(item_meta.c)
  *      4. history callback functions           (300)
  *      5. zbx_module_history_write_cbs         (465)
  *
@@ -34,20 +34,46 @@
 #include "log.h"
 #include "cfg.h"
 #include "db.h"
+#include "zbxalgo.h"
 
 #include "load_config.h"
+#include "item_cache.h"
+#include "influxdb_writer.h"
+#include "send_queue.h"
+#include "spool.h"
+#include "line_buffer.h"
+#include "lp_format.h"
+#include "item_meta.h"
+#include "item_filter.h"
+#include "deadband.h"
+#include "rollup.h"
+#include "coalesce.h"
+#include "shared_writer.h"
+#include "module_stats.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <curl/curl.h>
 #include <time.h>
 
-#define METRIC_LEN 1000
-#define CURL_LEN 256
-#define ITEM_VALUE_LEN 255
 #define HOST_NAME_LEN 128
 
+/* series key (measurement and tags) of an item within one history batch */
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	size_t		offset;		/* in series_keys */
+	size_t		len;		/* 0 - not resolved or filtered out */
+	size_t		fields;		/* start of the field name, 0 - InfluxDBSchema=item */
+	unsigned char	filtered;	/* resolved, not exported */
+}
+influx_series_t;
+
+static void batch_state_destroy(void);
+
+/* series keys of the current batch, copied from the item cache or built from the database */
+static line_buffer_t	series_keys;
+
 /* the variable keeps timeout setting for item processing */
 static int	item_timeout = 0;
 int MODULE_LOG_LEVEL = 0;
@@ -93,8 +119,10 @@ void	zbx_module_item_timeout(int timeout)
  ******************************************************************************/
 
 static ZBX_METRIC keys[] =
-/*	KEY				FLAG		FUNCTION		TEST PARAMETERS */
+/*	KEY				FLAG		FUNCTION			TEST PARAMETERS */
 {
+	{"influxdb.module.stats",	CF_HAVEPARAMS,	module_stats_item,		"values"},
+	{"influxdb.module.latency",	CF_HAVEPARAMS,	module_stats_latency_item,	"write,99"},
 	{NULL}
 };
 
@@ -103,6 +131,48 @@ ZBX_METRIC	*zbx_module_item_list(void)
 	return keys;
 }
 
+/* item_meta_cb_t filling the item cache at startup */
+static void item_cache_prewarmed(zbx_uint64_t itemid, const char *series, size_t len, zbx_uint64_t match, void *arg){
+	ZBX_UNUSED(arg);
+	item_cache_put(itemid, series, len);
+
+	if(0 != len)
+		deadband_classify(itemid, match);
+}
+
+/******************************************************************************
+ *
+ *	Function: item_cache_prefill
+ *
+ *	Purpose: Fills the item cache before history syncers are forked, from the
+ *			ItemCacheSnapshot file or, failing that and with
+ *			ItemCachePrewarm=1, from the database
+ *
+ ******************************************************************************/
+
+static void item_cache_prefill(void){
+	int items;
+
+	if(CONFIG_ITEM_CACHE_SNAPSHOT != NULL && FAIL != (items = item_cache_snapshot_load(CONFIG_ITEM_CACHE_SNAPSHOT))){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Item cache: %d items loaded from snapshot %s", MODULE_NAME, items,
+				CONFIG_ITEM_CACHE_SNAPSHOT);
+		return;
+	}
+
+	if(!CONFIG_ITEM_CACHE_PREWARM)
+		return;
+
+	if(ZBX_DB_OK != DBconnect(ZBX_DB_CONNECT_ONCE)){
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] cannot connect to database, item cache not prewarmed", MODULE_NAME);
+		return;
+	}
+
+	items = item_meta_prewarm(CONFIG_ITEM_CACHE_SIZE, item_cache_prewarmed, NULL);
+	DBclose();
+
+	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Item cache: %d items prewarmed from database", MODULE_NAME, items);
+}
+
 /******************************************************************************
  *                                                                            *
  * Function: zbx_module_init                                                  *
@@ -117,11 +187,9 @@ ZBX_METRIC	*zbx_module_item_list(void)
  *                                                                            *
  ******************************************************************************/
 
-char influxdb_write_url[CURL_LEN];
-
 int	zbx_module_init(void)
 {
-	char		*error = NULL;
+	char		*error = NULL, *targets;
 
 	/* Sets up cURL from config file */
 	zbx_module_load_config();
@@ -129,25 +197,140 @@ int	zbx_module_init(void)
 	/* This will open the log for debugging */
 	MODULE_LOG_LEVEL = (CONFIG_FORCE_MODULE_DEBUG ? LOG_LEVEL_INFORMATION : LOG_LEVEL_DEBUG);
 
-	if(CONFIG_INFLUXDB_USER == NULL){
-		zbx_snprintf(influxdb_write_url, CURL_LEN, "%s://%s:%s/write?db=%s", CONFIG_INFLUXDB_PROTOCOL, CONFIG_INFLUXDB_ADDRESS,
-						CONFIG_INFLUXDB_PORT, CONFIG_INFLUXDB_NAME);
-	} else {
-		if(CONFIG_INFLUXDB_PWD == NULL){
+	if(CONFIG_INFLUXDB_API_VERSION == 1){
+		if(CONFIG_INFLUXDB_NAME == NULL){
+			zbx_error("InfluxDBName missing");
+			exit(EXIT_FAILURE);
+		}
+		if(CONFIG_INFLUXDB_USER != NULL && CONFIG_INFLUXDB_PWD == NULL){
 			zbx_error("Password missing: %s", error);
 			zbx_free(error);
 			exit(EXIT_FAILURE);
 		}
-		zbx_snprintf(influxdb_write_url, CURL_LEN, "%s://%s:%s/write?db=%s&u=%s&p=%s", CONFIG_INFLUXDB_PROTOCOL, CONFIG_INFLUXDB_ADDRESS,
-						CONFIG_INFLUXDB_PORT, CONFIG_INFLUXDB_NAME, CONFIG_INFLUXDB_USER, CONFIG_INFLUXDB_PWD);
+	} else if(CONFIG_INFLUXDB_ORG == NULL || CONFIG_INFLUXDB_BUCKET == NULL || CONFIG_INFLUXDB_TOKEN == NULL){
+		zbx_error("InfluxDBOrg, InfluxDBBucket and InfluxDBToken are needed with InfluxDBAPIVersion=2");
+		exit(EXIT_FAILURE);
+	}
+	if(CONFIG_INFLUXDB_PRECISION < 0){
+		zbx_error("InfluxDBPrecision missconfigured expected one of (s, ms, us, ns), but found %s", PARSE_INFLUXDB_PRECISION);
+		exit(EXIT_FAILURE);
+	}
+	if(CONFIG_INFLUXDB_FANOUT == 0){
+		zbx_error("InfluxDBFanout missconfigured expected one of (replicate, shard), but found %s", PARSE_INFLUXDB_FANOUT);
+		exit(EXIT_FAILURE);
+	}
+	if(CONFIG_INFLUXDB_TRANSPORT == 0){
+		zbx_error("InfluxDBTransport missconfigured expected one of (tcp, unix, udp), but found %s", PARSE_INFLUXDB_TRANSPORT);
+		exit(EXIT_FAILURE);
 	}
 	if(CONFIG_DATABASE_ENGINE == NULL){
 		zbx_error("DatabaseEngine missconfigured expected one of (mysql, postgresql), but found %s", PARSE_DATABASE_ENGINE);
 		exit(EXIT_FAILURE);
 	}
-	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Initialised History InfluxDB module, target: %s", MODULE_NAME, influxdb_write_url);
+	if(CONFIG_SEND_QUEUE_FULL_POLICY == 0){
+		zbx_error("SendQueueFullPolicy missconfigured expected one of (block, drop_oldest), but found %s", PARSE_SEND_QUEUE_FULL_POLICY);
+		exit(EXIT_FAILURE);
+	}
+	if(CONFIG_SPOOL_FSYNC == 0){
+		zbx_error("SpoolFsync missconfigured expected one of (never, segment, always), but found %s", PARSE_SPOOL_FSYNC);
+		exit(EXIT_FAILURE);
+	}
+	if(CONFIG_INFLUXDB_SCHEMA == 0){
+		zbx_error("InfluxDBSchema missconfigured expected one of (item, host), but found %s", PARSE_INFLUXDB_SCHEMA);
+		exit(EXIT_FAILURE);
+	}
+	if(CONFIG_ITEM_CACHE_SNAPSHOT != NULL && !CONFIG_ITEM_CACHE_SHARED){
+		zbx_error("ItemCacheSnapshot needs ItemCacheShared=1, per process caches cannot be saved");
+		exit(EXIT_FAILURE);
+	}
+	if(SUCCEED != item_filter_init(CONFIG_INCLUDE_ITEMS, CONFIG_EXCLUDE_ITEMS, &error)){
+		zbx_error("%s", error);
+		zbx_free(error);
+		exit(EXIT_FAILURE);
+	}
+	if(SUCCEED != deadband_init(CONFIG_DEADBAND_RULES, &error)){
+		zbx_error("%s", error);
+		zbx_free(error);
+		exit(EXIT_FAILURE);
+	}
+	if(SUCCEED != rollup_init(&error)){
+		zbx_error("%s", error);
+		zbx_free(error);
+		exit(EXIT_FAILURE);
+	}
+	if(SUCCEED != module_stats_init()){
+		return ZBX_MODULE_FAIL;
+	}
+	if(SUCCEED != spool_init()){
+		return ZBX_MODULE_FAIL;
+	}
+	if(SUCCEED != influxdb_writer_init()){
+		return ZBX_MODULE_FAIL;
+	}
+	if(CONFIG_SHARED_WRITER && SUCCEED != shared_writer_init()){
+		return ZBX_MODULE_FAIL;
+	}
+	targets = influxdb_endpoints_names(influxdb_endpoints_all());
+	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Initialised History InfluxDB module, target: %s (%s, over %s)", MODULE_NAME,
+			targets, PARSE_INFLUXDB_FANOUT, PARSE_INFLUXDB_TRANSPORT);
+	zbx_free(targets);
+	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] InfluxDB %d.x write API, %s precision", MODULE_NAME,
+			CONFIG_INFLUXDB_API_VERSION, PARSE_INFLUXDB_PRECISION);
 	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Database Engine used: %s", MODULE_NAME, PARSE_DATABASE_ENGINE);
 	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Using compatibility with Zabbix %d", MODULE_NAME, CONFIG_ZABBIX_MAJOR_VERSION);
+	zabbix_log(LOG_LEVEL_INFORMATION, "[%s] InfluxDB connect timeout: %ds, timeout: %ds", MODULE_NAME,
+			CONFIG_INFLUXDB_CONNECT_TIMEOUT, CONFIG_INFLUXDB_TIMEOUT);
+	if(CONFIG_INFLUXDB_TRANSPORT == INFLUXDB_TRANSPORT_UDP){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Lines sent in UDP datagrams of at most %d bytes", MODULE_NAME,
+				CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE);
+	}
+	else {
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Writes of at most %d lines, %d bytes, over %d %s", MODULE_NAME,
+				CONFIG_MAX_LINES_PER_WRITE, CONFIG_MAX_BYTES_PER_WRITE, CONFIG_INFLUXDB_CONNECTIONS,
+				CONFIG_INFLUXDB_HTTP2 ? "HTTP/2 streams" : "connections");
+	}
+	if(CONFIG_ASYNC_SEND){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Asynchronous send, queue of %d batches, " ZBX_FS_UI64 " bytes, when full: %s",
+				MODULE_NAME, CONFIG_SEND_QUEUE_MAX_BATCHES, CONFIG_SEND_QUEUE_MAX_SIZE, PARSE_SEND_QUEUE_FULL_POLICY);
+	}
+	if(CONFIG_SHARED_WRITER){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] One writer for all processes, ring of " ZBX_FS_UI64 " bytes, batches of"
+				" up to %d bytes or %dms", MODULE_NAME, CONFIG_SHARED_WRITER_RING_SIZE, CONFIG_SHARED_WRITER_BATCH_SIZE,
+				CONFIG_SHARED_WRITER_LINGER);
+	}
+	if(CONFIG_SPOOL_DIR != NULL){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Spooling failed writes to %s, up to " ZBX_FS_UI64 " bytes, fsync: %s",
+				MODULE_NAME, CONFIG_SPOOL_DIR, CONFIG_SPOOL_MAX_SIZE, PARSE_SPOOL_FSYNC);
+	}
+
+	if(SUCCEED != item_cache_init()){
+		return ZBX_MODULE_FAIL;
+	}
+	if(CONFIG_ITEM_CACHE_SHARED){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Item cache size: %d, TTL: %ds, shared by all processes, " ZBX_FS_UI64
+				" bytes", MODULE_NAME, CONFIG_ITEM_CACHE_SIZE, CONFIG_ITEM_CACHE_TTL, CONFIG_ITEM_CACHE_SHARED_SIZE);
+	}
+	else {
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Item cache size: %d, TTL: %ds", MODULE_NAME, CONFIG_ITEM_CACHE_SIZE,
+				CONFIG_ITEM_CACHE_TTL);
+	}
+	if(0 != item_filter_rules_num()){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Exporting items by %d IncludeItems/ExcludeItems rules", MODULE_NAME,
+				item_filter_rules_num());
+	}
+	if(0 != deadband_rules_num()){
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Deadband: %d rules, heartbeat: %ds, up to %d items", MODULE_NAME,
+				deadband_rules_num(), CONFIG_DEADBAND_HEARTBEAT, CONFIG_DEADBAND_SIZE);
+	}
+	if(0 != rollup_windows_num()){
+		targets = rollup_windows_names();
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] Rollups of %s windows to measurements suffixed %s, up to %d items",
+				MODULE_NAME, targets, CONFIG_ROLLUP_MEASUREMENT_SUFFIX, CONFIG_ROLLUP_SIZE);
+		zbx_free(targets);
+	}
+	if(CONFIG_ITEM_CACHE_SIZE > 0){
+		item_cache_prefill();
+	}
 
 	return ZBX_MODULE_OK;
 }
@@ -165,208 +348,22 @@ int	zbx_module_init(void)
  ******************************************************************************/
 int	zbx_module_uninit(void)
 {
-	return ZBX_MODULE_OK;
-}
-
-/******************************************************************************
- *
- *	Function: write_to_influxdb
- *
- *	Purpose: Sets up an http connection using curl and writes a pre-formatted
- *				string to a specified influxdb url
- *
- ******************************************************************************/
-
-void write_to_influxdb(char *influxdb_data_entry) {
-	CURL *curl;
-	CURLcode res;
-	int i;
-
-	curl_global_init(CURL_GLOBAL_ALL);
-
-	curl = curl_easy_init();
-	if(curl) {
-		curl_easy_setopt(curl, CURLOPT_URL, influxdb_write_url);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, CONFIG_INFLUXDB_SSL_INSECURE ? 0L : 1L);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, CONFIG_INFLUXDB_SSL_INSECURE ? 0L : 1L);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, influxdb_data_entry);
-		res = curl_easy_perform(curl);
-
-		if(res != CURLE_OK){
-			zabbix_log(LOG_LEVEL_ERR, "[%s] curl_easy_perform() failed: %s", MODULE_NAME, curl_easy_strerror(res));
-		}
-		curl_easy_cleanup(curl);
-	}
-	curl_global_cleanup();
-	zabbix_log(MODULE_LOG_LEVEL, "[%s]     completed write_to_influxdb", MODULE_NAME);
-}
-
-/******************************************************************************
- *
- *	Function: host_item_name_query
- *
- *	Purpose: Performs a query to internal database to return human-readable
- *			info
- *
- *	Parameters: itemid
- *
- *	Returns: A string in a format which can be added to influxdb_data_entry for curl
- *			request
- *
- ******************************************************************************/
-
-char *itemid_to_influx_data(zbx_uint64_t itemid)
-{
-	DB_RESULT	result;
-	DB_ROW		row;
-	char *ret_string;
-//	const char *cut_fnc;
-//	const char *agg_fnc;
-//	const char *agg_sep;
-	static char query_str[3000];
-
-	switch((int)(uintptr_t)CONFIG_DATABASE_ENGINE) {
-	    case DATABASE_ENGINE_POSTGRESQL:
-				// prepare query for PostgreSQL
-				zbx_snprintf(query_str, sizeof(query_str),
-				"SELECT "
-				// item name with $1 - $9 replaced and escaped ',' and ' '
-				    "replace(replace(replace("
-				        "coalesce("
-				            // replace all $1 - $9 in item name with key parameters
-				            "replace(replace(replace(replace(replace(replace(replace(replace(replace(i.name,"
-				            " '$1', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 1)),"
-				            " '$2', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 2)),"
-				            " '$3', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 3)),"
-				            " '$4', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 4)),"
-				            " '$5', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 5)),"
-				            " '$6', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 6)),"
-				            " '$7', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 7)),"
-				            " '$8', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 8)),"
-				            " '$9', split_part(substring(i.key_ FROM '\\[(.+)\\]'), ',', 9)),"
-				            // or use plain item name if no variables to replace
-				            "i.name"
-				        "), "
-				    "' ', '\\ '), '\"', '\\\"'), ',', '\\,')"
-				" || "
-				// host name with escaped ',' and ' '
-				    "',host_name=' || "
-				    "replace(replace(("
-				        "select h.name from hosts h where h.hostid=i.hostid"
-				    "), ' ', '\\ '), ',', '\\,')"
-				" || "
-				// host groups with escaped ',' and ' ' joined with '|'
-				    "',host_groups=' || "
-				    "replace(replace(("
-				        "select string_agg(g.name, '|') "
-				        "from %s g "
-				        "inner join hosts_groups hg on hg.groupid = g.groupid "
-				        "where hg.hostid=i.hostid"
-				    "), ' ', '\\ '), ',', '\\,')"
-				// " || "
-				// item_key with escaped ',' and ' '
-				//     "',item_key=' || "
-				//     "replace(replace(("
-				//         "i.key_"
-				//     "), ' ', '\\ '), ',', '\\,')"
-				" || "
-				// applications
-				    "coalesce("
-				    "',applications=' || replace(replace(("
-				        "select string_agg(a.name, '|') "
-				        "from applications a "
-				        "inner join items_applications ia on ia.applicationid = a.applicationid "
-				        "where ia.itemid=i.itemid"
-				    "), ' ', '\\ '), ',', '\\,'), "
-				    "'') "
-				"FROM items i WHERE i.itemid=" ZBX_FS_UI64,
-				// Zabbix 3 vs Zabbix 4 table name
-				(CONFIG_ZABBIX_MAJOR_VERSION > (int*) 3) ? "hstgrp": "groups", itemid);
-				break;
-
-	    case DATABASE_ENGINE_MYSQL:
-				// prepare query for MySQL
-				zbx_snprintf(query_str, sizeof(query_str),
-				"SELECT CONCAT("
-				// item name with $1 - $9 replaced and ',', '"' and ' ' escaped
-				    "replace(replace(replace("
-				        "coalesce("
-				            // replace all $1 - $9 in item name with key parameters
-										// magic line explained:
-										// +------------------------------------------------+-----------------------------------------------+---------------------------------------------------------------------------------------------------------------------------+
-										// | key_                                           | name                                          | substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))) |
-										// +------------------------------------------------+-----------------------------------------------+---------------------------------------------------------------------------------------------------------------------------+
-										// | web.test.rspcode[CURL mockapp - http,Homepage] | Response code for step "$2" of scenario "$1". | CURL mockapp - http,Homepage                                                                                              |
-										// +------------------------------------------------+-----------------------------------------------+---------------------------------------------------------------------------------------------------------------------------+
-										// find first '[' and last ']' in the key_ and for what is between use substring_index() to extract correct parameter
-				            "replace(replace(replace(replace(replace(replace(replace(replace(replace(i.name,"
-				            " '$1', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 1), ',', -1)),"
-				            " '$2', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 2), ',', -1)),"
-				            " '$3', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 3), ',', -1)),"
-				            " '$4', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 4), ',', -1)),"
-				            " '$5', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 5), ',', -1)),"
-				            " '$6', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 6), ',', -1)),"
-				            " '$7', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 7), ',', -1)),"
-				            " '$8', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 8), ',', -1)),"
-				            " '$9', substring_index(substring_index(substring(i.key_, position('[' in i.key_)+1, length(i.key_) - position('[' in i.key_) - position(']' in reverse(i.key_))), ',', 9), ',', -1)),"
-				            // or use plain item name if no variables to replace
-				            "i.name"
-				        "), "
-				    "' ', '\\\\ '), '\"', '\\\\\"'), ',', '\\\\,')"
-				", "
-				// host name with escaped ',' and ' '
-				    "concat(',host_name=', replace(replace(("
-				        "select h.name from hosts h where h.hostid=i.hostid"
-				    "), ' ', '\\\\ '), ',', '\\\\,'))"
-				", "
-				// host groups with escaped ',' and ' ' joined with '|'
-				    "concat(',host_groups=', replace(replace(("
-				        "select group_concat(g.name SEPARATOR '|') "
-				        "from %s g "
-				        "inner join hosts_groups hg on hg.groupid = g.groupid "
-				        "where hg.hostid=i.hostid"
-				    "), ' ', '\\\\ '), ',', '\\\\,'))"
-				// ", "
-				// item_key with escaped ',' and ' '
-				//     "concat(',item_key=', replace(replace(("
-				//         "i.key_"
-				//     "), ' ', '\\\\ '), ',', '\\\\,'))"
-				", "
-				// applications
-				    "coalesce(concat(',applications=', replace(replace(("
-				        "select group_concat(a.name SEPARATOR '|') "
-				        "from applications a "
-				        "inner join items_applications ia on ia.applicationid = a.applicationid "
-				        "where ia.itemid=i.itemid"
-				    "), ' ', '\\\\ '), ',', '\\\\,')), "
-				    "'') "
-				") FROM items i WHERE i.itemid=" ZBX_FS_UI64,
-
-				// Zabbix 3 vs Zabbix 4 table name
-				(CONFIG_ZABBIX_MAJOR_VERSION > (int*) 3) ? "hstgrp": "groups", itemid);
-				break;
-
-	    default:
-				THIS_SHOULD_NEVER_HAPPEN;
+	if(CONFIG_ITEM_CACHE_SNAPSHOT != NULL){
+		item_cache_snapshot_save(CONFIG_ITEM_CACHE_SNAPSHOT);
 	}
 
-	// log for debugging the query
-	// zabbix_log(MODULE_LOG_LEVEL, "[%s] itemid_to_influx_data query: %s", MODULE_NAME, query_str);
-	result = DBselect("%s", query_str);
-
-	if (NULL != (row = DBfetch(result)))
-	{
-		ret_string = zbx_strdup(NULL, row[0]);
-	}
-	else {
-		zabbix_log(LOG_LEVEL_ERR, "[%s] missing information for itemid " ZBX_FS_UI64, MODULE_NAME, itemid);
-		ret_string = NULL;
-	}
-	DBfree_result(result);
+	batch_state_destroy();
+	shared_writer_destroy();
+	send_queue_destroy();
+	spool_destroy();
+	item_cache_destroy();
+	influxdb_writer_uninit();
+	rollup_destroy();
+	deadband_destroy();
+	item_filter_destroy();
+	module_stats_destroy();
 
-	// log for debugging the query
-	// zabbix_log(MODULE_LOG_LEVEL, "[%s] itemid_to_influx_data result: %s", MODULE_NAME, ret_string);
-	return ret_string;
+	return ZBX_MODULE_OK;
 }
 
 /******************************************************************************
@@ -392,6 +389,138 @@ char *itemid_to_influx_data(zbx_uint64_t itemid)
 #define ZBX_ITEM_TEXT 4
 #define ZBX_ITEM_LOG 5
 
+static zbx_uint64_t history_get_itemid(const int item_type, const void *history, int i){
+	switch(item_type){
+		case  ZBX_ITEM_FLOAT:
+			return ((const ZBX_HISTORY_FLOAT*)history)[i].itemid;
+		case  ZBX_ITEM_INTEGER:
+			return ((const ZBX_HISTORY_INTEGER*)history)[i].itemid;
+		case  ZBX_ITEM_STRING:
+			return ((const ZBX_HISTORY_STRING*)history)[i].itemid;
+		case  ZBX_ITEM_TEXT:
+			return ((const ZBX_HISTORY_TEXT*)history)[i].itemid;
+		case  ZBX_ITEM_LOG:
+			return ((const ZBX_HISTORY_LOG*)history)[i].itemid;
+		default:
+			THIS_SHOULD_NEVER_HAPPEN;
+			return 0;
+	}
+}
+
+/* whether a value is exported according to DeadbandRule, see deadband.c */
+static int history_deadband_check(const int item_type, const void *history, int i){
+	const ZBX_HISTORY_FLOAT *history_float;
+	const ZBX_HISTORY_INTEGER *history_integer;
+	const ZBX_HISTORY_STRING *history_string;
+	const ZBX_HISTORY_TEXT *history_text;
+
+	switch(item_type){
+		case  ZBX_ITEM_FLOAT:
+			history_float = &((const ZBX_HISTORY_FLOAT*)history)[i];
+			return deadband_check_double(history_float->itemid, history_float->clock, history_float->value);
+		case  ZBX_ITEM_INTEGER:
+			history_integer = &((const ZBX_HISTORY_INTEGER*)history)[i];
+			return deadband_check_uint64(history_integer->itemid, history_integer->clock, history_integer->value);
+		case  ZBX_ITEM_STRING:
+			history_string = &((const ZBX_HISTORY_STRING*)history)[i];
+			return deadband_check_str(history_string->itemid, DEADBAND_STRING, history_string->clock,
+					history_string->value);
+		case  ZBX_ITEM_TEXT:
+			history_text = &((const ZBX_HISTORY_TEXT*)history)[i];
+			return deadband_check_str(history_text->itemid, DEADBAND_TEXT, history_text->clock,
+					history_text->value);
+		default:
+			return SUCCEED;
+	}
+}
+
+/* appends "<name>=", the value goes to field value or, with InfluxDBSchema=host, the one named by the */
+/* item key, other fields of log entries are prefixed with it (system.log_severity) */
+static void history_append_field(line_buffer_t *lines, const influx_series_t *series, const char *name){
+	if(0 == series->fields){
+		line_buffer_append_str(lines, NULL != name ? name : "value");
+	}
+	else {
+		line_buffer_append(lines, series_keys.data + series->offset + series->fields, series->len - series->fields);
+
+		if(NULL != name){
+			line_buffer_append(lines, "_", 1);
+			line_buffer_append_str(lines, name);
+		}
+	}
+
+	line_buffer_append(lines, "=", 1);
+}
+
+/* with InfluxDBSchema=host the series key is followed by a space and the field name, see item_meta.c */
+static size_t history_series_fields(const char *series, size_t len){
+	size_t i;
+
+	if(ITEM_META_SCHEMA_HOST != CONFIG_INFLUXDB_SCHEMA)
+		return 0;
+
+	for(i = 0; i < len && ' ' != series[i]; i++){
+		if('\\' == series[i])
+			i++;
+	}
+
+	return i < len ? i + 1 : 0;
+}
+
+// per-process state reused by every batch, only emptied in between
+static zbx_hashset_t		series_map;
+static zbx_vector_uint64_t	missing_itemids;
+static line_buffer_t		batch_lines;
+static coalesce_t		batch_points;
+static pid_t			batch_state_pid = 0;
+
+static void batch_state_init(void){
+	if(batch_state_pid != getpid()){
+		zbx_hashset_create(&series_map, 1000, ZBX_DEFAULT_UINT64_HASH_FUNC, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+		zbx_vector_uint64_create(&missing_itemids);
+		memset(&batch_lines, 0, sizeof(batch_lines));
+		memset(&series_keys, 0, sizeof(series_keys));
+		memset(&batch_points, 0, sizeof(batch_points));
+		batch_state_pid = getpid();
+	}
+
+	zbx_hashset_clear(&series_map);
+	zbx_vector_uint64_clear(&missing_itemids);
+	line_buffer_reset(&batch_lines);
+	line_buffer_reset(&series_keys);
+	coalesce_reset(&batch_points);
+}
+
+static void batch_state_destroy(void){
+	if(batch_state_pid != getpid())
+		return;
+
+	zbx_hashset_destroy(&series_map);
+	zbx_vector_uint64_destroy(&missing_itemids);
+	line_buffer_free(&batch_lines);
+	line_buffer_free(&series_keys);
+	coalesce_free(&batch_points);
+	item_meta_destroy();
+	batch_state_pid = 0;
+}
+
+/* item_meta_cb_t keeping a series key read from the database in the batch */
+static void series_resolved(zbx_uint64_t itemid, const char *series_key, size_t len, zbx_uint64_t match, void *arg){
+	influx_series_t *series;
+
+	if (NULL == (series = (influx_series_t *)zbx_hashset_search((zbx_hashset_t *)arg, &itemid)))
+		return;
+
+	if (0 != len)
+		deadband_classify(itemid, match);
+
+	series->offset = series_keys.offset;
+	series->len = len;
+	series->fields = history_series_fields(series_key, len);
+	series->filtered = (0 == len);
+	line_buffer_append(&series_keys, series_key, len);
+}
+
 static void history_general_cb(const int item_type, const void *history, int history_num){
 	int i;
 
@@ -421,16 +550,75 @@ static void history_general_cb(const int item_type, const void *history, int his
 			THIS_SHOULD_NEVER_HAPPEN;
 	}
 
-	char influxdb_data_entry[(METRIC_LEN + ITEM_VALUE_LEN + 20) * history_num];
-	influxdb_data_entry[0] = '\0';
-
 	zbx_uint64_t itemid, int_val;
 	int cl, ns, log_timestamp, log_logid, log_sev;
 	double float_val;
-	const char str_val[ITEM_VALUE_LEN], *log_src;
-	char timestamp[20];
+	const char *log_src;
+	size_t line_start, fields_start, timestamp_start;
+	zbx_uint64_t db_start;
+	line_buffer_t *lines;
+
+	zbx_uint64_t cache_hits, cache_misses, filtered = 0, suppressed = 0, rollups = 0, truncated = 0;
+	int cache_entries, coalesced;
+
+	influx_series_t *series, series_local;
 
-	char *influx_data = NULL;
+	spool_start_thread();
+	batch_state_init();
+	module_stats_add(MODULE_STATS_VALUES, history_num);
+
+	// series keys of all distinct items in the batch, cached ones first,
+	// the rest resolved from the database in bulk
+
+	for(i = 0; i < history_num; i++){
+		series_local.itemid = history_get_itemid(item_type, history, i);
+
+		if (NULL != zbx_hashset_search(&series_map, &series_local))
+			continue;
+
+		series_local.offset = series_keys.offset;
+
+		// an empty key is cached for an item filtered out
+		if (SUCCEED == item_cache_get(series_local.itemid, &series_keys)){
+			series_local.len = series_keys.offset - series_local.offset;
+			series_local.fields = history_series_fields(series_keys.data + series_local.offset, series_local.len);
+			series_local.filtered = (0 == series_local.len);
+		}
+		else {
+			series_local.len = 0;
+			series_local.fields = 0;
+			series_local.filtered = 0;
+			zbx_vector_uint64_append(&missing_itemids, series_local.itemid);
+		}
+
+		zbx_hashset_insert(&series_map, &series_local, sizeof(series_local));
+	}
+
+	if(CONFIG_ITEM_CACHE_SIZE > 0){
+		module_stats_add(MODULE_STATS_CACHE_HITS, series_map.num_data - missing_itemids.values_num);
+		module_stats_add(MODULE_STATS_CACHE_MISSES, missing_itemids.values_num);
+	}
+
+	if (0 != missing_itemids.values_num){
+		zbx_vector_uint64_sort(&missing_itemids, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+		db_start = module_stats_clock_us();
+		item_meta_resolve(&missing_itemids, series_resolved, &series_map);
+		module_stats_latency(MODULE_STATS_DB_LATENCY, module_stats_clock_us() - db_start);
+		module_stats_add(MODULE_STATS_DB_LOOKUPS, 1);
+		module_stats_add(MODULE_STATS_DB_ITEMS, missing_itemids.values_num);
+	}
+
+	// cache what was read from the database
+	for(i = 0; i < missing_itemids.values_num; i++){
+		series = (influx_series_t *)zbx_hashset_search(&series_map, &missing_itemids.values[i]);
+
+		if (0 == series->len && 0 == series->filtered){
+			zabbix_log(LOG_LEVEL_ERR, "[%s] missing information for itemid " ZBX_FS_UI64, MODULE_NAME, series->itemid);
+			continue;
+		}
+
+		item_cache_put(series->itemid, 0 != series->len ? series_keys.data + series->offset : "", series->len);
+	}
 
 	for(i = 0; i < history_num; i++){
 		switch(item_type){
@@ -469,44 +657,132 @@ static void history_general_cb(const int item_type, const void *history, int his
 				THIS_SHOULD_NEVER_HAPPEN;
 		}
 
-		influx_data = itemid_to_influx_data(itemid);
+		series = (influx_series_t *)zbx_hashset_search(&series_map, &itemid);
 
-		if (NULL == influx_data)
+		if (0 == series->len){
+			filtered += series->filtered;
 			continue;
+		}
+
+		// rollups see every exported value, points of windows it closes go first
+		if (ZBX_ITEM_FLOAT == item_type){
+			rollups += rollup_add_double(&batch_lines, series_keys.data + series->offset, series->len, itemid, cl,
+					float_val);
+		}
+		else if (ZBX_ITEM_INTEGER == item_type){
+			rollups += rollup_add_uint64(&batch_lines, series_keys.data + series->offset, series->len, itemid, cl,
+					int_val);
+		}
+
+		// values within the deadband of the last exported one are left out
+		if (SUCCEED != history_deadband_check(item_type, history, i)){
+			suppressed++;
+			continue;
+		}
 
-		char entry[METRIC_LEN + ITEM_VALUE_LEN + 20];
-		zbx_snprintf(timestamp, sizeof(timestamp), "%09d%09d", cl, ns);
+		// with InfluxDBSchema=host values of a host are merged into points at the end,
+		// log entries are all kept and written as they are
+		lines = (0 != series->fields && ZBX_ITEM_LOG != item_type) ? &batch_points.lines : &batch_lines;
+		line_start = lines->offset;
+		line_buffer_append(lines, series_keys.data + series->offset,
+				0 != series->fields ? series->fields - 1 : series->len);
+		line_buffer_append(lines, " ", 1);
+		fields_start = lines->offset;
+		history_append_field(lines, series, NULL);
 
 		switch(item_type){
 			case  ZBX_ITEM_FLOAT:
-				zbx_snprintf(entry, sizeof(entry), "%s value=%f %s\n", influx_data, float_val, timestamp);
+				if(SUCCEED != lp_append_double(lines, float_val)){
+					zabbix_log(LOG_LEVEL_DEBUG, "[%s] skipping non-finite value of itemid " ZBX_FS_UI64,
+							MODULE_NAME, itemid);
+					line_buffer_truncate(lines, line_start);
+					continue;
+				}
 				break;
 			case  ZBX_ITEM_INTEGER:
-				zbx_snprintf(entry, sizeof(entry), "%s value=" ZBX_FS_UI64 " %s\n", influx_data, int_val, timestamp);
-
+				lp_append_uint64(lines, int_val);
 				break;
 			case  ZBX_ITEM_STRING:
-				zbx_snprintf(entry, sizeof(entry), "%s value=\"%s\" %s\n", influx_data, history_string[i].value, timestamp);
-
+				truncated += (SUCCEED != lp_append_string(lines, history_string[i].value, CONFIG_MAX_VALUE_LENGTH));
 				break;
 			case  ZBX_ITEM_TEXT:
-				zbx_snprintf(entry, sizeof(entry), "%s value=\"%s\" %s\n", influx_data, history_text[i].value, timestamp);
-
+				truncated += (SUCCEED != lp_append_string(lines, history_text[i].value, CONFIG_MAX_VALUE_LENGTH));
 				break;
 			case  ZBX_ITEM_LOG:
-				zbx_snprintf(entry, sizeof(entry), "%s,logeventid=%d,severity=%d,source=%s value=\"%s\" %d000000000\n", influx_data, log_logid, log_sev, log_src, history_log[i].value, log_timestamp);
+				truncated += (SUCCEED != lp_append_string(lines, history_log[i].value, CONFIG_MAX_VALUE_LENGTH));
+
+				if(NULL != log_src && '\0' != *log_src){
+					line_buffer_append(lines, ",", 1);
+					history_append_field(lines, series, "source");
+					truncated += (SUCCEED != lp_append_string(lines, log_src, CONFIG_MAX_VALUE_LENGTH));
+				}
+
+				line_buffer_append(lines, ",", 1);
+				history_append_field(lines, series, "severity");
+				lp_append_int64(lines, log_sev);
+				line_buffer_append(lines, ",", 1);
+				history_append_field(lines, series, "logeventid");
+				lp_append_int64(lines, log_logid);
+
+				// log entries are stamped with the time reported by the agent, if it parsed one
+				if(0 != log_timestamp){
+					cl = log_timestamp;
+					ns = 0;
+				}
 				break;
 			default:
 				THIS_SHOULD_NEVER_HAPPEN;
 		}
-		/* + 2 for new line character */
-		zbx_strlcat(influxdb_data_entry, entry, strlen(influxdb_data_entry) + strlen(entry) + 2);
 
-		// clean up
-		zbx_free(influx_data);
+		// points of a host share the time of its values within HostSchemaInterval
+		if(lines == &batch_points.lines && 0 != CONFIG_HOST_SCHEMA_INTERVAL){
+			cl -= cl % CONFIG_HOST_SCHEMA_INTERVAL;
+			ns = 0;
+		}
+
+		line_buffer_append(lines, " ", 1);
+		timestamp_start = lines->offset;
+		lp_append_timestamp(lines, cl, ns, CONFIG_INFLUXDB_PRECISION);
+		line_buffer_append(lines, "\n", 1);
+
+		if(lines == &batch_points.lines)
+			coalesce_add(&batch_points, itemid, line_start, fields_start, timestamp_start);
+	}
+
+	coalesced = coalesce_merge(&batch_points, &batch_lines);
+
+	module_stats_add(MODULE_STATS_FILTERED, filtered);
+	module_stats_add(MODULE_STATS_SUPPRESSED, suppressed);
+	module_stats_add(MODULE_STATS_ROLLUPS, rollups);
+	module_stats_add(MODULE_STATS_COALESCED, coalesced);
+	module_stats_add(MODULE_STATS_TRUNCATED, truncated);
+
+	item_cache_get_stats(&cache_hits, &cache_misses, &cache_entries);
+	zabbix_log(MODULE_LOG_LEVEL, "[%s]     item cache: %d entries, " ZBX_FS_UI64 " hits, " ZBX_FS_UI64 " misses",
+			MODULE_NAME, cache_entries, cache_hits, cache_misses);
+
+	if(0 == batch_lines.offset)
+		return;
+
+	// a batch can be megabytes, only its start is logged
+	zabbix_log(MODULE_LOG_LEVEL, "[%s]     influxdb_data_entry: " ZBX_FS_UI64 " bytes: %.*s", MODULE_NAME,
+			(zbx_uint64_t)batch_lines.offset, (int)MIN(batch_lines.offset, 256), batch_lines.data);
+
+	// with SharedWriter the batch is written by one process for all, unless the ring is full
+	if(CONFIG_SHARED_WRITER && SUCCEED == shared_writer_push(batch_lines.data, batch_lines.offset))
+		return;
+
+	if(CONFIG_ASYNC_SEND){
+		char *data = (char *)zbx_malloc(NULL, batch_lines.offset + 1);
+
+		memcpy(data, batch_lines.data, batch_lines.offset + 1);
+		send_queue_push(data);
+	} else {
+		unsigned int endpoints = influxdb_endpoints_all();
+
+		if(SUCCEED != write_to_influxdb(batch_lines.data, &endpoints))
+			spool_write(batch_lines.data, endpoints);
 	}
-	zabbix_log(MODULE_LOG_LEVEL, "[%s]     influxdb_data_entry: %s", MODULE_NAME, influxdb_data_entry);
-	write_to_influxdb(influxdb_data_entry);
 
 }
 
@@ -566,8 +842,8 @@ ZBX_HISTORY_WRITE_CBS	zbx_module_history_write_cbs(void)
 		history_float_cb,
 		history_integer_cb,
 		history_string_cb,
-		NULL, // history_text_cb, (not tested)
-		NULL, // history_log_cb, (not tested)
+		history_text_cb,
+		history_log_cb,
 	};
 
 	return callbacks;
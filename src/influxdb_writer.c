@@ -0,0 +1,1416 @@
+// this code is for sending line protocol to InfluxDB over http(s)
+// 1] cURL global state is set up once in zbx_module_init and released in zbx_module_uninit
+// 2] each history syncer process (each thread of it, see send_queue.c and spool.c) keeps
+//    its own pool of InfluxDBConnections easy handles in a multi handle for its whole life,
+//    so the TCP connections (and TLS sessions with https) are reused between batches
+// 3] a batch is split into chunks of at most MaxLinesPerWrite lines / MaxBytesPerWrite
+//    bytes which are posted concurrently, one per connection (or HTTP/2 stream with
+//    InfluxDBHTTP2), every chunk is retried on its own; a batch is written only when all
+//    of its chunks are, otherwise the whole batch is left to the caller - InfluxDB
+//    overwrites identical points, so writing a chunk twice does no harm
+// 4] connect and total timeouts keep a slow InfluxDB from stalling a syncer forever
+// 5] the HTTP status decides what happens to a chunk:
+//    2xx - written
+//    400 - InfluxDB refused some lines, they are logged and dropped, the rest is written
+//    429, 5xx and network errors - retried with jittered exponential backoff honouring
+//          Retry-After, up to InfluxDBMaxRetries times
+//    other - not written (left to the caller to spool)
+// 6] after InfluxDBBreakerThreshold failed batches in a row the circuit breaker opens and
+//    writes fail immediately for InfluxDBBreakerTimeout seconds, then one write is let
+//    through to probe InfluxDB
+// 7] with InfluxDBGzipLevel set, payloads of at least InfluxDBGzipMinSize bytes are sent
+//    gzip compressed (Content-Encoding: gzip)
+// 8] InfluxDBAddress may list several InfluxDB nodes, each with its own connections,
+//    chunks and circuit breaker, so a node that is down fails fast and does not hold
+//    back the others. With InfluxDBFanout=replicate every node gets every line, with
+//    shard the series key (measurement and tags) of a line picks one node by jump
+//    consistent hash (Lamping, Veach), so a series always lands on the same node.
+//    Callers get back the set of nodes a payload was not written to, so only those
+//    are retried from the spool.
+// 9] with InfluxDBAPIVersion=2 lines go to /api/v2/write with the org, bucket and an
+//    Authorization: Token header, 1.x credentials are sent as basic auth, so neither
+//    shows up in the URL (and in proxy or InfluxDB access logs)
+// 10] with InfluxDBTransport=unix the nodes in InfluxDBAddress are paths of Unix
+//    sockets InfluxDB (or Telegraf) listens on, the requests are the same HTTP ones
+//    without TCP and loopback overhead
+// 11] with InfluxDBTransport=udp lines are sent to the UDP listener of each node,
+//    packed into datagrams of at most InfluxDBUDPPayloadSize bytes straight from
+//    the payload, over a connected non-blocking socket per node and thread. Nothing
+//    is acknowledged, so nothing is retried or spooled either: a datagram the kernel
+//    cannot take right away is dropped (udp_dropped) rather than block the syncer.
+
+#include "load_config.h"
+#include "influxdb_writer.h"
+#include "zbxalgo.h"
+#include "line_buffer.h"
+#include "lp_format.h"
+#include "module_stats.h"
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+/* only the start of error responses is kept */
+#define RESPONSE_MAX_LEN	4096
+
+/* InfluxDB node, set up before history syncers are forked */
+typedef struct
+{
+	char	*name;
+	char	*url;
+
+	/* circuit breaker, shared by all threads of the process */
+	int	breaker_failures;
+	time_t	breaker_open_until;
+	int	breaker_probing;
+
+	/* resolved address of the UDP listener */
+	struct sockaddr_storage	addr;
+	socklen_t		addr_len;
+}
+influxdb_endpoint_t;
+
+static influxdb_endpoint_t	*endpoints = NULL;
+static int			endpoints_num = 0;
+
+#define CHUNK_PENDING	0
+#define CHUNK_SENDING	1
+#define CHUNK_DONE	2
+#define CHUNK_FAILED	3
+
+/* part of a batch posted as one request */
+typedef struct
+{
+	int		endpoint;
+	const char	*data;
+	size_t		len;
+	int		lines;
+	char		*resend;	/* the chunk without lines refused by InfluxDB */
+	int		state;
+	int		attempt;
+	zbx_uint64_t	retry_at;	/* monotonic time in ms, not sent before */
+}
+influxdb_chunk_t;
+
+/* easy handle of the pool with its own response and compressed body */
+typedef struct
+{
+	CURL			*easy;
+	int			endpoint;
+	influxdb_chunk_t	*chunk;
+	char			*response;
+	size_t			response_alloc;
+	size_t			response_offset;
+	long			retry_after;
+	unsigned char		*gzip_buf;
+	size_t			gzip_alloc;
+	size_t			body_size;	/* as posted, compressed or not */
+}
+influxdb_conn_t;
+
+static __thread CURLM		*multi = NULL;
+static __thread pid_t		multi_pid = 0;
+static __thread influxdb_conn_t	*conns = NULL;
+static __thread int		conns_num = 0;
+
+static __thread influxdb_chunk_t	*chunks = NULL;
+static __thread int		chunks_num = 0, chunks_alloc = 0;
+
+/* lines of a batch per node in shard mode */
+static __thread line_buffer_t	*shard_lines = NULL;
+
+/* UDP sockets of the nodes, -1 if one could not be created */
+static __thread int		*udp_fds = NULL;
+static __thread pid_t		udp_pid = 0;
+
+static __thread unsigned int	backoff_seed = 0;
+
+/* gzip state is kept between writes */
+static __thread z_stream	*gzip_stream = NULL;
+
+/* request headers, built before fork and only read afterwards */
+static struct curl_slist	*headers = NULL;
+static struct curl_slist	*gzip_headers = NULL;
+
+static pthread_mutex_t	breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *influxdb_precision(void)
+{
+	switch (CONFIG_INFLUXDB_PRECISION){
+		case LP_PRECISION_S:
+			return "s";
+		case LP_PRECISION_MS:
+			return "ms";
+		case LP_PRECISION_US:
+			return 1 == CONFIG_INFLUXDB_API_VERSION ? "u" : "us";
+		default:
+			return "ns";
+	}
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_endpoint_url
+ *
+ *	Purpose: Builds the write URL of a node for the configured API version
+ *
+ ******************************************************************************/
+
+static char *influxdb_endpoint_url(const char *name)
+{
+	char *url, *db, *org, *bucket;
+
+	if (1 == CONFIG_INFLUXDB_API_VERSION){
+		db = curl_easy_escape(NULL, CONFIG_INFLUXDB_NAME, 0);
+		url = zbx_dsprintf(NULL, "%s://%s/write?db=%s&precision=%s", CONFIG_INFLUXDB_PROTOCOL, name, db,
+				influxdb_precision());
+		curl_free(db);
+
+		return url;
+	}
+
+	org = curl_easy_escape(NULL, CONFIG_INFLUXDB_ORG, 0);
+	bucket = curl_easy_escape(NULL, CONFIG_INFLUXDB_BUCKET, 0);
+	url = zbx_dsprintf(NULL, "%s://%s/api/v2/write?org=%s&bucket=%s&precision=%s", CONFIG_INFLUXDB_PROTOCOL,
+			name, org, bucket, influxdb_precision());
+	curl_free(org);
+	curl_free(bucket);
+
+	return url;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_endpoint_resolve
+ *
+ *	Purpose: Resolves the UDP listener address of a node, once before fork so
+ *				that sending does not wait for DNS
+ *
+ ******************************************************************************/
+
+static int influxdb_endpoint_resolve(influxdb_endpoint_t *endpoint)
+{
+	struct addrinfo hints, *ai = NULL;
+	char *host, *port;
+	int rc;
+
+	host = zbx_strdup(NULL, endpoint->name);
+	port = strrchr(host, ':');
+	*port++ = '\0';
+
+	if ('[' == *host){
+		memmove(host, host + 1, strlen(host));
+		host[strlen(host) - 1] = '\0';
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (0 != (rc = getaddrinfo(host, port, &hints, &ai))){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot resolve InfluxDB %s: %s", MODULE_NAME, endpoint->name,
+				gai_strerror(rc));
+		zbx_free(host);
+		return FAIL;
+	}
+
+	memcpy(&endpoint->addr, ai->ai_addr, ai->ai_addrlen);
+	endpoint->addr_len = ai->ai_addrlen;
+
+	freeaddrinfo(ai);
+	zbx_free(host);
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_endpoint_add
+ *
+ *	Purpose: Adds a node given as host, host:port, IPv6 or [IPv6]:port, or as
+ *				a socket path with InfluxDBTransport=unix
+ *
+ ******************************************************************************/
+
+static int influxdb_endpoint_add(const char *address)
+{
+	influxdb_endpoint_t *endpoint;
+	const char *colon;
+	char *name;
+
+	if ('\0' == *address)
+		return SUCCEED;
+
+	if (INFLUXDB_ENDPOINTS_MAX == endpoints_num){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] too many addresses in InfluxDBAddress, at most %d are supported",
+				MODULE_NAME, INFLUXDB_ENDPOINTS_MAX);
+		return FAIL;
+	}
+
+	if (INFLUXDB_TRANSPORT_UNIX == CONFIG_INFLUXDB_TRANSPORT){
+		if ('/' != *address){
+			zabbix_log(LOG_LEVEL_ERR, "[%s] InfluxDBAddress must list socket paths with InfluxDBTransport=unix,"
+					" found \"%s\"", MODULE_NAME, address);
+			return FAIL;
+		}
+
+		endpoints = (influxdb_endpoint_t *)zbx_realloc(endpoints, sizeof(influxdb_endpoint_t) * (endpoints_num + 1));
+		endpoint = &endpoints[endpoints_num++];
+		memset(endpoint, 0, sizeof(influxdb_endpoint_t));
+		endpoint->name = zbx_strdup(NULL, address);
+		// the host is only sent in the Host header
+		endpoint->url = influxdb_endpoint_url("localhost");
+
+		return SUCCEED;
+	}
+
+	if ('[' == *address)
+		colon = strstr(address, "]:");
+	else if (NULL != (colon = strchr(address, ':')) && NULL != strchr(colon + 1, ':'))
+		colon = NULL;	/* bare IPv6 address */
+
+	if (NULL != colon)
+		name = zbx_strdup(NULL, address);
+	else if (NULL != strchr(address, ':') && '[' != *address)
+		name = zbx_dsprintf(NULL, "[%s]:%s", address, CONFIG_INFLUXDB_PORT);
+	else
+		name = zbx_dsprintf(NULL, "%s:%s", address, CONFIG_INFLUXDB_PORT);
+
+	endpoints = (influxdb_endpoint_t *)zbx_realloc(endpoints, sizeof(influxdb_endpoint_t) * (endpoints_num + 1));
+	endpoint = &endpoints[endpoints_num++];
+	memset(endpoint, 0, sizeof(influxdb_endpoint_t));
+	endpoint->name = name;
+
+	if (INFLUXDB_TRANSPORT_UDP == CONFIG_INFLUXDB_TRANSPORT)
+		return influxdb_endpoint_resolve(endpoint);
+
+	endpoint->url = influxdb_endpoint_url(name);
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_writer_init
+ *
+ *	Purpose: Global cURL initialisation and InfluxDB nodes from the comma
+ *				separated InfluxDBAddress, must be called before any
+ *				process is forked
+ *
+ ******************************************************************************/
+
+int influxdb_writer_init(void)
+{
+	CURLcode res;
+	char *addresses, *address, *next, *auth;
+
+	if (CURLE_OK != (res = curl_global_init(CURL_GLOBAL_ALL))){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] curl_global_init() failed: %s", MODULE_NAME, curl_easy_strerror(res));
+		return FAIL;
+	}
+
+	addresses = zbx_strdup(NULL, CONFIG_INFLUXDB_ADDRESS);
+
+	for (address = addresses; NULL != address; address = next){
+		if (NULL != (next = strchr(address, ',')))
+			*next++ = '\0';
+
+		zbx_lrtrim(address, " \t");
+
+		if (SUCCEED != influxdb_endpoint_add(address)){
+			zbx_free(addresses);
+			return FAIL;
+		}
+	}
+
+	zbx_free(addresses);
+
+	if (0 == endpoints_num){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] no address in InfluxDBAddress", MODULE_NAME);
+		return FAIL;
+	}
+
+	if (2 == CONFIG_INFLUXDB_API_VERSION){
+		auth = zbx_dsprintf(NULL, "Authorization: Token %s", CONFIG_INFLUXDB_TOKEN);
+		headers = curl_slist_append(headers, auth);
+		gzip_headers = curl_slist_append(gzip_headers, auth);
+		zbx_free(auth);
+	}
+
+	headers = curl_slist_append(headers, "Content-Type: text/plain; charset=utf-8");
+	gzip_headers = curl_slist_append(gzip_headers, "Content-Type: text/plain; charset=utf-8");
+	gzip_headers = curl_slist_append(gzip_headers, "Content-Encoding: gzip");
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_writer_uninit
+ *
+ ******************************************************************************/
+
+void influxdb_writer_uninit(void)
+{
+	int i;
+
+	influxdb_writer_close();
+	curl_global_cleanup();
+
+	curl_slist_free_all(headers);
+	curl_slist_free_all(gzip_headers);
+	headers = gzip_headers = NULL;
+
+	for (i = 0; i < endpoints_num; i++){
+		zbx_free(endpoints[i].name);
+		zbx_free(endpoints[i].url);
+	}
+
+	zbx_free(endpoints);
+	endpoints_num = 0;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_endpoints_all
+ *
+ *	Purpose: Returns the set of all configured InfluxDB nodes
+ *
+ ******************************************************************************/
+
+unsigned int influxdb_endpoints_all(void)
+{
+	return INFLUXDB_ENDPOINTS_MAX == endpoints_num ? ~0U : (1U << endpoints_num) - 1;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_endpoints_names
+ *
+ *	Purpose: Returns comma separated nodes of a set, for logging
+ *
+ ******************************************************************************/
+
+char *influxdb_endpoints_names(unsigned int set)
+{
+	char *names = NULL;
+	size_t names_alloc = 0, names_offset = 0;
+	int i;
+
+	zbx_strcpy_alloc(&names, &names_alloc, &names_offset, "");
+
+	for (i = 0; i < endpoints_num; i++){
+		if (0 == (set & (1U << i)))
+			continue;
+
+		if (0 != names_offset)
+			zbx_strcpy_alloc(&names, &names_alloc, &names_offset, ", ");
+
+		zbx_strcpy_alloc(&names, &names_alloc, &names_offset, endpoints[i].name);
+	}
+
+	return names;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_writer_close
+ *
+ *	Purpose: Closes the connection of the calling thread, threads writing to
+ *				InfluxDB must call it before they exit
+ *
+ ******************************************************************************/
+
+void influxdb_writer_close(void)
+{
+	int i;
+
+	for (i = 0; i < conns_num; i++){
+		// handles inherited over fork() belong to the parent
+		if (multi_pid == getpid()){
+			if (NULL != conns[i].chunk)
+				curl_multi_remove_handle(multi, conns[i].easy);
+
+			curl_easy_cleanup(conns[i].easy);
+		}
+
+		zbx_free(conns[i].response);
+		zbx_free(conns[i].gzip_buf);
+	}
+
+	if (NULL != multi && multi_pid == getpid())
+		curl_multi_cleanup(multi);
+
+	multi = NULL;
+	zbx_free(conns);
+	conns_num = 0;
+
+	zbx_free(chunks);
+	chunks_num = chunks_alloc = 0;
+
+	if (NULL != shard_lines){
+		for (i = 0; i < endpoints_num; i++)
+			line_buffer_free(&shard_lines[i]);
+
+		zbx_free(shard_lines);
+	}
+
+	if (NULL != udp_fds){
+		// descriptors inherited over fork() are copies, closing them does not affect the parent
+		for (i = 0; i < endpoints_num; i++){
+			if (-1 != udp_fds[i])
+				close(udp_fds[i]);
+		}
+
+		zbx_free(udp_fds);
+	}
+
+	if (NULL != gzip_stream){
+		deflateEnd(gzip_stream);
+		zbx_free(gzip_stream);
+	}
+}
+
+static size_t influxdb_response_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	influxdb_conn_t *conn = (influxdb_conn_t *)userdata;
+	size_t len = size * nmemb;
+
+	if (conn->response_offset < RESPONSE_MAX_LEN){
+		zbx_strncpy_alloc(&conn->response, &conn->response_alloc, &conn->response_offset, ptr,
+				MIN(len, RESPONSE_MAX_LEN - conn->response_offset));
+	}
+
+	return len;
+}
+
+static size_t influxdb_header_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	influxdb_conn_t *conn = (influxdb_conn_t *)userdata;
+	size_t len = size * nmemb;
+
+	// only the delay-seconds form of Retry-After is used, an HTTP-date is ignored
+	if (ZBX_CONST_STRLEN("Retry-After:") < len && 0 == strncasecmp(ptr, "Retry-After:", ZBX_CONST_STRLEN("Retry-After:")))
+		conn->retry_after = strtol(ptr + ZBX_CONST_STRLEN("Retry-After:"), NULL, 10);
+
+	return len;
+}
+
+static CURL *influxdb_easy_init(influxdb_conn_t *conn)
+{
+	CURL *easy;
+
+	if (NULL == (easy = curl_easy_init())){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] curl_easy_init() failed", MODULE_NAME);
+		return NULL;
+	}
+
+	curl_easy_setopt(easy, CURLOPT_URL, endpoints[conn->endpoint].url);
+
+	if (INFLUXDB_TRANSPORT_UNIX == CONFIG_INFLUXDB_TRANSPORT)
+		curl_easy_setopt(easy, CURLOPT_UNIX_SOCKET_PATH, endpoints[conn->endpoint].name);
+
+	curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, CONFIG_INFLUXDB_SSL_INSECURE ? 0L : 1L);
+	curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, CONFIG_INFLUXDB_SSL_INSECURE ? 0L : 1L);
+	curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, (long)CONFIG_INFLUXDB_CONNECT_TIMEOUT);
+	curl_easy_setopt(easy, CURLOPT_TIMEOUT, (long)CONFIG_INFLUXDB_TIMEOUT);
+	// timeouts must not be implemented with signals inside zabbix processes
+	curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(easy, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+	curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, influxdb_response_cb);
+	curl_easy_setopt(easy, CURLOPT_WRITEDATA, conn);
+	curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, influxdb_header_cb);
+	curl_easy_setopt(easy, CURLOPT_HEADERDATA, conn);
+	curl_easy_setopt(easy, CURLOPT_PRIVATE, conn);
+
+	if (1 == CONFIG_INFLUXDB_API_VERSION && NULL != CONFIG_INFLUXDB_USER){
+		curl_easy_setopt(easy, CURLOPT_USERNAME, CONFIG_INFLUXDB_USER);
+		curl_easy_setopt(easy, CURLOPT_PASSWORD, CONFIG_INFLUXDB_PWD);
+	}
+
+	if (0 != CONFIG_INFLUXDB_HTTP2){
+		// HTTP/2 is negotiated with TLS only, wait for the connection to multiplex on it
+		curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+	}
+
+	return easy;
+}
+
+static void influxdb_shard_init(void)
+{
+	if (INFLUXDB_FANOUT_SHARD == CONFIG_INFLUXDB_FANOUT && 1 < endpoints_num){
+		shard_lines = (line_buffer_t *)zbx_malloc(NULL, sizeof(line_buffer_t) * endpoints_num);
+		memset(shard_lines, 0, sizeof(line_buffer_t) * endpoints_num);
+	}
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_pool
+ *
+ *	Purpose: Sets up the connection pool of the calling thread on first use.
+ *				A pool inherited over fork() is never used nor cleaned up,
+ *				its connections belong to the parent.
+ *
+ ******************************************************************************/
+
+static int influxdb_pool(void)
+{
+	if (NULL != multi && multi_pid == getpid())
+		return SUCCEED;
+
+	multi = NULL;
+	conns = NULL;
+	conns_num = 0;
+	chunks = NULL;
+	chunks_num = chunks_alloc = 0;
+	shard_lines = NULL;
+
+	if (NULL == (multi = curl_multi_init())){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] curl_multi_init() failed", MODULE_NAME);
+		return FAIL;
+	}
+	multi_pid = getpid();
+
+	if (0 != CONFIG_INFLUXDB_HTTP2)
+		curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+	// every node gets connections of its own
+	conns = (influxdb_conn_t *)zbx_malloc(NULL, sizeof(influxdb_conn_t) * CONFIG_INFLUXDB_CONNECTIONS * endpoints_num);
+	memset(conns, 0, sizeof(influxdb_conn_t) * CONFIG_INFLUXDB_CONNECTIONS * endpoints_num);
+
+	for (conns_num = 0; conns_num < CONFIG_INFLUXDB_CONNECTIONS * endpoints_num; conns_num++){
+		conns[conns_num].endpoint = conns_num / CONFIG_INFLUXDB_CONNECTIONS;
+
+		if (NULL == (conns[conns_num].easy = influxdb_easy_init(&conns[conns_num]))){
+			influxdb_writer_close();
+			return FAIL;
+		}
+	}
+
+	influxdb_shard_init();
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_udp_pool
+ *
+ *	Purpose: Opens the UDP sockets of the calling thread on first use
+ *
+ ******************************************************************************/
+
+static void influxdb_udp_pool(void)
+{
+	int i;
+
+	if (NULL != udp_fds && udp_pid == getpid())
+		return;
+
+	influxdb_writer_close();
+	udp_pid = getpid();
+	udp_fds = (int *)zbx_malloc(NULL, sizeof(int) * endpoints_num);
+
+	for (i = 0; i < endpoints_num; i++){
+		// connected, so the route is looked up once and not for every datagram
+		if (-1 == (udp_fds[i] = socket(endpoints[i].addr.ss_family, SOCK_DGRAM, 0)) ||
+				0 != connect(udp_fds[i], (struct sockaddr *)&endpoints[i].addr, endpoints[i].addr_len)){
+			zabbix_log(LOG_LEVEL_ERR, "[%s] cannot open UDP socket to InfluxDB %s: %s", MODULE_NAME,
+					endpoints[i].name, zbx_strerror(errno));
+
+			if (-1 != udp_fds[i])
+				close(udp_fds[i]);
+
+			udp_fds[i] = -1;
+		}
+	}
+
+	influxdb_shard_init();
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_gzip
+ *
+ *	Purpose: Compresses a chunk into the gzip buffer of its connection
+ *
+ *	Returns: SUCCEED - conn->gzip_buf holds *size bytes of compressed data
+ *			FAIL - compression failed, payload should be sent as it is
+ *
+ ******************************************************************************/
+
+static int influxdb_gzip(influxdb_conn_t *conn, const char *data, size_t len, size_t *size)
+{
+	int rc;
+
+	if (NULL == gzip_stream){
+		gzip_stream = (z_stream *)zbx_malloc(NULL, sizeof(z_stream));
+		memset(gzip_stream, 0, sizeof(z_stream));
+
+		// 15 + 16 - largest window, with gzip header and trailer
+		if (Z_OK != (rc = deflateInit2(gzip_stream, CONFIG_INFLUXDB_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+				Z_DEFAULT_STRATEGY))){
+			zabbix_log(LOG_LEVEL_ERR, "[%s] cannot initialise gzip compression: %d", MODULE_NAME, rc);
+			zbx_free(gzip_stream);
+			return FAIL;
+		}
+	}
+	else
+		deflateReset(gzip_stream);
+
+	if (conn->gzip_alloc < deflateBound(gzip_stream, len)){
+		conn->gzip_alloc = deflateBound(gzip_stream, len);
+		conn->gzip_buf = (unsigned char *)zbx_realloc(conn->gzip_buf, conn->gzip_alloc);
+	}
+
+	gzip_stream->next_in = (unsigned char *)data;
+	gzip_stream->avail_in = len;
+	gzip_stream->next_out = conn->gzip_buf;
+	gzip_stream->avail_out = conn->gzip_alloc;
+
+	if (Z_STREAM_END != (rc = deflate(gzip_stream, Z_FINISH))){
+		zabbix_log(LOG_LEVEL_ERR, "[%s] gzip compression failed: %d", MODULE_NAME, rc);
+		return FAIL;
+	}
+
+	*size = gzip_stream->total_out;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_set_body
+ *
+ *	Purpose: Sets a chunk to be posted, compressed if configured so
+ *
+ ******************************************************************************/
+
+static void influxdb_set_body(influxdb_conn_t *conn, const char *data, size_t len)
+{
+	size_t size;
+
+	if (0 != CONFIG_INFLUXDB_GZIP_LEVEL && len >= (size_t)CONFIG_INFLUXDB_GZIP_MIN_SIZE &&
+			SUCCEED == influxdb_gzip(conn, data, len, &size)){
+		zabbix_log(MODULE_LOG_LEVEL, "[%s]     compressed %zu bytes to %zu", MODULE_NAME, len, size);
+		curl_easy_setopt(conn->easy, CURLOPT_HTTPHEADER, gzip_headers);
+		curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, conn->gzip_buf);
+		curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE, (long)size);
+		conn->body_size = size;
+		return;
+	}
+
+	curl_easy_setopt(conn->easy, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDS, data);
+	curl_easy_setopt(conn->easy, CURLOPT_POSTFIELDSIZE, (long)len);
+	conn->body_size = len;
+}
+
+/******************************************************************************
+ *
+ *	Function: breaker_allow
+ *
+ *	Purpose: Checks whether the circuit breaker of a node lets a write through
+ *
+ ******************************************************************************/
+
+static int breaker_allow(influxdb_endpoint_t *endpoint)
+{
+	int ret = SUCCEED;
+
+	if (0 == CONFIG_INFLUXDB_BREAKER_THRESHOLD)
+		return SUCCEED;
+
+	pthread_mutex_lock(&breaker_lock);
+
+	if (endpoint->breaker_failures >= CONFIG_INFLUXDB_BREAKER_THRESHOLD){
+		// open, once the timeout passes a single probe is let through
+		if (time(NULL) < endpoint->breaker_open_until || 0 != endpoint->breaker_probing)
+			ret = FAIL;
+		else
+			endpoint->breaker_probing = 1;
+	}
+
+	pthread_mutex_unlock(&breaker_lock);
+
+	return ret;
+}
+
+static void breaker_report(influxdb_endpoint_t *endpoint, int result)
+{
+	if (0 == CONFIG_INFLUXDB_BREAKER_THRESHOLD)
+		return;
+
+	pthread_mutex_lock(&breaker_lock);
+
+	if (SUCCEED == result){
+		if (endpoint->breaker_failures >= CONFIG_INFLUXDB_BREAKER_THRESHOLD)
+			zabbix_log(LOG_LEVEL_WARNING, "[%s] InfluxDB %s is available again", MODULE_NAME, endpoint->name);
+
+		endpoint->breaker_failures = 0;
+	}
+	else if (++endpoint->breaker_failures >= CONFIG_INFLUXDB_BREAKER_THRESHOLD){
+		if (endpoint->breaker_failures == CONFIG_INFLUXDB_BREAKER_THRESHOLD || 0 != endpoint->breaker_probing){
+			zabbix_log(LOG_LEVEL_WARNING, "[%s] InfluxDB %s unavailable, not writing for %d seconds",
+					MODULE_NAME, endpoint->name, CONFIG_INFLUXDB_BREAKER_TIMEOUT);
+		}
+		endpoint->breaker_open_until = time(NULL) + CONFIG_INFLUXDB_BREAKER_TIMEOUT;
+	}
+
+	endpoint->breaker_probing = 0;
+	pthread_mutex_unlock(&breaker_lock);
+}
+
+/******************************************************************************
+ *
+ *	Function: backoff_delay
+ *
+ *	Purpose: Returns how long (in milliseconds) to wait before retry number
+ *				attempt, a random delay up to exponentially growing limit
+ *
+ ******************************************************************************/
+
+static long backoff_delay(int attempt)
+{
+	long limit = CONFIG_INFLUXDB_RETRY_DELAY;
+
+	if (0 == backoff_seed)
+		backoff_seed = (unsigned int)getpid() ^ (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)&backoff_seed;
+
+	while (0 < attempt-- && limit < CONFIG_INFLUXDB_TIMEOUT * 1000L)
+		limit *= 2;
+
+	limit = MIN(limit, CONFIG_INFLUXDB_TIMEOUT * 1000L);
+
+	// half fixed, half random so that syncers failing together don't retry together
+	return limit / 2 + (long)(rand_r(&backoff_seed) % (limit / 2 + 1));
+}
+
+static void influxdb_sleep_ms(long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+
+	while (0 != nanosleep(&ts, &ts) && EINTR == errno)
+		;
+}
+
+static zbx_uint64_t influxdb_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (zbx_uint64_t)ts.tv_sec * 1000 + (zbx_uint64_t)ts.tv_nsec / 1000000;
+}
+
+/******************************************************************************
+ *
+ *	Function: json_unescape_alloc
+ *
+ *	Purpose: Copies a JSON string fragment up to end, resolving escapes
+ *
+ ******************************************************************************/
+
+static char *json_unescape_alloc(const char *start, const char *end)
+{
+	char *str = NULL;
+	size_t str_alloc = 0, str_offset = 0;
+	const char *p;
+
+	zbx_strcpy_alloc(&str, &str_alloc, &str_offset, "");
+
+	for (p = start; p < end; p++){
+		if ('\\' != *p || p + 1 == end){
+			zbx_chrcpy_alloc(&str, &str_alloc, &str_offset, *p);
+			continue;
+		}
+
+		switch (*++p){
+			case 'n':
+				zbx_chrcpy_alloc(&str, &str_alloc, &str_offset, '\n');
+				break;
+			case 't':
+				zbx_chrcpy_alloc(&str, &str_alloc, &str_offset, '\t');
+				break;
+			default:
+				zbx_chrcpy_alloc(&str, &str_alloc, &str_offset, *p);
+		}
+	}
+
+	return str;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_remove_rejected
+ *
+ *	Purpose: Handles 400 response to a write, logs lines InfluxDB could not
+ *				parse and builds the payload without them
+ *
+ *	Parameters: response - body of the response
+ *				data, len - the chunk which was refused
+ *
+ *	Returns: Payload to send again or NULL if there is nothing to resend
+ *
+ *	Comment: InfluxDB 1.x writes the valid lines of a payload anyway and
+ *				responds with "partial write: ...", nothing is resent then
+ *
+ ******************************************************************************/
+
+static char *influxdb_remove_rejected(const char *response, const char *data, size_t len)
+{
+	const char *p, *start, *end, *line, *eol, *data_end = data + len;
+	char *rejected, *resend = NULL;
+	size_t resend_alloc = 0, resend_offset = 0, line_len;
+	zbx_vector_ptr_t rejected_lines;
+	int i, keep, removed = 0;
+
+	zabbix_log(LOG_LEVEL_WARNING, "[%s] InfluxDB refused lines: %s", MODULE_NAME, ZBX_NULL2EMPTY_STR(response));
+
+	if (NULL == response || NULL != strstr(response, "partial write"))
+		return NULL;
+
+	zbx_vector_ptr_create(&rejected_lines);
+
+	// unable to parse '<line>': <reason>
+	for (p = response; NULL != (start = strstr(p, "unable to parse '")); p = end){
+		start += ZBX_CONST_STRLEN("unable to parse '");
+
+		if (NULL == (end = strstr(start, "': ")))
+			break;
+
+		zbx_vector_ptr_append(&rejected_lines, json_unescape_alloc(start, end));
+	}
+
+	for (line = data; line < data_end; line = eol){
+		if (NULL == (eol = lp_line_end(line, data_end)))
+			eol = data_end;
+
+		line_len = (size_t)(eol - line);
+		keep = 1;
+
+		for (i = 0; i < rejected_lines.values_num; i++){
+			rejected = (char *)rejected_lines.values[i];
+
+			if (strlen(rejected) == line_len && 0 == strncmp(rejected, line, line_len)){
+				keep = 0;
+				break;
+			}
+		}
+
+		if (eol < data_end)
+			eol++;
+
+		if (0 != keep)
+			zbx_strncpy_alloc(&resend, &resend_alloc, &resend_offset, line, (size_t)(eol - line));
+		else
+			removed++;
+	}
+
+	zbx_vector_ptr_clear_ext(&rejected_lines, zbx_ptr_free);
+	zbx_vector_ptr_destroy(&rejected_lines);
+
+	// nothing identified or nothing left, resending would not help
+	if (0 == removed || NULL == resend){
+		zbx_free(resend);
+		return NULL;
+	}
+
+	return resend;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_split
+ *
+ *	Purpose: Splits the payload for a node into chunks at line boundaries
+ *				according to MaxLinesPerWrite and MaxBytesPerWrite
+ *
+ ******************************************************************************/
+
+static void influxdb_split(int endpoint, const char *data, size_t len)
+{
+	const char *p, *eol, *next, *end = data + len;
+	size_t chunk_len;
+	int lines;
+	influxdb_chunk_t *chunk;
+
+	while (0 < len){
+		chunk_len = 0;
+		lines = 0;
+
+		for (p = data; p < end; p = next){
+			if (0 != CONFIG_MAX_LINES_PER_WRITE && lines >= CONFIG_MAX_LINES_PER_WRITE)
+				break;
+
+			if (NULL == (eol = lp_line_end(p, end)))
+				next = end;
+			else
+				next = eol + 1;
+
+			if (0 != chunk_len && 0 != CONFIG_MAX_BYTES_PER_WRITE &&
+					chunk_len + (size_t)(next - p) > (size_t)CONFIG_MAX_BYTES_PER_WRITE)
+				break;
+
+			chunk_len += (size_t)(next - p);
+			lines++;
+		}
+
+		if (chunks_num == chunks_alloc){
+			chunks_alloc = (0 == chunks_alloc ? 16 : chunks_alloc * 2);
+			chunks = (influxdb_chunk_t *)zbx_realloc(chunks, sizeof(influxdb_chunk_t) * chunks_alloc);
+		}
+
+		chunk = &chunks[chunks_num++];
+		memset(chunk, 0, sizeof(influxdb_chunk_t));
+		chunk->endpoint = endpoint;
+		chunk->data = data;
+		chunk->len = chunk_len;
+		chunk->lines = lines;
+
+		data += chunk_len;
+		len -= chunk_len;
+	}
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_shard
+ *
+ *	Purpose: Picks the node of a line by its series key
+ *
+ ******************************************************************************/
+
+static int influxdb_shard(const char *line, const char *end)
+{
+	const char *p;
+	zbx_uint64_t key;
+	long long b = -1, j = 0;
+
+	// series key ends at the first space not escaped
+	for (p = line; p < end && ' ' != *p; p++){
+		if ('\\' == *p && p + 1 < end)
+			p++;
+	}
+
+	key = ZBX_DEFAULT_STRING_HASH_ALGO(line, (size_t)(p - line), ZBX_DEFAULT_HASH_SEED);
+
+	// jump consistent hash, adding a node at the end moves only 1/n of the series
+	while (j < endpoints_num){
+		b = j;
+		key = key * __UINT64_C(2862933555777941757) + 1;
+		j = (long long)((double)(b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+
+	return (int)b;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_shard_lines
+ *
+ *	Purpose: Distributes lines of a payload to nodes of a set, lines of other
+ *				nodes are left out
+ *
+ ******************************************************************************/
+
+static void influxdb_shard_lines(const char *data, size_t len, unsigned int set)
+{
+	const char *line, *eol, *end = data + len;
+	int i;
+
+	for (i = 0; i < endpoints_num; i++)
+		line_buffer_reset(&shard_lines[i]);
+
+	for (line = data; line < end; line = eol){
+		if (NULL == (eol = lp_line_end(line, end)))
+			eol = end;
+		else
+			eol++;
+
+		if (0 != (set & (1U << (i = influxdb_shard(line, eol)))))
+			line_buffer_append(&shard_lines[i], line, (size_t)(eol - line));
+	}
+}
+
+/* counts the lines of a chunk, the last one may lack a newline */
+static int influxdb_count_lines(const char *data, size_t len)
+{
+	const char *p = data, *end = data + len;
+	int lines = 0;
+
+	while (p < end){
+		lines++;
+
+		if (NULL == (p = lp_line_end(p, end)))
+			break;
+
+		p++;
+	}
+
+	return lines;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_chunk_next
+ *
+ *	Purpose: Finds a chunk ready to be sent
+ *
+ *	Parameters: endpoint - node to send to, -1 for any
+ *				failed - nodes not to send to anymore
+ *				now - current time (ms)
+ *				wait - [OUT] how long until the next chunk waiting for
+ *					retry is ready, left as is if there is none
+ *
+ *	Returns: chunk to send, NULL if none is ready now
+ *
+ ******************************************************************************/
+
+static influxdb_chunk_t *influxdb_chunk_next(int endpoint, unsigned int failed, zbx_uint64_t now,
+		zbx_uint64_t *wait)
+{
+	int i;
+
+	for (i = 0; i < chunks_num; i++){
+		if (CHUNK_PENDING != chunks[i].state || 0 != (failed & (1U << chunks[i].endpoint)))
+			continue;
+
+		if (-1 != endpoint && chunks[i].endpoint != endpoint)
+			continue;
+
+		if (chunks[i].retry_at <= now)
+			return &chunks[i];
+
+		*wait = MIN(*wait, chunks[i].retry_at - now);
+	}
+
+	return NULL;
+}
+
+static void influxdb_chunk_start(influxdb_conn_t *conn, influxdb_chunk_t *chunk)
+{
+	conn->chunk = chunk;
+	conn->response_offset = 0;
+	conn->retry_after = 0;
+
+	if (NULL != conn->response)
+		*conn->response = '\0';
+
+	chunk->state = CHUNK_SENDING;
+	influxdb_set_body(conn, chunk->data, chunk->len);
+	curl_multi_add_handle(multi, conn->easy);
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_chunk_done
+ *
+ *	Purpose: Decides what happens to a chunk once its request is over
+ *
+ *	Returns: SUCCEED - chunk was written or is going to be retried
+ *			FAIL - chunk could not be written
+ *
+ ******************************************************************************/
+
+static int influxdb_chunk_done(influxdb_conn_t *conn, CURLcode res, zbx_uint64_t now)
+{
+	influxdb_chunk_t *chunk = conn->chunk;
+	long http_code = 0, delay;
+
+	conn->chunk = NULL;
+
+	if(res != CURLE_OK){
+		module_stats_add(MODULE_STATS_HTTP_ERRORS, 1);
+		zabbix_log(LOG_LEVEL_ERR, "[%s] curl request to %s failed: %s", MODULE_NAME, endpoints[conn->endpoint].name,
+				curl_easy_strerror(res));
+
+		// the whole timeout was used up already
+		if (CURLE_OPERATION_TIMEDOUT == res)
+			goto fail;
+	}
+	else {
+		curl_easy_getinfo(conn->easy, CURLINFO_RESPONSE_CODE, &http_code);
+		module_stats_add(MODULE_STATS_BYTES, conn->body_size);
+
+		if (200 <= http_code && 300 > http_code){
+			module_stats_add(MODULE_STATS_HTTP_2XX, 1);
+			module_stats_add(MODULE_STATS_LINES, chunk->lines);
+			chunk->state = CHUNK_DONE;
+			return SUCCEED;
+		}
+
+		module_stats_add(500 <= http_code ? MODULE_STATS_HTTP_5XX : MODULE_STATS_HTTP_4XX, 1);
+
+		if (400 == http_code){
+			// InfluxDB is fine, the data is not, so it is neither retried nor spooled
+			chunk->state = CHUNK_DONE;
+
+			if (NULL == chunk->resend && NULL != (chunk->resend = influxdb_remove_rejected(conn->response,
+					chunk->data, chunk->len))){
+				chunk->data = chunk->resend;
+				chunk->len = strlen(chunk->resend);
+				chunk->lines = influxdb_count_lines(chunk->data, chunk->len);
+				chunk->state = CHUNK_PENDING;
+				chunk->retry_at = 0;
+			}
+
+			return SUCCEED;
+		}
+
+		zabbix_log(LOG_LEVEL_ERR, "[%s] InfluxDB %s responded %ld: %s", MODULE_NAME, endpoints[conn->endpoint].name,
+				http_code, ZBX_NULL2EMPTY_STR(conn->response));
+
+		if (429 != http_code && 500 > http_code)
+			goto fail;
+	}
+
+	if (chunk->attempt >= CONFIG_INFLUXDB_MAX_RETRIES)
+		goto fail;
+
+	delay = (0 < conn->retry_after ? conn->retry_after * 1000 : backoff_delay(chunk->attempt));
+
+	// waiting longer than a write may take is left to the spool
+	if (delay > CONFIG_INFLUXDB_TIMEOUT * 1000L)
+		goto fail;
+
+	zabbix_log(MODULE_LOG_LEVEL, "[%s]     retrying write of %zu bytes in %ldms", MODULE_NAME, chunk->len, delay);
+	module_stats_add(MODULE_STATS_RETRIES, 1);
+	chunk->attempt++;
+	chunk->retry_at = now + (zbx_uint64_t)delay;
+	chunk->state = CHUNK_PENDING;
+
+	return SUCCEED;
+fail:
+	chunk->state = CHUNK_FAILED;
+
+	return FAIL;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_udp_send
+ *
+ *	Purpose: Sends the lines of a node in datagrams of whole lines, each of at
+ *				most InfluxDBUDPPayloadSize bytes unless a line alone is longer
+ *
+ *	Returns: number of lines in datagrams that were dropped
+ *
+ ******************************************************************************/
+
+static int influxdb_udp_send(int endpoint, const char *data, size_t len)
+{
+	const char *p, *eol, *next, *end = data + len;
+	size_t datagram_len;
+	int lines, dropped = 0, err = 0;
+
+	while (data < end){
+		datagram_len = 0;
+		lines = 0;
+
+		for (p = data; p < end; p = next){
+			if (NULL == (eol = lp_line_end(p, end)))
+				next = end;
+			else
+				next = eol + 1;
+
+			if (0 != datagram_len && datagram_len + (size_t)(next - p) > (size_t)CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE)
+				break;
+
+			datagram_len += (size_t)(next - p);
+			lines++;
+		}
+
+		if (-1 != udp_fds[endpoint] && -1 != send(udp_fds[endpoint], data, datagram_len, MSG_DONTWAIT)){
+			module_stats_add(MODULE_STATS_LINES, lines);
+			module_stats_add(MODULE_STATS_BYTES, datagram_len);
+		}
+		else {
+			err = (-1 != udp_fds[endpoint] ? errno : EBADF);
+			dropped += lines;
+		}
+
+		data += datagram_len;
+	}
+
+	if (0 != dropped){
+		zabbix_log(MODULE_LOG_LEVEL, "[%s]     %d lines not sent to InfluxDB %s: %s", MODULE_NAME, dropped,
+				endpoints[endpoint].name, zbx_strerror(err));
+	}
+
+	return dropped;
+}
+
+/******************************************************************************
+ *
+ *	Function: influxdb_udp_write
+ *
+ *	Purpose: Sends a payload to the UDP listeners of a set of nodes
+ *
+ ******************************************************************************/
+
+static void influxdb_udp_write(const char *data, size_t len, unsigned int set)
+{
+	int i, dropped = 0;
+
+	influxdb_udp_pool();
+
+	if (NULL != shard_lines)
+		influxdb_shard_lines(data, len, set);
+
+	for (i = 0; i < endpoints_num; i++){
+		if (0 == (set & (1U << i)))
+			continue;
+
+		if (NULL != shard_lines)
+			dropped += influxdb_udp_send(i, shard_lines[i].data, shard_lines[i].offset);
+		else
+			dropped += influxdb_udp_send(i, data, len);
+	}
+
+	module_stats_add(MODULE_STATS_UDP_DROPPED, dropped);
+}
+
+/******************************************************************************
+ *
+ *	Function: write_to_influxdb
+ *
+ *	Purpose: Writes a pre-formatted string to the InfluxDB nodes over the
+ *				connections kept open by this thread
+ *
+ *	Parameters: influxdb_data_entry - line protocol payload
+ *				endpoints - [IN] nodes to write to (replicate) or nodes
+ *					whose lines to write (shard)
+ *					[OUT] nodes the payload was not written to
+ *
+ *	Returns: SUCCEED - data was handed over to InfluxDB (or sent over UDP)
+ *			FAIL - data was not written to some nodes, it may be retried
+ *				later for those
+ *
+ ******************************************************************************/
+
+int write_to_influxdb(const char *influxdb_data_entry, unsigned int *endpoints_set) {
+	influxdb_conn_t *conn;
+	influxdb_chunk_t *chunk;
+	CURLMsg *msg;
+	zbx_uint64_t now, wait, start = module_stats_clock_us();
+	unsigned int set = *endpoints_set & influxdb_endpoints_all(), tried = 0, failed = 0;
+	int i, running = 0, still_running, msgs_left;
+	size_t len = strlen(influxdb_data_entry);
+
+	// fire and forget, there is nothing to retry
+	if (INFLUXDB_TRANSPORT_UDP == CONFIG_INFLUXDB_TRANSPORT){
+		influxdb_udp_write(influxdb_data_entry, len, set);
+		*endpoints_set = 0;
+		module_stats_add(MODULE_STATS_WRITES, 1);
+		module_stats_latency(MODULE_STATS_WRITE_LATENCY, module_stats_clock_us() - start);
+
+		return SUCCEED;
+	}
+
+	if (SUCCEED != influxdb_pool())
+		return FAIL;
+
+	if (NULL != shard_lines)
+		influxdb_shard_lines(influxdb_data_entry, len, set);
+
+	chunks_num = 0;
+
+	for (i = 0; i < endpoints_num; i++){
+		if (0 == (set & (1U << i)))
+			continue;
+
+		// no lines of the batch belong to this node
+		if (NULL != shard_lines && 0 == shard_lines[i].offset)
+			continue;
+
+		if (SUCCEED != breaker_allow(&endpoints[i])){
+			zabbix_log(MODULE_LOG_LEVEL, "[%s]     InfluxDB %s unavailable, skipped write_to_influxdb", MODULE_NAME,
+					endpoints[i].name);
+			failed |= 1U << i;
+			continue;
+		}
+
+		tried |= 1U << i;
+
+		if (NULL != shard_lines)
+			influxdb_split(i, shard_lines[i].data, shard_lines[i].offset);
+		else
+			influxdb_split(i, influxdb_data_entry, len);
+	}
+
+	if (1 < chunks_num)
+		zabbix_log(MODULE_LOG_LEVEL, "[%s]     writing in %d chunks", MODULE_NAME, chunks_num);
+
+	for (;;){
+		now = influxdb_time_ms();
+		wait = 1000;
+
+		// a node failed the batch already is not written anymore, only its requests in flight are finished
+		for (i = 0; i < conns_num; i++){
+			if (NULL != conns[i].chunk || 0 != (failed & (1U << conns[i].endpoint)))
+				continue;
+
+			if (NULL == (chunk = influxdb_chunk_next(conns[i].endpoint, failed, now, &wait)))
+				continue;
+
+			influxdb_chunk_start(&conns[i], chunk);
+			running++;
+		}
+
+		if (0 == running){
+			// nothing in flight, either finished or only waiting for retries
+			if (NULL == influxdb_chunk_next(-1, failed, ZBX_MAX_UINT64, &wait))
+				break;
+
+			influxdb_sleep_ms((long)wait);
+			continue;
+		}
+
+		curl_multi_perform(multi, &still_running);
+
+		while (NULL != (msg = curl_multi_info_read(multi, &msgs_left))){
+			if (CURLMSG_DONE != msg->msg)
+				continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&conn);
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			running--;
+
+			if (SUCCEED != influxdb_chunk_done(conn, msg->data.result, now))
+				failed |= 1U << conn->endpoint;
+		}
+
+		if (0 != still_running)
+			curl_multi_wait(multi, NULL, 0, (int)wait, NULL);
+	}
+
+	for (i = 0; i < chunks_num; i++)
+		zbx_free(chunks[i].resend);
+
+	for (i = 0; i < endpoints_num; i++){
+		if (0 != (tried & (1U << i)))
+			breaker_report(&endpoints[i], 0 != (failed & (1U << i)) ? FAIL : SUCCEED);
+	}
+
+	*endpoints_set = failed;
+	module_stats_add(MODULE_STATS_WRITES, 1);
+	module_stats_latency(MODULE_STATS_WRITE_LATENCY, module_stats_clock_us() - start);
+
+	if (0 != failed){
+		module_stats_add(MODULE_STATS_WRITE_FAILURES, 1);
+		return FAIL;
+	}
+
+	zabbix_log(MODULE_LOG_LEVEL, "[%s]     completed write_to_influxdb", MODULE_NAME);
+
+	return SUCCEED;
+}
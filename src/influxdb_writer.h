@@ -0,0 +1,30 @@
+#ifndef __ZABBIX_INFLUXDB_WRITER_H
+#define __ZABBIX_INFLUXDB_WRITER_H
+
+
+#include "common.h"
+
+/* sets of InfluxDB nodes are passed around as bit masks */
+#define INFLUXDB_ENDPOINTS_MAX 32
+
+#define INFLUXDB_FANOUT_REPLICATE 1
+#define INFLUXDB_FANOUT_SHARD     2
+
+#define INFLUXDB_TRANSPORT_TCP  1
+#define INFLUXDB_TRANSPORT_UNIX 2
+#define INFLUXDB_TRANSPORT_UDP  3
+
+/* largest payload of a UDP datagram over IPv4 */
+#define INFLUXDB_UDP_PAYLOAD_MAX 65507
+
+extern int influxdb_writer_init(void);
+extern void influxdb_writer_uninit(void);
+extern void influxdb_writer_close(void);
+
+extern unsigned int influxdb_endpoints_all(void);
+extern char *influxdb_endpoints_names(unsigned int set);
+
+extern int write_to_influxdb(const char *influxdb_data_entry, unsigned int *endpoints_set);
+
+
+#endif /* __ZABBIX_INFLUXDB_WRITER_H */
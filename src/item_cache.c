@@ -0,0 +1,478 @@
+// in-process cache of itemid -> series key (escaped measurement and tags)
+// 1] entries are kept in a zbx_hashset keyed by itemid
+// 2] a doubly linked list orders entries from most to least recently used,
+//    the tail is evicted when ItemCacheSize is reached
+// 3] entries older than ItemCacheTTL seconds are treated as a miss, so item
+//    renames and host/group changes are picked up eventually
+//
+// The cache lives in each history syncer process separately, no locking needed.
+// With ItemCacheShared=1 the cache in shared memory (item_cache_shm.c) is used
+// instead, sized by ItemCacheSize and ItemCacheSharedSize.
+//
+// Series keys are copied out of the cache into the batch, so an entry evicted
+// (or a shared cache emptied by another syncer) while the batch is built does
+// no harm.
+//
+// With ItemCacheSnapshot (only with ItemCacheShared=1, a per process cache of the
+// process that created it never gets more than the startup items) the cache is
+// saved to a file by that process when the module is unloaded, and loaded from
+// it at startup. Keys from a snapshot older than ItemCacheTTL are used for a
+// random part of the TTL, so they are read from the database again spread over
+// that time rather than all in the first sync cycles. The snapshot holds a hash
+// of the settings the keys depend on and is ignored once they change, and the
+// rules of deadband.c each item matched, which are passed on again on load.
+
+#include "load_config.h"
+#include "item_cache.h"
+#include "item_cache_shm.h"
+#include "item_meta.h"
+#include "deadband.h"
+#include "zbxalgo.h"
+
+typedef struct item_cache_entry
+{
+	zbx_uint64_t		itemid;
+	char			*series;
+	size_t			len;
+	time_t			lastupdate;
+	struct item_cache_entry	*prev;
+	struct item_cache_entry	*next;
+}
+item_cache_entry_t;
+
+static zbx_hashset_t		item_cache;
+static int			item_cache_enabled = 0;
+static int			item_cache_shared = 0;
+static pid_t			item_cache_pid = 0;
+static item_cache_entry_t	*lru_head = NULL;
+static item_cache_entry_t	*lru_tail = NULL;
+
+static zbx_uint64_t	cache_hits = 0;
+static zbx_uint64_t	cache_misses = 0;
+
+
+static void	lru_unlink(item_cache_entry_t *entry)
+{
+	if (NULL != entry->prev)
+		entry->prev->next = entry->next;
+	else
+		lru_head = entry->next;
+
+	if (NULL != entry->next)
+		entry->next->prev = entry->prev;
+	else
+		lru_tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+static void	lru_push_head(item_cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = lru_head;
+
+	if (NULL != lru_head)
+		lru_head->prev = entry;
+	else
+		lru_tail = entry;
+
+	lru_head = entry;
+}
+
+static void	item_cache_remove(item_cache_entry_t *entry)
+{
+	lru_unlink(entry);
+	zbx_free(entry->series);
+	zbx_hashset_remove(&item_cache, entry);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_init                                                  *
+ *                                                                            *
+ * Purpose: creates the cache according to ItemCacheSize, a size of 0         *
+ *          disables caching and every lookup goes to the database            *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the shared cache cannot be created        *
+ *                                                                            *
+ * Comment: must be called before any process is forked                       *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_init(void)
+{
+	if (0 >= CONFIG_ITEM_CACHE_SIZE)
+		return SUCCEED;
+
+	item_cache_pid = getpid();
+
+	if (0 != CONFIG_ITEM_CACHE_SHARED)
+	{
+		if (SUCCEED != item_cache_shm_create(CONFIG_ITEM_CACHE_SIZE, CONFIG_ITEM_CACHE_SHARED_SIZE))
+			return FAIL;
+
+		item_cache_enabled = 1;
+		item_cache_shared = 1;
+		return SUCCEED;
+	}
+
+	zbx_hashset_create(&item_cache, MIN(CONFIG_ITEM_CACHE_SIZE, 1000), ZBX_DEFAULT_UINT64_HASH_FUNC,
+			ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+	item_cache_enabled = 1;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_destroy                                               *
+ *                                                                            *
+ ******************************************************************************/
+void	item_cache_destroy(void)
+{
+	if (0 == item_cache_enabled)
+		return;
+
+	item_cache_enabled = 0;
+
+	if (0 != item_cache_shared)
+	{
+		item_cache_shm_destroy();
+		item_cache_shared = 0;
+		return;
+	}
+
+	while (NULL != lru_head)
+		item_cache_remove(lru_head);
+
+	zbx_hashset_destroy(&item_cache);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_get                                                   *
+ *                                                                            *
+ * Purpose: looks up the series key of an item and appends it to buf         *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if not cached (or expired)                   *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_get(zbx_uint64_t itemid, line_buffer_t *buf)
+{
+	item_cache_entry_t	*entry;
+
+	if (0 == item_cache_enabled)
+		return FAIL;
+
+	if (0 != item_cache_shared)
+	{
+		if (SUCCEED != item_cache_shm_get(itemid, CONFIG_ITEM_CACHE_TTL, buf))
+		{
+			cache_misses++;
+			return FAIL;
+		}
+
+		cache_hits++;
+		return SUCCEED;
+	}
+
+	if (NULL == (entry = (item_cache_entry_t *)zbx_hashset_search(&item_cache, &itemid)))
+	{
+		cache_misses++;
+		return FAIL;
+	}
+
+	if (0 < CONFIG_ITEM_CACHE_TTL && time(NULL) - entry->lastupdate >= CONFIG_ITEM_CACHE_TTL)
+	{
+		item_cache_remove(entry);
+		cache_misses++;
+		return FAIL;
+	}
+
+	if (entry != lru_head)
+	{
+		lru_unlink(entry);
+		lru_push_head(entry);
+	}
+
+	cache_hits++;
+	line_buffer_append(buf, entry->series, entry->len);
+
+	return SUCCEED;
+}
+
+static void	item_cache_put_at(zbx_uint64_t itemid, const char *series, size_t len, time_t lastupdate)
+{
+	item_cache_entry_t	*entry, entry_local;
+
+	if (0 != item_cache_shared)
+	{
+		item_cache_shm_put(itemid, series, len, (int)lastupdate);
+		return;
+	}
+
+	if (NULL != (entry = (item_cache_entry_t *)zbx_hashset_search(&item_cache, &itemid)))
+	{
+		entry->series = (char *)zbx_realloc(entry->series, len + 1);
+		memcpy(entry->series, series, len);
+		entry->series[len] = '\0';
+		entry->len = len;
+		entry->lastupdate = lastupdate;
+		lru_unlink(entry);
+		lru_push_head(entry);
+		return;
+	}
+
+	if (item_cache.num_data >= CONFIG_ITEM_CACHE_SIZE)
+		item_cache_remove(lru_tail);
+
+	memset(&entry_local, 0, sizeof(entry_local));
+	entry_local.itemid = itemid;
+
+	entry = (item_cache_entry_t *)zbx_hashset_insert(&item_cache, &entry_local, sizeof(entry_local));
+	entry->series = (char *)zbx_malloc(NULL, len + 1);
+	memcpy(entry->series, series, len);
+	entry->series[len] = '\0';
+	entry->len = len;
+	entry->lastupdate = lastupdate;
+	lru_push_head(entry);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_put                                                   *
+ *                                                                            *
+ * Purpose: stores (or refreshes) the series key of an item, evicting the     *
+ *          least recently used entry when the cache is full                  *
+ *                                                                            *
+ ******************************************************************************/
+void	item_cache_put(zbx_uint64_t itemid, const char *series, size_t len)
+{
+	if (0 == item_cache_enabled)
+		return;
+
+	item_cache_put_at(itemid, series, len, time(NULL));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_get_stats                                             *
+ *                                                                            *
+ * Purpose: returns hit/miss counters of this process since its start and     *
+ *          current number of cached items                                    *
+ *                                                                            *
+ ******************************************************************************/
+void	item_cache_get_stats(zbx_uint64_t *hits, zbx_uint64_t *misses, int *entries)
+{
+	*hits = cache_hits;
+	*misses = cache_misses;
+	if (0 == item_cache_enabled)
+		*entries = 0;
+	else if (0 != item_cache_shared)
+		*entries = item_cache_shm_entries();
+	else
+		*entries = item_cache.num_data;
+}
+
+/* snapshot file layout: magic, settings hash (8 bytes), then itemid (8 bytes), deadband rules matched (8), */
+/* lastupdate (4), length (4) and key of each item, keys of one InfluxDBSchema are of no use with the other */
+#define ITEM_CACHE_SNAPSHOT_MAGIC	"ZBXINFC3"
+#define ITEM_CACHE_SNAPSHOT_MAGIC_HOST	"ZBXINFH3"
+
+static const char	*item_cache_snapshot_magic(void)
+{
+	return ITEM_META_SCHEMA_HOST == CONFIG_INFLUXDB_SCHEMA ? ITEM_CACHE_SNAPSHOT_MAGIC_HOST :
+			ITEM_CACHE_SNAPSHOT_MAGIC;
+}
+
+static zbx_hash_t	item_cache_snapshot_hash_strarr(char **strings, zbx_hash_t seed)
+{
+	int	num = 0;
+
+	for (; NULL != strings && NULL != *strings; strings++, num++)
+		seed = ZBX_DEFAULT_STRING_HASH_ALGO(*strings, strlen(*strings) + 1, seed);
+
+	return ZBX_DEFAULT_HASH_ALGO(&num, sizeof(num), seed);
+}
+
+/* hash of the settings cached keys depend on, items filtered out are cached with empty keys, */
+/* DeadbandRule patterns take rule numbers of item_filter.c too */
+static zbx_uint64_t	item_cache_snapshot_settings(void)
+{
+	zbx_hash_t	hash;
+
+	hash = ZBX_DEFAULT_STRING_HASH_ALGO(CONFIG_HOST_SCHEMA_MEASUREMENT, strlen(CONFIG_HOST_SCHEMA_MEASUREMENT) + 1,
+			ZBX_DEFAULT_HASH_SEED);
+	hash = item_cache_snapshot_hash_strarr(CONFIG_INCLUDE_ITEMS, hash);
+	hash = item_cache_snapshot_hash_strarr(CONFIG_EXCLUDE_ITEMS, hash);
+	hash = item_cache_snapshot_hash_strarr(CONFIG_DEADBAND_RULES, hash);
+
+	return (zbx_uint64_t)hash;
+}
+
+static int	item_cache_snapshot_record(FILE *f, zbx_uint64_t itemid, const char *series, size_t len, int lastupdate)
+{
+	unsigned int	record_len = (unsigned int)len;
+	zbx_uint64_t	match = deadband_match(itemid);
+
+	if (1 != fwrite(&itemid, sizeof(itemid), 1, f) || 1 != fwrite(&match, sizeof(match), 1, f) ||
+			1 != fwrite(&lastupdate, sizeof(lastupdate), 1, f) ||
+			1 != fwrite(&record_len, sizeof(record_len), 1, f) || len != fwrite(series, 1, len, f))
+	{
+		return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+static int	item_cache_snapshot_shm_cb(zbx_uint64_t itemid, const char *series, size_t len, int lastupdate, void *arg)
+{
+	return item_cache_snapshot_record((FILE *)arg, itemid, series, len, lastupdate);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_snapshot_save                                         *
+ *                                                                            *
+ * Purpose: writes all cached items to a file, least recently used first      *
+ *                                                                            *
+ * Comment: only the process that created the cache writes it, other          *
+ *          processes have (at most) a part of it                             *
+ *                                                                            *
+ ******************************************************************************/
+void	item_cache_snapshot_save(const char *path)
+{
+	FILE			*f;
+	char			*tmp;
+	item_cache_entry_t	*entry;
+	int			ret = SUCCEED, entries;
+	zbx_uint64_t		hits, misses, settings;
+
+	if (0 == item_cache_enabled || item_cache_pid != getpid())
+		return;
+
+	tmp = zbx_dsprintf(NULL, "%s.tmp", path);
+
+	if (NULL == (f = fopen(tmp, "wb")))
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] cannot create item cache snapshot %s: %s", MODULE_NAME, tmp,
+				zbx_strerror(errno));
+		zbx_free(tmp);
+		return;
+	}
+
+	settings = item_cache_snapshot_settings();
+
+	if (1 != fwrite(item_cache_snapshot_magic(), ZBX_CONST_STRLEN(ITEM_CACHE_SNAPSHOT_MAGIC), 1, f) ||
+			1 != fwrite(&settings, sizeof(settings), 1, f))
+	{
+		ret = FAIL;
+	}
+	else if (0 != item_cache_shared)
+		ret = item_cache_shm_iterate(item_cache_snapshot_shm_cb, f);
+
+	for (entry = lru_tail; SUCCEED == ret && 0 == item_cache_shared && NULL != entry; entry = entry->prev)
+		ret = item_cache_snapshot_record(f, entry->itemid, entry->series, entry->len, (int)entry->lastupdate);
+
+	if (0 != fclose(f))
+		ret = FAIL;
+
+	if (SUCCEED != ret || 0 != rename(tmp, path))
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] cannot write item cache snapshot %s: %s", MODULE_NAME, path,
+				zbx_strerror(errno));
+		unlink(tmp);
+	}
+	else
+	{
+		item_cache_get_stats(&hits, &misses, &entries);
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] saved %d items to item cache snapshot %s", MODULE_NAME, entries,
+				path);
+	}
+
+	zbx_free(tmp);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_snapshot_load                                         *
+ *                                                                            *
+ * Purpose: fills the cache from a file written by item_cache_snapshot_save() *
+ *                                                                            *
+ * Return value: number of items loaded, FAIL if there is no usable snapshot  *
+ *               (none, of other settings or empty)                           *
+ *                                                                            *
+ * Comment: must be called before any process is forked, so all of them get   *
+ *          the loaded items                                                  *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_snapshot_load(const char *path)
+{
+	FILE		*f;
+	char		magic[ZBX_CONST_STRLEN(ITEM_CACHE_SNAPSHOT_MAGIC)], *series = NULL;
+	size_t		series_alloc = 0;
+	zbx_uint64_t	itemid, settings, match;
+	int		lastupdate, loaded = 0;
+	unsigned int	len;
+	time_t		now = time(NULL);
+
+	if (0 == item_cache_enabled)
+		return FAIL;
+
+	if (NULL == (f = fopen(path, "rb")))
+	{
+		if (ENOENT != errno)
+		{
+			zabbix_log(LOG_LEVEL_WARNING, "[%s] cannot open item cache snapshot %s: %s", MODULE_NAME, path,
+					zbx_strerror(errno));
+		}
+
+		return FAIL;
+	}
+
+	if (1 != fread(magic, sizeof(magic), 1, f) || 0 != memcmp(magic, item_cache_snapshot_magic(), sizeof(magic)))
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] %s is not an item cache snapshot of InfluxDBSchema=%s, ignoring it",
+				MODULE_NAME, path, PARSE_INFLUXDB_SCHEMA);
+		fclose(f);
+		return FAIL;
+	}
+
+	if (1 != fread(&settings, sizeof(settings), 1, f) || settings != item_cache_snapshot_settings())
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] item cache snapshot %s was saved with other IncludeItems,"
+				" ExcludeItems, DeadbandRule or HostSchemaMeasurement, ignoring it", MODULE_NAME, path);
+		fclose(f);
+		return FAIL;
+	}
+
+	while (loaded < CONFIG_ITEM_CACHE_SIZE && 1 == fread(&itemid, sizeof(itemid), 1, f) &&
+			1 == fread(&match, sizeof(match), 1, f) && 1 == fread(&lastupdate, sizeof(lastupdate), 1, f) && 1 == fread(&len, sizeof(len), 1, f))
+	{
+		/* a key is a few hundred bytes, anything much longer is a damaged file */
+		if (ZBX_MEBIBYTE < len)
+			break;
+
+		/* items filtered out have empty keys */
+		if (NULL == series || series_alloc < len)
+			series = (char *)zbx_realloc(series, series_alloc = MAX(len, 1));
+
+		if (len != fread(series, 1, len, f))
+			break;
+
+		if (0 < CONFIG_ITEM_CACHE_TTL && now - lastupdate >= CONFIG_ITEM_CACHE_TTL)
+			lastupdate = (int)(now - CONFIG_ITEM_CACHE_TTL + 1 + rand() % CONFIG_ITEM_CACHE_TTL);
+
+		item_cache_put_at(itemid, series, len, lastupdate);
+
+		if (0 != match)
+			deadband_classify(itemid, match);
+
+		loaded++;
+	}
+
+	zbx_free(series);
+	fclose(f);
+
+	/* an empty snapshot is no reason to skip ItemCachePrewarm */
+	return 0 != loaded ? loaded : FAIL;
+}
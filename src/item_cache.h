@@ -0,0 +1,20 @@
+#ifndef __ZABBIX_ITEM_CACHE_H
+#define __ZABBIX_ITEM_CACHE_H
+
+
+#include "common.h"
+#include "line_buffer.h"
+
+extern int item_cache_init(void);
+extern void item_cache_destroy(void);
+
+extern int item_cache_get(zbx_uint64_t itemid, line_buffer_t *buf);
+extern void item_cache_put(zbx_uint64_t itemid, const char *series, size_t len);
+
+extern void item_cache_get_stats(zbx_uint64_t *hits, zbx_uint64_t *misses, int *entries);
+
+extern void item_cache_snapshot_save(const char *path);
+extern int item_cache_snapshot_load(const char *path);
+
+
+#endif /* __ZABBIX_ITEM_CACHE_H */
@@ -0,0 +1,293 @@
+// item cache shared by all history syncer processes (ItemCacheShared=1)
+// 1] one anonymous shared mapping is created in zbx_module_init, before Zabbix
+//    forks the history syncers, so all of them see the same cache and an item
+//    is read from the database once for the whole server
+// 2] the mapping holds a fixed open addressing table of itemids (linear
+//    probing, at most half full) and an arena the series keys are appended to,
+//    its size never changes with the number of syncers
+// 3] writers take a process shared mutex, readers take no lock: a sequence
+//    counter is odd while a writer changes the table and a reader copies the
+//    key out and retries if the counter moved in the meantime (seqlock)
+// 4] there is no eviction, when the table or the arena is full the whole cache
+//    is emptied and filled again from the following batches
+//
+// Entries older than ItemCacheTTL are a miss, their new key is appended to the
+// arena and the slot is pointed at it.
+
+#include "load_config.h"
+#include "item_cache_shm.h"
+#include "zbxalgo.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+	zbx_uint64_t	itemid;		/* 0 - free slot */
+	zbx_uint64_t	offset;		/* series key in the arena */
+	unsigned int	len;
+	int		lastupdate;
+}
+item_cache_slot_t;
+
+typedef struct
+{
+	pthread_mutex_t	lock;
+	unsigned int	seq;
+	int		entries;
+	int		entries_max;
+	zbx_uint64_t	mask;
+	zbx_uint64_t	arena_size;
+	zbx_uint64_t	arena_used;
+}
+item_cache_shm_t;
+
+static item_cache_shm_t		*shm = NULL;
+static size_t			shm_size = 0;
+static item_cache_slot_t	*slots = NULL;
+static char			*arena = NULL;
+
+static void	seq_write_begin(void)
+{
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void	seq_write_end(void)
+{
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+static zbx_uint64_t	slot_index(zbx_uint64_t itemid)
+{
+	return ZBX_DEFAULT_UINT64_HASH_FUNC(&itemid) & shm->mask;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_shm_create                                            *
+ *                                                                            *
+ * Purpose: maps the shared cache, must be called before any process is       *
+ *          forked                                                            *
+ *                                                                            *
+ * Parameters: entries_max - number of items the table is sized for           *
+ *             size        - total size of the mapping in bytes               *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the mapping cannot be created or is too   *
+ *               small for the table                                          *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_shm_create(int entries_max, zbx_uint64_t size)
+{
+	pthread_mutexattr_t	attr;
+	zbx_uint64_t		capacity = 1, table_size;
+
+	while (capacity < (zbx_uint64_t)entries_max * 2)
+		capacity *= 2;
+
+	table_size = sizeof(item_cache_shm_t) + capacity * sizeof(item_cache_slot_t);
+
+	if (size < table_size + ZBX_MEBIBYTE)
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] ItemCacheSharedSize " ZBX_FS_UI64 " is too small for ItemCacheSize %d,"
+				" at least " ZBX_FS_UI64 " needed", MODULE_NAME, size, entries_max, table_size + ZBX_MEBIBYTE);
+		return FAIL;
+	}
+
+	if (MAP_FAILED == (shm = (item_cache_shm_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			-1, 0)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot map " ZBX_FS_UI64 " bytes of shared memory for item cache: %s",
+				MODULE_NAME, size, zbx_strerror(errno));
+		shm = NULL;
+		return FAIL;
+	}
+
+	shm_size = size;
+	slots = (item_cache_slot_t *)(shm + 1);
+	arena = (char *)(slots + capacity);
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&shm->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	shm->entries_max = entries_max;
+	shm->mask = capacity - 1;
+	shm->arena_size = size - table_size;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_shm_destroy                                           *
+ *                                                                            *
+ ******************************************************************************/
+void	item_cache_shm_destroy(void)
+{
+	if (NULL == shm)
+		return;
+
+	munmap(shm, shm_size);
+	shm = NULL;
+	slots = NULL;
+	arena = NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_shm_get                                               *
+ *                                                                            *
+ * Purpose: copies the series key of an item to the end of buf                *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if not cached (or older than ttl seconds)    *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_shm_get(zbx_uint64_t itemid, int ttl, line_buffer_t *buf)
+{
+	zbx_uint64_t	i, n, offset = 0;
+	unsigned int	seq, len = 0;
+	int		lastupdate = 0, found;
+	size_t		buf_offset = buf->offset;
+
+	for (;;)
+	{
+		if (0 != ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1))
+		{
+			sched_yield();
+			continue;
+		}
+
+		found = FAIL;
+
+		/* a table changing under the reader may have no free slot, the probe is bounded */
+		for (i = slot_index(itemid), n = 0; n <= shm->mask; i = (i + 1) & shm->mask, n++)
+		{
+			zbx_uint64_t	id = __atomic_load_n(&slots[i].itemid, __ATOMIC_RELAXED);
+
+			if (0 == id)
+				break;
+
+			if (id != itemid)
+				continue;
+
+			offset = __atomic_load_n(&slots[i].offset, __ATOMIC_RELAXED);
+			len = __atomic_load_n(&slots[i].len, __ATOMIC_RELAXED);
+			lastupdate = __atomic_load_n(&slots[i].lastupdate, __ATOMIC_RELAXED);
+
+			/* torn values are caught by the sequence check, but must not be followed */
+			if (offset + len <= shm->arena_size)
+			{
+				memcpy(line_buffer_reserve(buf, len), arena + offset, len);
+				found = SUCCEED;
+			}
+
+			break;
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	if (SUCCEED != found || (0 < ttl && time(NULL) - lastupdate >= ttl))
+	{
+		line_buffer_truncate(buf, buf_offset);
+		return FAIL;
+	}
+
+	line_buffer_commit(buf, len);
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_shm_put                                               *
+ *                                                                            *
+ * Purpose: stores (or refreshes) the series key of an item, emptying the     *
+ *          cache first when it is full                                       *
+ *                                                                            *
+ ******************************************************************************/
+void	item_cache_shm_put(zbx_uint64_t itemid, const char *series, size_t len, int lastupdate)
+{
+	zbx_uint64_t	i;
+
+	if (len > shm->arena_size)
+		return;
+
+	pthread_mutex_lock(&shm->lock);
+
+	if (shm->entries >= shm->entries_max || shm->arena_used + len > shm->arena_size)
+	{
+		zabbix_log(MODULE_LOG_LEVEL, "[%s] shared item cache full (%d items, " ZBX_FS_UI64 " bytes), emptying it",
+				MODULE_NAME, shm->entries, shm->arena_used);
+
+		seq_write_begin();
+		memset(slots, 0, (shm->mask + 1) * sizeof(item_cache_slot_t));
+		shm->entries = 0;
+		shm->arena_used = 0;
+		seq_write_end();
+	}
+
+	/* space past arena_used is not referred to by any slot, readers never look at it */
+	memcpy(arena + shm->arena_used, series, len);
+
+	for (i = slot_index(itemid); 0 != slots[i].itemid && itemid != slots[i].itemid; i = (i + 1) & shm->mask)
+		;
+
+	seq_write_begin();
+
+	if (0 == slots[i].itemid)
+		shm->entries++;
+
+	__atomic_store_n(&slots[i].offset, shm->arena_used, __ATOMIC_RELAXED);
+	__atomic_store_n(&slots[i].len, (unsigned int)len, __ATOMIC_RELAXED);
+	__atomic_store_n(&slots[i].lastupdate, lastupdate, __ATOMIC_RELAXED);
+	__atomic_store_n(&slots[i].itemid, itemid, __ATOMIC_RELAXED);
+	shm->arena_used += len;
+
+	seq_write_end();
+
+	pthread_mutex_unlock(&shm->lock);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_shm_iterate                                           *
+ *                                                                            *
+ * Purpose: calls cb for every cached item, writers wait meanwhile            *
+ *                                                                            *
+ * Return value: SUCCEED or the first result of cb other than SUCCEED         *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_shm_iterate(item_cache_shm_cb_t cb, void *arg)
+{
+	zbx_uint64_t	i;
+	int		ret = SUCCEED;
+
+	pthread_mutex_lock(&shm->lock);
+
+	for (i = 0; i <= shm->mask && SUCCEED == ret; i++)
+	{
+		if (0 != slots[i].itemid)
+			ret = cb(slots[i].itemid, arena + slots[i].offset, slots[i].len, slots[i].lastupdate, arg);
+	}
+
+	pthread_mutex_unlock(&shm->lock);
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_cache_shm_entries                                           *
+ *                                                                            *
+ ******************************************************************************/
+int	item_cache_shm_entries(void)
+{
+	return __atomic_load_n(&shm->entries, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,21 @@
+#ifndef __ZABBIX_ITEM_CACHE_SHM_H
+#define __ZABBIX_ITEM_CACHE_SHM_H
+
+
+#include "common.h"
+#include "line_buffer.h"
+
+/* receives a cached item, the key is only valid during the call */
+typedef int (*item_cache_shm_cb_t)(zbx_uint64_t itemid, const char *series, size_t len, int lastupdate, void *arg);
+
+extern int item_cache_shm_create(int entries_max, zbx_uint64_t size);
+extern void item_cache_shm_destroy(void);
+
+extern int item_cache_shm_get(zbx_uint64_t itemid, int ttl, line_buffer_t *buf);
+extern void item_cache_shm_put(zbx_uint64_t itemid, const char *series, size_t len, int lastupdate);
+extern int item_cache_shm_iterate(item_cache_shm_cb_t cb, void *arg);
+
+extern int item_cache_shm_entries(void);
+
+
+#endif /* __ZABBIX_ITEM_CACHE_SHM_H */
@@ -0,0 +1,270 @@
+// include/exclude rules deciding which items are exported
+// 1] a rule is <field>:<pattern>, field one of host_group, host, application or
+//    key, the pattern is a wildcard (* and ? only, so [ and ] of item keys need
+//    no escaping) or, prefixed with ~, a POSIX extended regular expression
+// 2] item_meta.c matches the rules against the unescaped names it reads and
+//    or-s the outcomes over the host groups, host, applications and key of an
+//    item, an item is exported if it matched an include rule (or there are none)
+//    and no exclude rule
+// 3] every rule is a bit of the outcome, so other options select items with
+//    rules of their own (item_filter_rule_add()), up to ITEM_FILTER_RULES_MAX
+//    rules in total
+// 4] the outcome is cached with the series key of the item, an item filtered
+//    out has an empty key, so its values cost a cache lookup and nothing else
+//
+// Rules are compiled by zbx_module_init() before the history syncers are forked
+// and only read afterwards.
+
+#include "load_config.h"
+#include "item_filter.h"
+
+#include <regex.h>
+
+typedef struct
+{
+	int	field;
+	char	*pattern;
+	regex_t	*regex;		/* NULL - wildcard */
+}
+item_filter_rule_t;
+
+static item_filter_rule_t	rules[ITEM_FILTER_RULES_MAX];
+static int			rules_num = 0;
+static zbx_uint64_t		include_rules = 0;
+static zbx_uint64_t		exclude_rules = 0;
+
+static const char	*fields[] = {"host_group", "host", "application", "key", NULL};
+
+/* matches a wildcard where * is any string and ? any character */
+static int	item_filter_wildcard(const char *pattern, const char *value)
+{
+	const char	*star = NULL, *retry = NULL;
+
+	while ('\0' != *value)
+	{
+		if ('*' == *pattern)
+		{
+			star = ++pattern;
+			retry = value;
+		}
+		else if ('?' == *pattern || *pattern == *value)
+		{
+			pattern++;
+			value++;
+		}
+		else if (NULL != star)
+		{
+			pattern = star;
+			value = ++retry;
+		}
+		else
+			return FAIL;
+	}
+
+	while ('*' == *pattern)
+		pattern++;
+
+	return '\0' == *pattern ? SUCCEED : FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_filter_rule_add                                             *
+ *                                                                            *
+ * Purpose: compiles a <field>:<pattern> rule                                 *
+ *                                                                            *
+ * Parameters: rule   - the rule                                              *
+ *             option - what the rule is, for the error message               *
+ *             error  - the error message of an invalid rule                  *
+ *                                                                            *
+ * Return value: bit number of the rule in item_filter_match() outcomes or    *
+ *               FAIL if the rule is invalid                                  *
+ *                                                                            *
+ ******************************************************************************/
+int	item_filter_rule_add(const char *rule, const char *option, char **error)
+{
+	item_filter_rule_t	*filter;
+	const char		*pattern;
+	char			buf[256];
+	int			field, rc;
+
+	if (ITEM_FILTER_RULES_MAX == rules_num)
+	{
+		*error = zbx_dsprintf(*error, "too many rules at %s \"%s\", at most %d IncludeItems, ExcludeItems and"
+				" DeadbandRule patterns can be used", option, rule, ITEM_FILTER_RULES_MAX);
+		return FAIL;
+	}
+
+	for (field = 0; NULL != fields[field]; field++)
+	{
+		size_t	len = strlen(fields[field]);
+
+		if (0 == strncmp(rule, fields[field], len) && ':' == rule[len])
+			break;
+	}
+
+	if (NULL == fields[field])
+	{
+		*error = zbx_dsprintf(*error, "invalid %s \"%s\": expected host_group, host, application or key"
+				" followed by ':' and a pattern", option, rule);
+		return FAIL;
+	}
+
+	pattern = rule + strlen(fields[field]) + 1;
+
+	filter = &rules[rules_num];
+	filter->field = field;
+	filter->regex = NULL;
+
+	if ('~' != *pattern)
+	{
+		filter->pattern = zbx_strdup(NULL, pattern);
+		return rules_num++;
+	}
+
+	filter->regex = (regex_t *)zbx_malloc(NULL, sizeof(regex_t));
+
+	if (0 != (rc = regcomp(filter->regex, pattern + 1, REG_EXTENDED | REG_NOSUB)))
+	{
+		regerror(rc, filter->regex, buf, sizeof(buf));
+		*error = zbx_dsprintf(*error, "invalid regular expression in %s \"%s\": %s", option, rule, buf);
+		zbx_free(filter->regex);
+		return FAIL;
+	}
+
+	filter->pattern = zbx_strdup(NULL, pattern + 1);
+
+	return rules_num++;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_filter_init                                                 *
+ *                                                                            *
+ * Purpose: compiles the IncludeItems and ExcludeItems rules                  *
+ *                                                                            *
+ * Parameters: include - NULL terminated list of include rules                *
+ *             exclude - NULL terminated list of exclude rules                *
+ *             error   - the error message of an invalid rule                 *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if a rule is invalid                         *
+ *                                                                            *
+ ******************************************************************************/
+int	item_filter_init(char **include, char **exclude, char **error)
+{
+	int	rule;
+
+	for (; NULL != include && NULL != *include; include++)
+	{
+		if (FAIL == (rule = item_filter_rule_add(*include, "IncludeItems rule", error)))
+			return FAIL;
+
+		include_rules |= __UINT64_C(1) << rule;
+	}
+
+	for (; NULL != exclude && NULL != *exclude; exclude++)
+	{
+		if (FAIL == (rule = item_filter_rule_add(*exclude, "ExcludeItems rule", error)))
+			return FAIL;
+
+		exclude_rules |= __UINT64_C(1) << rule;
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_filter_destroy                                              *
+ *                                                                            *
+ ******************************************************************************/
+void	item_filter_destroy(void)
+{
+	int	i;
+
+	for (i = 0; i < rules_num; i++)
+	{
+		if (NULL != rules[i].regex)
+		{
+			regfree(rules[i].regex);
+			zbx_free(rules[i].regex);
+		}
+
+		zbx_free(rules[i].pattern);
+	}
+
+	rules_num = 0;
+	include_rules = exclude_rules = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_filter_rules_num                                            *
+ *                                                                            *
+ * Return value: number of IncludeItems and ExcludeItems rules, 0 - every     *
+ *               item is exported                                             *
+ *                                                                            *
+ ******************************************************************************/
+int	item_filter_rules_num(void)
+{
+	zbx_uint64_t	rules_used = include_rules | exclude_rules;
+	int		num = 0;
+
+	for (; 0 != rules_used; rules_used &= rules_used - 1)
+		num++;
+
+	return num;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_filter_match                                                *
+ *                                                                            *
+ * Purpose: matches one host group, host, application or key of an item       *
+ *                                                                            *
+ * Parameters: field - ITEM_FILTER_HOST_GROUP, ITEM_FILTER_HOST,              *
+ *                     ITEM_FILTER_APPLICATION or ITEM_FILTER_KEY             *
+ *             value - unescaped name or key                                  *
+ *                                                                            *
+ * Return value: bits of the rules that matched                               *
+ *                                                                            *
+ ******************************************************************************/
+zbx_uint64_t	item_filter_match(int field, const char *value)
+{
+	zbx_uint64_t	match = 0;
+	int		i;
+
+	for (i = 0; i < rules_num; i++)
+	{
+		if (field != rules[i].field)
+			continue;
+
+		if (NULL == rules[i].regex ? SUCCEED == item_filter_wildcard(rules[i].pattern, value) :
+				0 == regexec(rules[i].regex, value, 0, NULL, 0))
+		{
+			match |= __UINT64_C(1) << i;
+		}
+	}
+
+	return match;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_filter_exported                                             *
+ *                                                                            *
+ * Purpose: decides on an item from what its metadata matched                 *
+ *                                                                            *
+ * Return value: SUCCEED if the item is exported, FAIL otherwise              *
+ *                                                                            *
+ ******************************************************************************/
+int	item_filter_exported(zbx_uint64_t match)
+{
+	if (0 != (match & exclude_rules))
+		return FAIL;
+
+	if (0 != include_rules && 0 == (match & include_rules))
+		return FAIL;
+
+	return SUCCEED;
+}
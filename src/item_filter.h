@@ -0,0 +1,25 @@
+#ifndef __ZABBIX_ITEM_FILTER_H
+#define __ZABBIX_ITEM_FILTER_H
+
+
+#include "common.h"
+
+/* item metadata the rules are matched against */
+#define ITEM_FILTER_HOST_GROUP	0
+#define ITEM_FILTER_HOST	1
+#define ITEM_FILTER_APPLICATION	2
+#define ITEM_FILTER_KEY		3
+
+/* rules are bits of the outcome of matching, which is or-ed over all metadata of an item */
+#define ITEM_FILTER_RULES_MAX	64
+
+extern int item_filter_init(char **include, char **exclude, char **error);
+extern int item_filter_rule_add(const char *rule, const char *option, char **error);
+extern void item_filter_destroy(void);
+
+extern int item_filter_rules_num(void);
+extern zbx_uint64_t item_filter_match(int field, const char *value);
+extern int item_filter_exported(zbx_uint64_t match);
+
+
+#endif /* __ZABBIX_ITEM_FILTER_H */
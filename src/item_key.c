@@ -0,0 +1,161 @@
+// item name expansion, done in the module instead of the database
+// 1] item key parameters are parsed the way Zabbix does it: unquoted, quoted
+//    ("a, b" with \" for a quote) or arrays ([a,"b,c"]) which are kept as
+//    written, so commas inside quotes and arrays no longer split a parameter
+// 2] $1..$9 in the item name are replaced by the parameter of the same number,
+//    a parameter the key does not have is replaced by nothing, names of keys
+//    without parameters (or with a key that does not parse) are left as they are
+// 3] the expanded name is escaped as a line protocol measurement on the way
+//    into the buffer, no intermediate copy is made
+
+#include "item_key.h"
+#include "lp_format.h"
+
+/* returns the closing quote of a quoted parameter starting at p */
+static const char	*item_key_quoted_end(const char *p)
+{
+	for (p++; '"' != *p; p++)
+	{
+		if ('\0' == *p)
+			return NULL;
+
+		if ('\\' == *p && '"' == p[1])
+			p++;
+	}
+
+	return p;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_key_params                                                  *
+ *                                                                            *
+ * Purpose: splits the parameters of an item key                              *
+ *                                                                            *
+ * Parameters: key        - item key, e.g. vfs.fs.size[/,pfree]               *
+ *             params     - first ITEM_KEY_PARAMS_MAX parameters              *
+ *             params_num - number of parameters, 0 for keys without []       *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the key is malformed                      *
+ *                                                                            *
+ ******************************************************************************/
+int	item_key_params(const char *key, item_key_param_t *params, int *params_num)
+{
+	const char	*p, *start;
+	size_t		len;
+	int		quoted;
+
+	*params_num = 0;
+
+	if (NULL == (p = strchr(key, '[')))
+		return SUCCEED;
+
+	for (p++;; p++)
+	{
+		while (' ' == *p)
+			p++;
+
+		start = p;
+		quoted = 0;
+
+		if ('"' == *p)
+		{
+			if (NULL == (p = item_key_quoted_end(p)))
+				return FAIL;
+
+			start++;
+			len = (size_t)(p++ - start);
+			quoted = 1;
+		}
+		else if ('[' == *p)
+		{
+			for (p++; ']' != *p; p++)
+			{
+				if ('\0' == *p)
+					return FAIL;
+
+				if ('"' == *p && NULL == (p = item_key_quoted_end(p)))
+					return FAIL;
+			}
+
+			len = (size_t)(++p - start);
+		}
+		else
+		{
+			while (',' != *p && ']' != *p && '\0' != *p)
+				p++;
+
+			len = (size_t)(p - start);
+		}
+
+		if (ITEM_KEY_PARAMS_MAX > *params_num)
+		{
+			params[*params_num].value = start;
+			params[*params_num].len = len;
+			params[*params_num].quoted = quoted;
+		}
+
+		(*params_num)++;
+
+		while (' ' == *p)
+			p++;
+
+		if (']' == *p && '\0' == p[1])
+			return SUCCEED;
+
+		if (',' != *p)
+			return FAIL;
+	}
+}
+
+static void	item_key_param_append(line_buffer_t *buf, const item_key_param_t *param)
+{
+	const char	*p, *start = param->value, *end = param->value + param->len;
+
+	if (0 != param->quoted)
+	{
+		for (p = start; p < end - 1; p++)
+		{
+			if ('\\' != *p || '"' != p[1])
+				continue;
+
+			lp_append_escaped(buf, start, (size_t)(p - start), LP_ESCAPE_MEASUREMENT);
+			start = ++p;
+		}
+	}
+
+	lp_append_escaped(buf, start, (size_t)(end - start), LP_ESCAPE_MEASUREMENT);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_name_expand                                                 *
+ *                                                                            *
+ * Purpose: appends the item name with $1..$9 replaced by key parameters,     *
+ *          escaped as line protocol measurement                              *
+ *                                                                            *
+ ******************************************************************************/
+void	item_name_expand(line_buffer_t *buf, const char *name, const char *key)
+{
+	item_key_param_t	params[ITEM_KEY_PARAMS_MAX];
+	int			params_num, n;
+	const char		*p, *start = name;
+
+	if (SUCCEED == item_key_params(key, params, &params_num) && 0 != params_num)
+	{
+		for (p = name; '\0' != *p; p++)
+		{
+			if ('$' != *p || '1' > p[1] || '9' < p[1])
+				continue;
+
+			lp_append_escaped(buf, start, (size_t)(p - start), LP_ESCAPE_MEASUREMENT);
+
+			if ((n = p[1] - '1') < params_num)
+				item_key_param_append(buf, &params[n]);
+
+			start = ++p + 1;
+		}
+	}
+
+	lp_append_escaped(buf, start, strlen(start), LP_ESCAPE_MEASUREMENT);
+}
@@ -0,0 +1,24 @@
+#ifndef __ZABBIX_ITEM_KEY_H
+#define __ZABBIX_ITEM_KEY_H
+
+
+#include "common.h"
+#include "line_buffer.h"
+
+/* item names can refer to $1..$9 only */
+#define ITEM_KEY_PARAMS_MAX 9
+
+/* parameter of an item key, points into the key */
+typedef struct
+{
+	const char	*value;
+	size_t		len;
+	int		quoted;
+}
+item_key_param_t;
+
+extern int item_key_params(const char *key, item_key_param_t *params, int *params_num);
+extern void item_name_expand(line_buffer_t *buf, const char *name, const char *key);
+
+
+#endif /* __ZABBIX_ITEM_KEY_H */
@@ -0,0 +1,396 @@
+// series keys (escaped measurement and tags) of items, read from the Zabbix database
+// 1] items, host groups and applications are read with three plain queries by
+//    primary or foreign key, $1..$9 expansion and escaping are done here (see
+//    item_key.c), the same SQL works with both database engines
+// 2] items of a batch are resolved ITEM_META_CHUNK at a time, host groups and
+//    applications are joined with '|' in name order, so the key of an item does
+//    not depend on the order the database returns rows in
+// 3] item_meta_prewarm() reads all monitored items with the same three queries,
+//    restricted by host and item status instead of ids, to fill the item cache
+//    at startup
+// 4] IncludeItems/ExcludeItems rules (see item_filter.c) are matched against the
+//    names as they are read, an item filtered out is passed on with an empty key
+// 5] with InfluxDBSchema=host the key is HostSchemaMeasurement with the host_name
+//    and host_groups tags, followed by a space and the item key as the field name
+//    (see coalesce.c), item names are not expanded and applications only go to
+//    the IncludeItems/ExcludeItems rules
+//
+// Items of hosts without host groups have no series key, the tag would be empty.
+
+#include "load_config.h"
+#include "item_meta.h"
+#include "item_key.h"
+#include "item_filter.h"
+#include "lp_format.h"
+#include "zbxalgo.h"
+#include "db.h"
+
+#define ITEM_META_CHUNK	1000
+
+/* monitored items of monitored hosts, no prototypes */
+#define ITEM_META_MONITORED	" h.status=0 AND i.status=0 AND i.flags<>2"
+
+typedef struct
+{
+	zbx_uint64_t	hostid;
+	char		*groups;
+	zbx_uint64_t	filter;		/* rules matched by the host groups */
+}
+item_meta_host_t;
+
+typedef struct
+{
+	zbx_uint64_t	itemid;
+	zbx_uint64_t	hostid;
+	char		*name_host;	/* measurement and host_name tag */
+	char		*field;		/* field name, InfluxDBSchema=host only */
+	char		*applications;
+	zbx_uint64_t	filter;		/* rules matched by the key, host name and applications */
+}
+item_meta_item_t;
+
+/* strings are built here before they are copied to their owner */
+static line_buffer_t	meta_buf;
+
+/* appends a group or application name to the '|' separated list in meta_buf */
+static void	item_meta_join(const char *name)
+{
+	if (0 != meta_buf.offset)
+		line_buffer_append(&meta_buf, "|", 1);
+
+	lp_append_escaped(&meta_buf, name, strlen(name), LP_ESCAPE_TAG);
+}
+
+static const char	*item_meta_groups_table(void)
+{
+	// Zabbix 3 vs Zabbix 4 table name
+	return (CONFIG_ZABBIX_MAJOR_VERSION > (int*) 3) ? "hstgrp" : "groups";
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_fetch_items                                            *
+ *                                                                            *
+ * Purpose: reads itemid, hostid, name, key_ and host name rows, keeps the    *
+ *          expanded item name and host name tag of each item                 *
+ *                                                                            *
+ ******************************************************************************/
+static void	item_meta_fetch_items(DB_RESULT result, zbx_hashset_t *items, zbx_vector_uint64_t *hostids)
+{
+	DB_ROW			row;
+	item_meta_item_t	item_local;
+
+	while (NULL != (row = DBfetch(result)))
+	{
+		line_buffer_reset(&meta_buf);
+		item_local.field = NULL;
+
+		if (ITEM_META_SCHEMA_HOST == CONFIG_INFLUXDB_SCHEMA)
+		{
+			lp_append_escaped(&meta_buf, row[3], strlen(row[3]), LP_ESCAPE_FIELD_KEY);
+			item_local.field = zbx_strdup(NULL, meta_buf.data);
+			line_buffer_reset(&meta_buf);
+			lp_append_escaped(&meta_buf, CONFIG_HOST_SCHEMA_MEASUREMENT, strlen(CONFIG_HOST_SCHEMA_MEASUREMENT),
+					LP_ESCAPE_MEASUREMENT);
+		}
+		else
+			item_name_expand(&meta_buf, row[2], row[3]);
+
+		line_buffer_append_str(&meta_buf, ",host_name=");
+		lp_append_escaped(&meta_buf, row[4], strlen(row[4]), LP_ESCAPE_TAG);
+
+		ZBX_STR2UINT64(item_local.itemid, row[0]);
+		ZBX_STR2UINT64(item_local.hostid, row[1]);
+		item_local.name_host = zbx_strdup(NULL, meta_buf.data);
+		item_local.applications = NULL;
+		item_local.filter = item_filter_match(ITEM_FILTER_KEY, row[3]) | item_filter_match(ITEM_FILTER_HOST, row[4]);
+		zbx_hashset_insert(items, &item_local, sizeof(item_local));
+
+		zbx_vector_uint64_append(hostids, item_local.hostid);
+	}
+	DBfree_result(result);
+
+	zbx_vector_uint64_sort(hostids, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+	zbx_vector_uint64_uniq(hostids, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_fetch_groups                                           *
+ *                                                                            *
+ * Purpose: reads hostid, group name rows ordered by hostid and group name    *
+ *                                                                            *
+ ******************************************************************************/
+static void	item_meta_fetch_groups(DB_RESULT result, zbx_hashset_t *hosts)
+{
+	DB_ROW			row;
+	zbx_uint64_t		hostid = 0, lastid = 0;
+	item_meta_host_t	host_local;
+	zbx_uint64_t		filter = 0;
+
+	for (;;)
+	{
+		if (NULL != (row = DBfetch(result)))
+			ZBX_STR2UINT64(hostid, row[0]);
+
+		if (0 != lastid && (NULL == row || hostid != lastid))
+		{
+			host_local.hostid = lastid;
+			host_local.groups = zbx_strdup(NULL, meta_buf.data);
+			host_local.filter = filter;
+			zbx_hashset_insert(hosts, &host_local, sizeof(host_local));
+		}
+
+		if (NULL == row)
+			break;
+
+		if (hostid != lastid)
+		{
+			line_buffer_reset(&meta_buf);
+			lastid = hostid;
+			filter = 0;
+		}
+
+		item_meta_join(row[1]);
+		filter |= item_filter_match(ITEM_FILTER_HOST_GROUP, row[1]);
+	}
+	DBfree_result(result);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_fetch_applications                                     *
+ *                                                                            *
+ * Purpose: reads itemid, application name rows ordered by itemid and         *
+ *          application name, rows of items not in items are skipped          *
+ *                                                                            *
+ ******************************************************************************/
+static void	item_meta_fetch_applications(DB_RESULT result, zbx_hashset_t *items)
+{
+	DB_ROW			row;
+	zbx_uint64_t		itemid = 0, lastid = 0;
+	item_meta_item_t	*item;
+	zbx_uint64_t		filter = 0;
+
+	for (;;)
+	{
+		if (NULL != (row = DBfetch(result)))
+			ZBX_STR2UINT64(itemid, row[0]);
+
+		if (0 != lastid && (NULL == row || itemid != lastid) &&
+				NULL != (item = (item_meta_item_t *)zbx_hashset_search(items, &lastid)))
+		{
+			item->applications = zbx_strdup(NULL, meta_buf.data);
+			item->filter |= filter;
+		}
+
+		if (NULL == row)
+			break;
+
+		if (itemid != lastid)
+		{
+			line_buffer_reset(&meta_buf);
+			lastid = itemid;
+			filter = 0;
+		}
+
+		item_meta_join(row[1]);
+		filter |= item_filter_match(ITEM_FILTER_APPLICATION, row[1]);
+	}
+	DBfree_result(result);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_build                                                  *
+ *                                                                            *
+ * Purpose: passes the series key of every item with host groups to cb, an    *
+ *          empty one if the item is filtered out, and empties items and      *
+ *          hosts                                                             *
+ *                                                                            *
+ ******************************************************************************/
+static int	item_meta_build(zbx_hashset_t *items, zbx_hashset_t *hosts, item_meta_cb_t cb, void *arg)
+{
+	zbx_hashset_iter_t	iter;
+	item_meta_item_t	*item;
+	item_meta_host_t	*host;
+	int			built = 0;
+
+	zbx_hashset_iter_reset(items, &iter);
+
+	while (NULL != (item = (item_meta_item_t *)zbx_hashset_iter_next(&iter)))
+	{
+		if (NULL != (host = (item_meta_host_t *)zbx_hashset_search(hosts, &item->hostid)) &&
+				SUCCEED != item_filter_exported(item->filter | host->filter))
+		{
+			cb(item->itemid, "", 0, item->filter | host->filter, arg);
+			built++;
+		}
+		else if (NULL != host)
+		{
+			line_buffer_reset(&meta_buf);
+			line_buffer_append_str(&meta_buf, item->name_host);
+			line_buffer_append_str(&meta_buf, ",host_groups=");
+			line_buffer_append_str(&meta_buf, host->groups);
+
+			if (NULL != item->field)
+			{
+				line_buffer_append(&meta_buf, " ", 1);
+				line_buffer_append_str(&meta_buf, item->field);
+			}
+			else if (NULL != item->applications)
+			{
+				line_buffer_append_str(&meta_buf, ",applications=");
+				line_buffer_append_str(&meta_buf, item->applications);
+			}
+
+			cb(item->itemid, meta_buf.data, meta_buf.offset, item->filter | host->filter, arg);
+			built++;
+		}
+
+		zbx_free(item->name_host);
+		zbx_free(item->field);
+		zbx_free(item->applications);
+	}
+
+	zbx_hashset_iter_reset(hosts, &iter);
+
+	while (NULL != (host = (item_meta_host_t *)zbx_hashset_iter_next(&iter)))
+		zbx_free(host->groups);
+
+	zbx_hashset_clear(items);
+	zbx_hashset_clear(hosts);
+
+	return built;
+}
+
+static DB_RESULT	item_meta_select(char **sql, size_t *sql_alloc, const char *query, const char *field,
+		const zbx_uint64_t *ids, int ids_num, const char *order)
+{
+	size_t	sql_offset = 0;
+
+	zbx_strcpy_alloc(sql, sql_alloc, &sql_offset, query);
+	DBadd_condition_alloc(sql, sql_alloc, &sql_offset, field, ids, ids_num);
+	zbx_strcpy_alloc(sql, sql_alloc, &sql_offset, order);
+
+	// log for debugging the query
+	// zabbix_log(MODULE_LOG_LEVEL, "[%s] item_meta_select query: %s", MODULE_NAME, *sql);
+	return DBselect("%s", *sql);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_resolve                                                *
+ *                                                                            *
+ * Purpose: reads series keys of a set of items, up to ITEM_META_CHUNK items  *
+ *          per query                                                         *
+ *                                                                            *
+ * Parameters: itemids - sorted list of unique itemids to resolve             *
+ *             cb      - called with the series key of each item found        *
+ *             arg     - passed to cb                                         *
+ *                                                                            *
+ ******************************************************************************/
+void	item_meta_resolve(const zbx_vector_uint64_t *itemids, item_meta_cb_t cb, void *arg)
+{
+	char			*sql = NULL, *groups_query;
+	size_t			sql_alloc = 0;
+	int			i, num;
+	zbx_hashset_t		items, hosts;
+	zbx_vector_uint64_t	hostids;
+
+	zbx_hashset_create(&items, MIN(itemids->values_num, ITEM_META_CHUNK), ZBX_DEFAULT_UINT64_HASH_FUNC,
+			ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+	zbx_hashset_create(&hosts, 100, ZBX_DEFAULT_UINT64_HASH_FUNC, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+	zbx_vector_uint64_create(&hostids);
+
+	groups_query = zbx_dsprintf(NULL, "SELECT hg.hostid, g.name FROM hosts_groups hg JOIN %s g ON g.groupid = hg.groupid"
+			" WHERE", item_meta_groups_table());
+
+	for (i = 0; i < itemids->values_num; i += ITEM_META_CHUNK)
+	{
+		num = MIN(ITEM_META_CHUNK, itemids->values_num - i);
+
+		item_meta_fetch_items(item_meta_select(&sql, &sql_alloc,
+				"SELECT i.itemid, i.hostid, i.name, i.key_, h.name FROM items i JOIN hosts h ON h.hostid = i.hostid"
+				" WHERE", "i.itemid", itemids->values + i, num, ""), &items, &hostids);
+
+		item_meta_fetch_groups(item_meta_select(&sql, &sql_alloc, groups_query, "hg.hostid", hostids.values,
+				hostids.values_num, " ORDER BY hg.hostid, g.name"), &hosts);
+
+		item_meta_fetch_applications(item_meta_select(&sql, &sql_alloc,
+				"SELECT ia.itemid, a.name FROM items_applications ia"
+				" JOIN applications a ON a.applicationid = ia.applicationid WHERE",
+				"ia.itemid", itemids->values + i, num, " ORDER BY ia.itemid, a.name"), &items);
+
+		item_meta_build(&items, &hosts, cb, arg);
+		zbx_vector_uint64_clear(&hostids);
+	}
+
+	line_buffer_reset(&meta_buf);
+	zbx_free(groups_query);
+	zbx_free(sql);
+	zbx_vector_uint64_destroy(&hostids);
+	zbx_hashset_destroy(&hosts);
+	zbx_hashset_destroy(&items);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_prewarm                                                *
+ *                                                                            *
+ * Purpose: reads series keys of all monitored items                          *
+ *                                                                            *
+ * Parameters: limit - maximum number of items read                           *
+ *             cb    - called with the series key of each item found          *
+ *             arg   - passed to cb                                           *
+ *                                                                            *
+ * Return value: number of series keys passed to cb                           *
+ *                                                                            *
+ * Comment: group and application rows are read for all monitored items and   *
+ *          filtered here, listing the ids would make the queries huge        *
+ *                                                                            *
+ ******************************************************************************/
+int	item_meta_prewarm(int limit, item_meta_cb_t cb, void *arg)
+{
+	zbx_hashset_t		items, hosts;
+	zbx_vector_uint64_t	hostids;
+	int			built;
+
+	zbx_hashset_create(&items, MIN(limit, 100000), ZBX_DEFAULT_UINT64_HASH_FUNC, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+	zbx_hashset_create(&hosts, 1000, ZBX_DEFAULT_UINT64_HASH_FUNC, ZBX_DEFAULT_UINT64_COMPARE_FUNC);
+	zbx_vector_uint64_create(&hostids);
+
+	item_meta_fetch_items(DBselectN(
+			"SELECT i.itemid, i.hostid, i.name, i.key_, h.name FROM items i JOIN hosts h ON h.hostid = i.hostid"
+			" WHERE" ITEM_META_MONITORED " ORDER BY i.itemid", limit), &items, &hostids);
+
+	item_meta_fetch_groups(DBselect(
+			"SELECT hg.hostid, g.name FROM hosts_groups hg JOIN %s g ON g.groupid = hg.groupid"
+			" JOIN hosts h ON h.hostid = hg.hostid WHERE h.status=0 ORDER BY hg.hostid, g.name",
+			item_meta_groups_table()), &hosts);
+
+	item_meta_fetch_applications(DBselect(
+			"SELECT ia.itemid, a.name FROM items_applications ia"
+			" JOIN applications a ON a.applicationid = ia.applicationid"
+			" JOIN items i ON i.itemid = ia.itemid JOIN hosts h ON h.hostid = i.hostid"
+			" WHERE" ITEM_META_MONITORED " ORDER BY ia.itemid, a.name"), &items);
+
+	built = item_meta_build(&items, &hosts, cb, arg);
+
+	line_buffer_free(&meta_buf);
+	zbx_vector_uint64_destroy(&hostids);
+	zbx_hashset_destroy(&hosts);
+	zbx_hashset_destroy(&items);
+
+	return built;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: item_meta_destroy                                                *
+ *                                                                            *
+ ******************************************************************************/
+void	item_meta_destroy(void)
+{
+	line_buffer_free(&meta_buf);
+}
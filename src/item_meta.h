@@ -0,0 +1,21 @@
+#ifndef __ZABBIX_ITEM_META_H
+#define __ZABBIX_ITEM_META_H
+
+
+#include "common.h"
+#include "zbxalgo.h"
+
+/* InfluxDBSchema */
+#define ITEM_META_SCHEMA_ITEM	1	/* measurement per item, tags of the item, field value */
+#define ITEM_META_SCHEMA_HOST	2	/* one measurement, tags of the host, field named by the item key */
+
+/* receives the series key of an item and the item_filter.c rules it matched, the key is only valid during */
+/* the call and empty if the item is filtered out */
+typedef void (*item_meta_cb_t)(zbx_uint64_t itemid, const char *series, size_t len, zbx_uint64_t match, void *arg);
+
+extern void item_meta_resolve(const zbx_vector_uint64_t *itemids, item_meta_cb_t cb, void *arg);
+extern int item_meta_prewarm(int limit, item_meta_cb_t cb, void *arg);
+extern void item_meta_destroy(void);
+
+
+#endif /* __ZABBIX_ITEM_META_H */
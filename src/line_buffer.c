@@ -0,0 +1,124 @@
+// growable buffer the line protocol payload of a history batch is built in
+// 1] every write appends at the tracked offset, nothing is ever rescanned
+//    with strlen, so building a batch is linear in its size
+// 2] the buffer grows geometrically and is only reset between batches, after
+//    the first few batches a history syncer stops allocating altogether
+// 3] a buffer that grew past LINE_BUFFER_KEEP_SIZE because of a burst is
+//    released on reset instead of being held for the life of the process
+//
+// Each history syncer process has its own buffer, no locking needed.
+
+#include "line_buffer.h"
+
+#define LINE_BUFFER_INIT_SIZE	(64 * ZBX_KIBIBYTE)
+#define LINE_BUFFER_KEEP_SIZE	(16 * ZBX_MEBIBYTE)
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_reset                                                *
+ *                                                                            *
+ * Purpose: empties the buffer for the next batch, keeping its memory         *
+ *                                                                            *
+ ******************************************************************************/
+void	line_buffer_reset(line_buffer_t *buf)
+{
+	if (LINE_BUFFER_KEEP_SIZE < buf->alloc)
+		line_buffer_free(buf);
+
+	buf->offset = 0;
+
+	if (NULL != buf->data)
+		*buf->data = '\0';
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_free                                                 *
+ *                                                                            *
+ ******************************************************************************/
+void	line_buffer_free(line_buffer_t *buf)
+{
+	zbx_free(buf->data);
+	buf->alloc = 0;
+	buf->offset = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_reserve                                              *
+ *                                                                            *
+ * Purpose: makes room for len more bytes (plus terminating zero)             *
+ *                                                                            *
+ * Return value: pointer to the current end of data, the caller writes at     *
+ *               most len bytes there and confirms them with                  *
+ *               line_buffer_commit()                                         *
+ *                                                                            *
+ ******************************************************************************/
+char	*line_buffer_reserve(line_buffer_t *buf, size_t len)
+{
+	size_t	need = buf->offset + len + 1;
+
+	if (need > buf->alloc)
+	{
+		size_t	alloc = (0 == buf->alloc ? LINE_BUFFER_INIT_SIZE : buf->alloc);
+
+		while (alloc < need)
+			alloc *= 2;
+
+		buf->data = (char *)zbx_realloc(buf->data, alloc);
+		buf->alloc = alloc;
+	}
+
+	return buf->data + buf->offset;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_commit                                               *
+ *                                                                            *
+ * Purpose: accounts for len bytes written after line_buffer_reserve()        *
+ *                                                                            *
+ ******************************************************************************/
+void	line_buffer_commit(line_buffer_t *buf, size_t len)
+{
+	buf->offset += len;
+	buf->data[buf->offset] = '\0';
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_truncate                                             *
+ *                                                                            *
+ * Purpose: drops everything written after offset, used to discard a          *
+ *          partially written line                                            *
+ *                                                                            *
+ ******************************************************************************/
+void	line_buffer_truncate(line_buffer_t *buf, size_t offset)
+{
+	if (offset >= buf->offset)
+		return;
+
+	buf->offset = offset;
+	buf->data[offset] = '\0';
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_append                                               *
+ *                                                                            *
+ ******************************************************************************/
+void	line_buffer_append(line_buffer_t *buf, const char *str, size_t len)
+{
+	memcpy(line_buffer_reserve(buf, len), str, len);
+	line_buffer_commit(buf, len);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: line_buffer_append_str                                           *
+ *                                                                            *
+ ******************************************************************************/
+void	line_buffer_append_str(line_buffer_t *buf, const char *str)
+{
+	line_buffer_append(buf, str, strlen(str));
+}
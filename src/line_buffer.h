@@ -0,0 +1,27 @@
+#ifndef __ZABBIX_LINE_BUFFER_H
+#define __ZABBIX_LINE_BUFFER_H
+
+
+#include "common.h"
+
+/* growable buffer the payload of a batch is built in, kept between batches */
+typedef struct
+{
+	char	*data;
+	size_t	alloc;
+	size_t	offset;
+}
+line_buffer_t;
+
+extern void line_buffer_reset(line_buffer_t *buf);
+extern void line_buffer_free(line_buffer_t *buf);
+
+extern char *line_buffer_reserve(line_buffer_t *buf, size_t len);
+extern void line_buffer_commit(line_buffer_t *buf, size_t len);
+extern void line_buffer_truncate(line_buffer_t *buf, size_t offset);
+
+extern void line_buffer_append(line_buffer_t *buf, const char *str, size_t len);
+extern void line_buffer_append_str(line_buffer_t *buf, const char *str);
+
+
+#endif /* __ZABBIX_LINE_BUFFER_H */
@@ -4,6 +4,11 @@
 // 3] override values with whatever is set in the config MODULE_LOCAL_CONFIG_FILE_NAME if present
 
 #include "load_config.h"
+#include "send_queue.h"
+#include "influxdb_writer.h"
+#include "lp_format.h"
+#include "spool.h"
+#include "item_meta.h"
 
 char *CONFIG_INFLUXDB_ADDRESS = NULL;
 char *CONFIG_INFLUXDB_NAME = NULL;
@@ -16,6 +21,63 @@ int *CONFIG_FORCE_MODULE_DEBUG = NULL;
 int *CONFIG_ZABBIX_MAJOR_VERSION = NULL;
 int *CONFIG_DATABASE_ENGINE = NULL;
 char *PARSE_DATABASE_ENGINE = NULL;
+int CONFIG_ITEM_CACHE_SIZE = 0;
+int CONFIG_ITEM_CACHE_TTL = 0;
+int CONFIG_ITEM_CACHE_SHARED = 0;
+zbx_uint64_t CONFIG_ITEM_CACHE_SHARED_SIZE = 0;
+int CONFIG_ITEM_CACHE_PREWARM = 0;
+char *CONFIG_ITEM_CACHE_SNAPSHOT = NULL;
+int CONFIG_INFLUXDB_CONNECT_TIMEOUT = 0;
+int CONFIG_INFLUXDB_TIMEOUT = 0;
+int CONFIG_INFLUXDB_MAX_RETRIES = 0;
+int CONFIG_INFLUXDB_RETRY_DELAY = 0;
+int CONFIG_INFLUXDB_BREAKER_THRESHOLD = 0;
+int CONFIG_INFLUXDB_BREAKER_TIMEOUT = 0;
+int CONFIG_INFLUXDB_GZIP_LEVEL = 0;
+int CONFIG_INFLUXDB_GZIP_MIN_SIZE = 0;
+int CONFIG_INFLUXDB_CONNECTIONS = 0;
+int CONFIG_INFLUXDB_HTTP2 = 0;
+int CONFIG_INFLUXDB_FANOUT = 0;
+int CONFIG_INFLUXDB_API_VERSION = 0;
+char *CONFIG_INFLUXDB_ORG = NULL;
+char *CONFIG_INFLUXDB_BUCKET = NULL;
+char *CONFIG_INFLUXDB_TOKEN = NULL;
+int CONFIG_INFLUXDB_PRECISION = 0;
+char *PARSE_INFLUXDB_PRECISION = NULL;
+char *PARSE_INFLUXDB_FANOUT = NULL;
+int CONFIG_INFLUXDB_TRANSPORT = 0;
+char *PARSE_INFLUXDB_TRANSPORT = NULL;
+int CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE = 0;
+int CONFIG_MAX_LINES_PER_WRITE = 0;
+int CONFIG_MAX_BYTES_PER_WRITE = 0;
+int CONFIG_ASYNC_SEND = 0;
+int CONFIG_SEND_QUEUE_MAX_BATCHES = 0;
+zbx_uint64_t CONFIG_SEND_QUEUE_MAX_SIZE = 0;
+int CONFIG_SEND_QUEUE_FULL_POLICY = 0;
+char *PARSE_SEND_QUEUE_FULL_POLICY = NULL;
+char *CONFIG_SPOOL_DIR = NULL;
+zbx_uint64_t CONFIG_SPOOL_MAX_SIZE = 0;
+int CONFIG_SPOOL_SEGMENT_SIZE = 0;
+int CONFIG_SPOOL_FSYNC = 0;
+char *PARSE_SPOOL_FSYNC = NULL;
+int CONFIG_SPOOL_REPLAY_RATE = 0;
+char **CONFIG_INCLUDE_ITEMS = NULL;
+char **CONFIG_EXCLUDE_ITEMS = NULL;
+char **CONFIG_DEADBAND_RULES = NULL;
+int CONFIG_DEADBAND_HEARTBEAT = 0;
+int CONFIG_DEADBAND_SIZE = 0;
+int CONFIG_MAX_VALUE_LENGTH = 0;
+int CONFIG_INFLUXDB_SCHEMA = 0;
+char *PARSE_INFLUXDB_SCHEMA = NULL;
+char *CONFIG_HOST_SCHEMA_MEASUREMENT = NULL;
+int CONFIG_HOST_SCHEMA_INTERVAL = 0;
+char *CONFIG_ROLLUP_WINDOWS = NULL;
+char *CONFIG_ROLLUP_MEASUREMENT_SUFFIX = NULL;
+int CONFIG_ROLLUP_SIZE = 0;
+int CONFIG_SHARED_WRITER = 0;
+zbx_uint64_t CONFIG_SHARED_WRITER_RING_SIZE = 0;
+int CONFIG_SHARED_WRITER_BATCH_SIZE = 0;
+int CONFIG_SHARED_WRITER_LINGER = 0;
 
 
 /*********************************************************************
@@ -36,7 +98,17 @@ void     zbx_module_load_config(void)
 		{"InfluxDBAddress",		&CONFIG_INFLUXDB_ADDRESS,	TYPE_STRING,
 				PARM_OPT,   0,    0},
 		{"InfluxDBName",		&CONFIG_INFLUXDB_NAME,	TYPE_STRING,
-				PARM_MAND,  0,    0},
+				PARM_OPT,   0,    0},
+		{"InfluxDBAPIVersion",	&CONFIG_INFLUXDB_API_VERSION,	TYPE_INT,
+				PARM_OPT,		1,		2},
+		{"InfluxDBOrg",	&CONFIG_INFLUXDB_ORG,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"InfluxDBBucket",	&CONFIG_INFLUXDB_BUCKET,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"InfluxDBToken",	&CONFIG_INFLUXDB_TOKEN,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"InfluxDBPrecision",	&PARSE_INFLUXDB_PRECISION,	TYPE_STRING,
+				PARM_OPT,		0,		0},
 		{"InfluxDBUser",	&CONFIG_INFLUXDB_USER,	TYPE_STRING,
 				PARM_OPT,   0,		0},
 		{"InfluxDBPassword",	&CONFIG_INFLUXDB_PWD,	TYPE_STRING,
@@ -47,12 +119,104 @@ void     zbx_module_load_config(void)
 				PARM_OPT,		0,		0},
 		{"InfluxDBSSLInsecure",	&CONFIG_INFLUXDB_SSL_INSECURE,	TYPE_INT,
 				PARM_OPT,		0,		1},
+		{"InfluxDBConnectTimeout",	&CONFIG_INFLUXDB_CONNECT_TIMEOUT,	TYPE_INT,
+				PARM_OPT,		1,		300},
+		{"InfluxDBTimeout",	&CONFIG_INFLUXDB_TIMEOUT,	TYPE_INT,
+				PARM_OPT,		1,		3600},
+		{"InfluxDBMaxRetries",	&CONFIG_INFLUXDB_MAX_RETRIES,	TYPE_INT,
+				PARM_OPT,		0,		10},
+		{"InfluxDBRetryDelay",	&CONFIG_INFLUXDB_RETRY_DELAY,	TYPE_INT,
+				PARM_OPT,		10,		60000},
+		{"InfluxDBBreakerThreshold",	&CONFIG_INFLUXDB_BREAKER_THRESHOLD,	TYPE_INT,
+				PARM_OPT,		0,		1000},
+		{"InfluxDBBreakerTimeout",	&CONFIG_INFLUXDB_BREAKER_TIMEOUT,	TYPE_INT,
+				PARM_OPT,		1,		3600},
+		{"InfluxDBGzipLevel",	&CONFIG_INFLUXDB_GZIP_LEVEL,	TYPE_INT,
+				PARM_OPT,		0,		9},
+		{"InfluxDBGzipMinSize",	&CONFIG_INFLUXDB_GZIP_MIN_SIZE,	TYPE_INT,
+				PARM_OPT,		0,		ZBX_GIBIBYTE},
+		{"InfluxDBConnections",	&CONFIG_INFLUXDB_CONNECTIONS,	TYPE_INT,
+				PARM_OPT,		1,		64},
+		{"InfluxDBHTTP2",	&CONFIG_INFLUXDB_HTTP2,	TYPE_INT,
+				PARM_OPT,		0,		1},
+		{"InfluxDBFanout",	&PARSE_INFLUXDB_FANOUT,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"InfluxDBTransport",	&PARSE_INFLUXDB_TRANSPORT,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"InfluxDBUDPPayloadSize",	&CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE,	TYPE_INT,
+				PARM_OPT,		512,		INFLUXDB_UDP_PAYLOAD_MAX},
+		{"MaxLinesPerWrite",	&CONFIG_MAX_LINES_PER_WRITE,	TYPE_INT,
+				PARM_OPT,		0,		10000000},
+		{"MaxBytesPerWrite",	&CONFIG_MAX_BYTES_PER_WRITE,	TYPE_INT,
+				PARM_OPT,		0,		ZBX_GIBIBYTE},
 		{"ForceModuleDebugLogging",	&CONFIG_FORCE_MODULE_DEBUG,	TYPE_INT,
 				PARM_OPT,		0,		1},
 		{"ZabbixMajorVersion",	&CONFIG_ZABBIX_MAJOR_VERSION,	TYPE_INT,
 				PARM_OPT,		3,		4},
 		{"DatabaseEngine",	&PARSE_DATABASE_ENGINE,	TYPE_STRING,
 				PARM_OPT,		0,		0},
+		{"ItemCacheSize",	&CONFIG_ITEM_CACHE_SIZE,	TYPE_INT,
+				PARM_OPT,		0,		10000000},
+		{"ItemCacheTTL",	&CONFIG_ITEM_CACHE_TTL,	TYPE_INT,
+				PARM_OPT,		0,		86400},
+		{"ItemCacheShared",	&CONFIG_ITEM_CACHE_SHARED,	TYPE_INT,
+				PARM_OPT,		0,		1},
+		{"ItemCacheSharedSize",	&CONFIG_ITEM_CACHE_SHARED_SIZE,	TYPE_UINT64,
+				PARM_OPT,		ZBX_MEBIBYTE,	__UINT64_C(64) * ZBX_GIBIBYTE},
+		{"ItemCachePrewarm",	&CONFIG_ITEM_CACHE_PREWARM,	TYPE_INT,
+				PARM_OPT,		0,		1},
+		{"ItemCacheSnapshot",	&CONFIG_ITEM_CACHE_SNAPSHOT,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"AsyncSend",	&CONFIG_ASYNC_SEND,	TYPE_INT,
+				PARM_OPT,		0,		1},
+		{"SendQueueMaxBatches",	&CONFIG_SEND_QUEUE_MAX_BATCHES,	TYPE_INT,
+				PARM_OPT,		1,		100000},
+		{"SendQueueMaxSize",	&CONFIG_SEND_QUEUE_MAX_SIZE,	TYPE_UINT64,
+				PARM_OPT,		ZBX_KIBIBYTE,	__UINT64_C(16) * ZBX_GIBIBYTE},
+		{"SendQueueFullPolicy",	&PARSE_SEND_QUEUE_FULL_POLICY,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"SpoolDir",	&CONFIG_SPOOL_DIR,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"SpoolMaxSize",	&CONFIG_SPOOL_MAX_SIZE,	TYPE_UINT64,
+				PARM_OPT,		ZBX_MEBIBYTE,	__UINT64_C(1024) * ZBX_GIBIBYTE},
+		{"SpoolSegmentSize",	&CONFIG_SPOOL_SEGMENT_SIZE,	TYPE_INT,
+				PARM_OPT,		ZBX_KIBIBYTE,	ZBX_GIBIBYTE},
+		{"SpoolFsync",	&PARSE_SPOOL_FSYNC,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"SpoolReplayRate",	&CONFIG_SPOOL_REPLAY_RATE,	TYPE_INT,
+				PARM_OPT,		0,		ZBX_GIBIBYTE},
+		{"IncludeItems",	&CONFIG_INCLUDE_ITEMS,	TYPE_MULTISTRING,
+				PARM_OPT,		0,		0},
+		{"ExcludeItems",	&CONFIG_EXCLUDE_ITEMS,	TYPE_MULTISTRING,
+				PARM_OPT,		0,		0},
+		{"DeadbandRule",	&CONFIG_DEADBAND_RULES,	TYPE_MULTISTRING,
+				PARM_OPT,		0,		0},
+		{"DeadbandHeartbeat",	&CONFIG_DEADBAND_HEARTBEAT,	TYPE_INT,
+				PARM_OPT,		0,		86400},
+		{"DeadbandSize",	&CONFIG_DEADBAND_SIZE,	TYPE_INT,
+				PARM_OPT,		1,		10000000},
+		{"MaxValueLength",	&CONFIG_MAX_VALUE_LENGTH,	TYPE_INT,
+				PARM_OPT,		0,		ZBX_GIBIBYTE},
+		{"InfluxDBSchema",	&PARSE_INFLUXDB_SCHEMA,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"HostSchemaMeasurement",	&CONFIG_HOST_SCHEMA_MEASUREMENT,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"HostSchemaInterval",	&CONFIG_HOST_SCHEMA_INTERVAL,	TYPE_INT,
+				PARM_OPT,		0,		SEC_PER_HOUR},
+		{"RollupWindows",	&CONFIG_ROLLUP_WINDOWS,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"RollupMeasurementSuffix",	&CONFIG_ROLLUP_MEASUREMENT_SUFFIX,	TYPE_STRING,
+				PARM_OPT,		0,		0},
+		{"RollupSize",	&CONFIG_ROLLUP_SIZE,	TYPE_INT,
+				PARM_OPT,		1,		10000000},
+		{"SharedWriter",	&CONFIG_SHARED_WRITER,	TYPE_INT,
+				PARM_OPT,		0,		1},
+		{"SharedWriterRingSize",	&CONFIG_SHARED_WRITER_RING_SIZE,	TYPE_UINT64,
+				PARM_OPT,		ZBX_MEBIBYTE,	__UINT64_C(16) * ZBX_GIBIBYTE},
+		{"SharedWriterBatchSize",	&CONFIG_SHARED_WRITER_BATCH_SIZE,	TYPE_INT,
+				PARM_OPT,		ZBX_KIBIBYTE,	ZBX_GIBIBYTE},
+		{"SharedWriterLinger",	&CONFIG_SHARED_WRITER_LINGER,	TYPE_INT,
+				PARM_OPT,		0,		60000},
 		{NULL}
 	};
 
@@ -64,6 +228,52 @@ void     zbx_module_load_config(void)
 	CONFIG_FORCE_MODULE_DEBUG = (int*) 0;
 	CONFIG_ZABBIX_MAJOR_VERSION = (int*) 4;
 	PARSE_DATABASE_ENGINE = zbx_strdup(PARSE_DATABASE_ENGINE, "mysql");
+	CONFIG_ITEM_CACHE_SIZE = 100000;
+	CONFIG_ITEM_CACHE_TTL = 600;
+	CONFIG_ITEM_CACHE_SHARED = 0;
+	CONFIG_ITEM_CACHE_SHARED_SIZE = 64 * ZBX_MEBIBYTE;
+	CONFIG_ITEM_CACHE_PREWARM = 0;
+	CONFIG_INFLUXDB_CONNECT_TIMEOUT = 5;
+	CONFIG_INFLUXDB_TIMEOUT = 10;
+	CONFIG_INFLUXDB_MAX_RETRIES = 2;
+	CONFIG_INFLUXDB_RETRY_DELAY = 500;
+	CONFIG_INFLUXDB_BREAKER_THRESHOLD = 5;
+	CONFIG_INFLUXDB_BREAKER_TIMEOUT = 30;
+	CONFIG_INFLUXDB_GZIP_LEVEL = 0;
+	CONFIG_INFLUXDB_GZIP_MIN_SIZE = 1024;
+	CONFIG_INFLUXDB_CONNECTIONS = 4;
+	CONFIG_INFLUXDB_HTTP2 = 0;
+	PARSE_INFLUXDB_FANOUT = zbx_strdup(PARSE_INFLUXDB_FANOUT, "replicate");
+	PARSE_INFLUXDB_TRANSPORT = zbx_strdup(PARSE_INFLUXDB_TRANSPORT, "tcp");
+	CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE = 1400;
+	CONFIG_INFLUXDB_API_VERSION = 1;
+	PARSE_INFLUXDB_PRECISION = zbx_strdup(PARSE_INFLUXDB_PRECISION, "ns");
+	CONFIG_INFLUXDB_PRECISION = -1;
+	CONFIG_MAX_LINES_PER_WRITE = 5000;
+	CONFIG_MAX_BYTES_PER_WRITE = 4 * ZBX_MEBIBYTE;
+	CONFIG_ASYNC_SEND = 0;
+	CONFIG_SEND_QUEUE_MAX_BATCHES = 100;
+	CONFIG_SEND_QUEUE_MAX_SIZE = 64 * ZBX_MEBIBYTE;
+	PARSE_SEND_QUEUE_FULL_POLICY = zbx_strdup(PARSE_SEND_QUEUE_FULL_POLICY, "block");
+	CONFIG_SPOOL_MAX_SIZE = ZBX_GIBIBYTE;
+	CONFIG_SPOOL_SEGMENT_SIZE = 16 * ZBX_MEBIBYTE;
+	PARSE_SPOOL_FSYNC = zbx_strdup(PARSE_SPOOL_FSYNC, "segment");
+	CONFIG_SPOOL_REPLAY_RATE = ZBX_MEBIBYTE;
+	zbx_strarr_init(&CONFIG_INCLUDE_ITEMS);
+	zbx_strarr_init(&CONFIG_EXCLUDE_ITEMS);
+	zbx_strarr_init(&CONFIG_DEADBAND_RULES);
+	CONFIG_DEADBAND_HEARTBEAT = 600;
+	CONFIG_DEADBAND_SIZE = 100000;
+	CONFIG_MAX_VALUE_LENGTH = 65535;
+	PARSE_INFLUXDB_SCHEMA = zbx_strdup(PARSE_INFLUXDB_SCHEMA, "item");
+	CONFIG_HOST_SCHEMA_MEASUREMENT = zbx_strdup(CONFIG_HOST_SCHEMA_MEASUREMENT, "zabbix");
+	CONFIG_HOST_SCHEMA_INTERVAL = 0;
+	CONFIG_ROLLUP_MEASUREMENT_SUFFIX = zbx_strdup(CONFIG_ROLLUP_MEASUREMENT_SUFFIX, "_rollup");
+	CONFIG_ROLLUP_SIZE = 100000;
+	CONFIG_SHARED_WRITER = 0;
+	CONFIG_SHARED_WRITER_RING_SIZE = 64 * ZBX_MEBIBYTE;
+	CONFIG_SHARED_WRITER_BATCH_SIZE = 4 * ZBX_MEBIBYTE;
+	CONFIG_SHARED_WRITER_LINGER = 1000;
 
 
 	// load main config file
@@ -81,6 +291,66 @@ void     zbx_module_load_config(void)
 	    CONFIG_DATABASE_ENGINE = (int*) DATABASE_ENGINE_POSTGRESQL;
 	}
 
+	// parse fan-out mode
+	if (strcmp(PARSE_INFLUXDB_FANOUT, "replicate") == 0) {
+	    CONFIG_INFLUXDB_FANOUT = INFLUXDB_FANOUT_REPLICATE;
+	}
+	else if (strcmp(PARSE_INFLUXDB_FANOUT, "shard") == 0) {
+	    CONFIG_INFLUXDB_FANOUT = INFLUXDB_FANOUT_SHARD;
+	}
+
+	// parse transport
+	if (strcmp(PARSE_INFLUXDB_TRANSPORT, "tcp") == 0) {
+	    CONFIG_INFLUXDB_TRANSPORT = INFLUXDB_TRANSPORT_TCP;
+	}
+	else if (strcmp(PARSE_INFLUXDB_TRANSPORT, "unix") == 0) {
+	    CONFIG_INFLUXDB_TRANSPORT = INFLUXDB_TRANSPORT_UNIX;
+	}
+	else if (strcmp(PARSE_INFLUXDB_TRANSPORT, "udp") == 0) {
+	    CONFIG_INFLUXDB_TRANSPORT = INFLUXDB_TRANSPORT_UDP;
+	}
+
+	// parse schema
+	if (strcmp(PARSE_INFLUXDB_SCHEMA, "item") == 0) {
+	    CONFIG_INFLUXDB_SCHEMA = ITEM_META_SCHEMA_ITEM;
+	}
+	else if (strcmp(PARSE_INFLUXDB_SCHEMA, "host") == 0) {
+	    CONFIG_INFLUXDB_SCHEMA = ITEM_META_SCHEMA_HOST;
+	}
+
+	// parse timestamp precision
+	if (strcmp(PARSE_INFLUXDB_PRECISION, "s") == 0) {
+	    CONFIG_INFLUXDB_PRECISION = LP_PRECISION_S;
+	}
+	else if (strcmp(PARSE_INFLUXDB_PRECISION, "ms") == 0) {
+	    CONFIG_INFLUXDB_PRECISION = LP_PRECISION_MS;
+	}
+	else if (strcmp(PARSE_INFLUXDB_PRECISION, "us") == 0) {
+	    CONFIG_INFLUXDB_PRECISION = LP_PRECISION_US;
+	}
+	else if (strcmp(PARSE_INFLUXDB_PRECISION, "ns") == 0) {
+	    CONFIG_INFLUXDB_PRECISION = LP_PRECISION_NS;
+	}
+
+	// parse send queue full policy
+	if (strcmp(PARSE_SEND_QUEUE_FULL_POLICY, "block") == 0) {
+	    CONFIG_SEND_QUEUE_FULL_POLICY = SEND_QUEUE_FULL_BLOCK;
+	}
+	else if (strcmp(PARSE_SEND_QUEUE_FULL_POLICY, "drop_oldest") == 0) {
+	    CONFIG_SEND_QUEUE_FULL_POLICY = SEND_QUEUE_FULL_DROP_OLDEST;
+	}
+
+	// parse spool fsync policy
+	if (strcmp(PARSE_SPOOL_FSYNC, "never") == 0) {
+	    CONFIG_SPOOL_FSYNC = SPOOL_FSYNC_NEVER;
+	}
+	else if (strcmp(PARSE_SPOOL_FSYNC, "segment") == 0) {
+	    CONFIG_SPOOL_FSYNC = SPOOL_FSYNC_SEGMENT;
+	}
+	else if (strcmp(PARSE_SPOOL_FSYNC, "always") == 0) {
+	    CONFIG_SPOOL_FSYNC = SPOOL_FSYNC_ALWAYS;
+	}
+
 	// clean up path variables
 	zbx_free(MODULE_CONFIG_FILE);
 	zbx_free(MODULE_LOCAL_CONFIG_FILE);
@@ -35,6 +35,65 @@ extern int *CONFIG_FORCE_MODULE_DEBUG;
 extern int *CONFIG_ZABBIX_MAJOR_VERSION;
 extern int *CONFIG_DATABASE_ENGINE;
 extern char *PARSE_DATABASE_ENGINE;
+extern int CONFIG_ITEM_CACHE_SIZE;
+extern int CONFIG_ITEM_CACHE_TTL;
+extern int CONFIG_ITEM_CACHE_SHARED;
+extern zbx_uint64_t CONFIG_ITEM_CACHE_SHARED_SIZE;
+extern int CONFIG_ITEM_CACHE_PREWARM;
+extern char *CONFIG_ITEM_CACHE_SNAPSHOT;
+extern int CONFIG_INFLUXDB_CONNECT_TIMEOUT;
+extern int CONFIG_INFLUXDB_TIMEOUT;
+extern int CONFIG_INFLUXDB_MAX_RETRIES;
+extern int CONFIG_INFLUXDB_RETRY_DELAY;
+extern int CONFIG_INFLUXDB_BREAKER_THRESHOLD;
+extern int CONFIG_INFLUXDB_BREAKER_TIMEOUT;
+extern int CONFIG_INFLUXDB_GZIP_LEVEL;
+extern int CONFIG_INFLUXDB_GZIP_MIN_SIZE;
+extern int CONFIG_INFLUXDB_CONNECTIONS;
+extern int CONFIG_INFLUXDB_HTTP2;
+extern int CONFIG_INFLUXDB_FANOUT;
+extern char *PARSE_INFLUXDB_FANOUT;
+extern int CONFIG_INFLUXDB_TRANSPORT;
+extern char *PARSE_INFLUXDB_TRANSPORT;
+extern int CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE;
+extern int CONFIG_INFLUXDB_API_VERSION;
+extern char *CONFIG_INFLUXDB_ORG;
+extern char *CONFIG_INFLUXDB_BUCKET;
+extern char *CONFIG_INFLUXDB_TOKEN;
+extern int CONFIG_INFLUXDB_PRECISION;
+extern char *PARSE_INFLUXDB_PRECISION;
+extern int CONFIG_MAX_LINES_PER_WRITE;
+extern int CONFIG_MAX_BYTES_PER_WRITE;
+extern int CONFIG_ASYNC_SEND;
+extern int CONFIG_SEND_QUEUE_MAX_BATCHES;
+extern zbx_uint64_t CONFIG_SEND_QUEUE_MAX_SIZE;
+extern int CONFIG_SEND_QUEUE_FULL_POLICY;
+extern char *PARSE_SEND_QUEUE_FULL_POLICY;
+extern char *CONFIG_SPOOL_DIR;
+extern zbx_uint64_t CONFIG_SPOOL_MAX_SIZE;
+extern int CONFIG_SPOOL_SEGMENT_SIZE;
+extern int CONFIG_SPOOL_FSYNC;
+extern char *PARSE_SPOOL_FSYNC;
+extern int CONFIG_SPOOL_REPLAY_RATE;
+extern char **CONFIG_INCLUDE_ITEMS;
+extern char **CONFIG_EXCLUDE_ITEMS;
+extern char **CONFIG_DEADBAND_RULES;
+extern int CONFIG_DEADBAND_HEARTBEAT;
+extern int CONFIG_DEADBAND_SIZE;
+extern int CONFIG_MAX_VALUE_LENGTH;
+extern int CONFIG_INFLUXDB_SCHEMA;
+extern char *PARSE_INFLUXDB_SCHEMA;
+extern char *CONFIG_HOST_SCHEMA_MEASUREMENT;
+extern int CONFIG_HOST_SCHEMA_INTERVAL;
+extern char *CONFIG_ROLLUP_WINDOWS;
+extern char *CONFIG_ROLLUP_MEASUREMENT_SUFFIX;
+extern int CONFIG_ROLLUP_SIZE;
+extern int CONFIG_SHARED_WRITER;
+extern zbx_uint64_t CONFIG_SHARED_WRITER_RING_SIZE;
+extern int CONFIG_SHARED_WRITER_BATCH_SIZE;
+extern int CONFIG_SHARED_WRITER_LINGER;
+
+extern int MODULE_LOG_LEVEL;
 
 
 #endif /* __ZABBIX_LOAD_CONFIG_H */
@@ -0,0 +1,865 @@
+// number formatting and escaping for the line protocol, written straight into the batch buffer
+// 1] doubles are printed as the shortest string that reads back to the same
+//    value (Grisu2, F. Loitsch "Printing Floating-Point Numbers Quickly and
+//    Accurately with Integers"), instead of "%f" which keeps 6 decimals only
+// 2] integers and timestamps go through a two digits at a time lookup table,
+//    no format string parsing per value
+// 3] measurement and tag names and values are escaped in runs, the plain part
+//    between two special characters is copied in one go
+// 4] string field values are escaped the same way into space reserved for the
+//    worst case, so a long text or log value costs one pass and no copy of its
+//    own; newlines are kept, InfluxDB takes them as part of a quoted string,
+//    so whatever splits payloads into lines must use lp_line_end()
+// 5] the search for the next special character compares 32 (AVX2) or 16 (SSE2)
+//    bytes at a time on x86, the AVX2 kernel is picked at run time when the CPU
+//    has it, elsewhere and for the last few bytes a bit set of the special
+//    characters is looked up byte by byte; most names and values have nothing
+//    to escape and become a single memcpy
+//
+// InfluxDB parses floats with strconv.ParseFloat, so both "0.001" and "1e-7"
+// style output is accepted.
+
+#include "lp_format.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#	define LP_SCAN_X86
+#	include <immintrin.h>
+#endif
+
+/* special characters of one part of a line, at most LP_SPECIAL_MAX of them */
+#define LP_SPECIAL_MAX	4
+
+typedef struct
+{
+	zbx_uint64_t	bits[2];	/* characters below 128 */
+	char		chars[LP_SPECIAL_MAX];
+	int		num;
+}
+lp_special_t;
+
+typedef const char	*(*lp_scan_func_t)(const char *p, const char *end, const lp_special_t *special);
+
+typedef struct
+{
+	zbx_uint64_t	f;
+	int		e;
+}
+diy_fp_t;
+
+#define DP_SIGNIFICAND_SIZE	52
+#define DP_EXPONENT_BIAS	(0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT		(-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK	__UINT64_C(0x7FF0000000000000)
+#define DP_SIGNIFICAND_MASK	__UINT64_C(0x000FFFFFFFFFFFFF)
+#define DP_HIDDEN_BIT		__UINT64_C(0x0010000000000000)
+
+static const char	digits_lut[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const zbx_uint64_t	pow10_lut[20] =
+{
+	__UINT64_C(1), __UINT64_C(10), __UINT64_C(100), __UINT64_C(1000), __UINT64_C(10000),
+	__UINT64_C(100000), __UINT64_C(1000000), __UINT64_C(10000000), __UINT64_C(100000000),
+	__UINT64_C(1000000000), __UINT64_C(10000000000), __UINT64_C(100000000000),
+	__UINT64_C(1000000000000), __UINT64_C(10000000000000), __UINT64_C(100000000000000),
+	__UINT64_C(1000000000000000), __UINT64_C(10000000000000000),
+	__UINT64_C(100000000000000000), __UINT64_C(1000000000000000000),
+	__UINT64_C(10000000000000000000)
+};
+
+/* normalized 10^k for k = -348, -340, ..., 340 */
+static const diy_fp_t	cached_powers[] =
+{
+	{__UINT64_C(0xfa8fd5a0081c0288), -1220},
+	{__UINT64_C(0xbaaee17fa23ebf76), -1193},
+	{__UINT64_C(0x8b16fb203055ac76), -1166},
+	{__UINT64_C(0xcf42894a5dce35ea), -1140},
+	{__UINT64_C(0x9a6bb0aa55653b2d), -1113},
+	{__UINT64_C(0xe61acf033d1a45df), -1087},
+	{__UINT64_C(0xab70fe17c79ac6ca), -1060},
+	{__UINT64_C(0xff77b1fcbebcdc4f), -1034},
+	{__UINT64_C(0xbe5691ef416bd60c), -1007},
+	{__UINT64_C(0x8dd01fad907ffc3c), -980},
+	{__UINT64_C(0xd3515c2831559a83), -954},
+	{__UINT64_C(0x9d71ac8fada6c9b5), -927},
+	{__UINT64_C(0xea9c227723ee8bcb), -901},
+	{__UINT64_C(0xaecc49914078536d), -874},
+	{__UINT64_C(0x823c12795db6ce57), -847},
+	{__UINT64_C(0xc21094364dfb5637), -821},
+	{__UINT64_C(0x9096ea6f3848984f), -794},
+	{__UINT64_C(0xd77485cb25823ac7), -768},
+	{__UINT64_C(0xa086cfcd97bf97f4), -741},
+	{__UINT64_C(0xef340a98172aace5), -715},
+	{__UINT64_C(0xb23867fb2a35b28e), -688},
+	{__UINT64_C(0x84c8d4dfd2c63f3b), -661},
+	{__UINT64_C(0xc5dd44271ad3cdba), -635},
+	{__UINT64_C(0x936b9fcebb25c996), -608},
+	{__UINT64_C(0xdbac6c247d62a584), -582},
+	{__UINT64_C(0xa3ab66580d5fdaf6), -555},
+	{__UINT64_C(0xf3e2f893dec3f126), -529},
+	{__UINT64_C(0xb5b5ada8aaff80b8), -502},
+	{__UINT64_C(0x87625f056c7c4a8b), -475},
+	{__UINT64_C(0xc9bcff6034c13053), -449},
+	{__UINT64_C(0x964e858c91ba2655), -422},
+	{__UINT64_C(0xdff9772470297ebd), -396},
+	{__UINT64_C(0xa6dfbd9fb8e5b88f), -369},
+	{__UINT64_C(0xf8a95fcf88747d94), -343},
+	{__UINT64_C(0xb94470938fa89bcf), -316},
+	{__UINT64_C(0x8a08f0f8bf0f156b), -289},
+	{__UINT64_C(0xcdb02555653131b6), -263},
+	{__UINT64_C(0x993fe2c6d07b7fac), -236},
+	{__UINT64_C(0xe45c10c42a2b3b06), -210},
+	{__UINT64_C(0xaa242499697392d3), -183},
+	{__UINT64_C(0xfd87b5f28300ca0e), -157},
+	{__UINT64_C(0xbce5086492111aeb), -130},
+	{__UINT64_C(0x8cbccc096f5088cc), -103},
+	{__UINT64_C(0xd1b71758e219652c), -77},
+	{__UINT64_C(0x9c40000000000000), -50},
+	{__UINT64_C(0xe8d4a51000000000), -24},
+	{__UINT64_C(0xad78ebc5ac620000), 3},
+	{__UINT64_C(0x813f3978f8940984), 30},
+	{__UINT64_C(0xc097ce7bc90715b3), 56},
+	{__UINT64_C(0x8f7e32ce7bea5c70), 83},
+	{__UINT64_C(0xd5d238a4abe98068), 109},
+	{__UINT64_C(0x9f4f2726179a2245), 136},
+	{__UINT64_C(0xed63a231d4c4fb27), 162},
+	{__UINT64_C(0xb0de65388cc8ada8), 189},
+	{__UINT64_C(0x83c7088e1aab65db), 216},
+	{__UINT64_C(0xc45d1df942711d9a), 242},
+	{__UINT64_C(0x924d692ca61be758), 269},
+	{__UINT64_C(0xda01ee641a708dea), 295},
+	{__UINT64_C(0xa26da3999aef774a), 322},
+	{__UINT64_C(0xf209787bb47d6b85), 348},
+	{__UINT64_C(0xb454e4a179dd1877), 375},
+	{__UINT64_C(0x865b86925b9bc5c2), 402},
+	{__UINT64_C(0xc83553c5c8965d3d), 428},
+	{__UINT64_C(0x952ab45cfa97a0b3), 455},
+	{__UINT64_C(0xde469fbd99a05fe3), 481},
+	{__UINT64_C(0xa59bc234db398c25), 508},
+	{__UINT64_C(0xf6c69a72a3989f5c), 534},
+	{__UINT64_C(0xb7dcbf5354e9bece), 561},
+	{__UINT64_C(0x88fcf317f22241e2), 588},
+	{__UINT64_C(0xcc20ce9bd35c78a5), 614},
+	{__UINT64_C(0x98165af37b2153df), 641},
+	{__UINT64_C(0xe2a0b5dc971f303a), 667},
+	{__UINT64_C(0xa8d9d1535ce3b396), 694},
+	{__UINT64_C(0xfb9b7cd9a4a7443c), 720},
+	{__UINT64_C(0xbb764c4ca7a44410), 747},
+	{__UINT64_C(0x8bab8eefb6409c1a), 774},
+	{__UINT64_C(0xd01fef10a657842c), 800},
+	{__UINT64_C(0x9b10a4e5e9913129), 827},
+	{__UINT64_C(0xe7109bfba19c0c9d), 853},
+	{__UINT64_C(0xac2820d9623bf429), 880},
+	{__UINT64_C(0x80444b5e7aa7cf85), 907},
+	{__UINT64_C(0xbf21e44003acdd2d), 933},
+	{__UINT64_C(0x8e679c2f5e44ff8f), 960},
+	{__UINT64_C(0xd433179d9c8cb841), 986},
+	{__UINT64_C(0x9e19db92b4e31ba9), 1013},
+	{__UINT64_C(0xeb96bf6ebadf77d9), 1039},
+	{__UINT64_C(0xaf87023b9bf0ee6b), 1066}
+};
+
+static diy_fp_t	diy_fp_from_double(double value)
+{
+	diy_fp_t	fp;
+	zbx_uint64_t	u;
+	int		biased_e;
+
+	memcpy(&u, &value, sizeof(u));
+	biased_e = (int)((u & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+	fp.f = u & DP_SIGNIFICAND_MASK;
+
+	if (0 != biased_e)
+	{
+		fp.f += DP_HIDDEN_BIT;
+		fp.e = biased_e - DP_EXPONENT_BIAS;
+	}
+	else
+		fp.e = DP_MIN_EXPONENT + 1;
+
+	return fp;
+}
+
+static diy_fp_t	diy_fp_mul(diy_fp_t x, diy_fp_t y)
+{
+	const zbx_uint64_t	m32 = 0xFFFFFFFF;
+	zbx_uint64_t		a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+	zbx_uint64_t		ac = a * c, bc = b * c, ad = a * d, bd = b * d, tmp;
+	diy_fp_t		r;
+
+	tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+	tmp += 1U << 31;	/* round */
+
+	r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+	r.e = x.e + y.e + 64;
+
+	return r;
+}
+
+static diy_fp_t	diy_fp_normalize(diy_fp_t fp)
+{
+	while (0 == (fp.f & (__UINT64_C(1) << 63)))
+	{
+		fp.f <<= 1;
+		fp.e--;
+	}
+
+	return fp;
+}
+
+static void	diy_fp_boundaries(diy_fp_t v, diy_fp_t *minus, diy_fp_t *plus)
+{
+	diy_fp_t	pl, mi;
+
+	pl.f = (v.f << 1) + 1;
+	pl.e = v.e - 1;
+
+	while (0 == (pl.f & (DP_HIDDEN_BIT << 1)))
+	{
+		pl.f <<= 1;
+		pl.e--;
+	}
+
+	pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+	pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+	if (DP_HIDDEN_BIT == v.f)
+	{
+		mi.f = (v.f << 2) - 1;
+		mi.e = v.e - 2;
+	}
+	else
+	{
+		mi.f = (v.f << 1) - 1;
+		mi.e = v.e - 1;
+	}
+
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+
+	*plus = pl;
+	*minus = mi;
+}
+
+static diy_fp_t	cached_power(int e, int *K)
+{
+	double	dk = (-61 - e) * 0.30102999566398114 + 347;
+	int	k = (int)dk, index;
+
+	if (0.0 < dk - k)
+		k++;
+
+	index = (k >> 3) + 1;
+	*K = -(-348 + index * 8);
+
+	return cached_powers[index];
+}
+
+static void	grisu_round(char *buffer, int len, zbx_uint64_t delta, zbx_uint64_t rest, zbx_uint64_t ten_kappa,
+		zbx_uint64_t wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+			(rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+	{
+		buffer[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int	count_digits32(unsigned int n)
+{
+	int	digits = 1;
+
+	while (n >= 10 && digits < 10)
+	{
+		n /= 10;
+		digits++;
+	}
+
+	return digits;
+}
+
+static void	grisu_digit_gen(diy_fp_t W, diy_fp_t Mp, zbx_uint64_t delta, char *buffer, int *len, int *K)
+{
+	diy_fp_t	one, wp_w;
+	unsigned int	p1;
+	zbx_uint64_t	p2;
+	int		kappa;
+
+	one.f = __UINT64_C(1) << -Mp.e;
+	one.e = Mp.e;
+	wp_w.f = Mp.f - W.f;
+	wp_w.e = Mp.e;
+
+	p1 = (unsigned int)(Mp.f >> -one.e);
+	p2 = Mp.f & (one.f - 1);
+	kappa = count_digits32(p1);
+	*len = 0;
+
+	while (0 < kappa)
+	{
+		unsigned int	d = p1 / (unsigned int)pow10_lut[kappa - 1];
+		zbx_uint64_t	tmp;
+
+		p1 %= (unsigned int)pow10_lut[kappa - 1];
+
+		if (0 != d || 0 != *len)
+			buffer[(*len)++] = (char)('0' + d);
+
+		kappa--;
+		tmp = ((zbx_uint64_t)p1 << -one.e) + p2;
+
+		if (tmp <= delta)
+		{
+			*K += kappa;
+			grisu_round(buffer, *len, delta, tmp, pow10_lut[kappa] << -one.e, wp_w.f);
+			return;
+		}
+	}
+
+	for (;;)
+	{
+		char	d;
+
+		p2 *= 10;
+		delta *= 10;
+		d = (char)(p2 >> -one.e);
+
+		if (0 != d || 0 != *len)
+			buffer[(*len)++] = (char)('0' + d);
+
+		p2 &= one.f - 1;
+		kappa--;
+
+		if (p2 < delta)
+		{
+			*K += kappa;
+			grisu_round(buffer, *len, delta, p2, one.f, wp_w.f * (-kappa < 20 ? pow10_lut[-kappa] : 0));
+			return;
+		}
+	}
+}
+
+static size_t	write_exponent(char *buffer, int K)
+{
+	char	*p = buffer;
+
+	if (0 > K)
+	{
+		*p++ = '-';
+		K = -K;
+	}
+
+	if (100 <= K)
+	{
+		*p++ = (char)('0' + K / 100);
+		K %= 100;
+		*p++ = digits_lut[K * 2];
+		*p++ = digits_lut[K * 2 + 1];
+	}
+	else if (10 <= K)
+	{
+		*p++ = digits_lut[K * 2];
+		*p++ = digits_lut[K * 2 + 1];
+	}
+	else
+		*p++ = (char)('0' + K);
+
+	return (size_t)(p - buffer);
+}
+
+/* turns digits and decimal exponent k (value = digits * 10^k) into a number */
+static size_t	prettify(char *buffer, int length, int k)
+{
+	int	kk = length + k, i;	/* 10^(kk-1) <= v < 10^kk */
+
+	if (length <= kk && kk <= 21)
+	{
+		/* 1234e7 -> 12340000000 */
+		for (i = length; i < kk; i++)
+			buffer[i] = '0';
+
+		return (size_t)kk;
+	}
+
+	if (0 < kk && kk <= 21)
+	{
+		/* 1234e-2 -> 12.34 */
+		memmove(&buffer[kk + 1], &buffer[kk], (size_t)(length - kk));
+		buffer[kk] = '.';
+
+		return (size_t)length + 1;
+	}
+
+	if (-6 < kk && kk <= 0)
+	{
+		/* 1234e-6 -> 0.001234 */
+		int	offset = 2 - kk;
+
+		memmove(&buffer[offset], &buffer[0], (size_t)length);
+		buffer[0] = '0';
+		buffer[1] = '.';
+
+		for (i = 2; i < offset; i++)
+			buffer[i] = '0';
+
+		return (size_t)(length + offset);
+	}
+
+	if (1 == length)
+	{
+		/* 1e30 */
+		buffer[1] = 'e';
+
+		return 2 + write_exponent(&buffer[2], kk - 1);
+	}
+
+	/* 1234e30 -> 1.234e33 */
+	memmove(&buffer[2], &buffer[1], (size_t)(length - 1));
+	buffer[1] = '.';
+	buffer[length + 1] = 'e';
+
+	return (size_t)length + 2 + write_exponent(&buffer[length + 2], kk - 1);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_format_double                                                 *
+ *                                                                            *
+ * Purpose: prints the shortest decimal representation that parses back to   *
+ *          exactly the same double                                           *
+ *                                                                            *
+ * Parameters: buffer - output, at least LP_NUMBER_MAX_LEN bytes              *
+ *             value  - finite value to print                                 *
+ *                                                                            *
+ * Return value: number of bytes written (not zero terminated)                *
+ *                                                                            *
+ ******************************************************************************/
+size_t	lp_format_double(char *buffer, double value)
+{
+	diy_fp_t	v, w_m, w_p, c_mk, W, Wp, Wm;
+	int		length, K;
+	size_t		sign = 0;
+
+	if (0.0 == value)
+	{
+		*buffer = '0';
+		return 1;
+	}
+
+	if (0 > value)
+	{
+		*buffer++ = '-';
+		value = -value;
+		sign = 1;
+	}
+
+	v = diy_fp_from_double(value);
+	diy_fp_boundaries(v, &w_m, &w_p);
+
+	c_mk = cached_power(w_p.e, &K);
+	W = diy_fp_mul(diy_fp_normalize(v), c_mk);
+	Wp = diy_fp_mul(w_p, c_mk);
+	Wm = diy_fp_mul(w_m, c_mk);
+	Wm.f++;
+	Wp.f--;
+
+	grisu_digit_gen(W, Wp, Wp.f - Wm.f, buffer, &length, &K);
+
+	return sign + prettify(buffer, length, K);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_format_uint64                                                 *
+ *                                                                            *
+ * Return value: number of bytes written (not zero terminated)                *
+ *                                                                            *
+ ******************************************************************************/
+size_t	lp_format_uint64(char *buffer, zbx_uint64_t value)
+{
+	size_t	len = 1, i;
+
+	while (len < 20 && value >= pow10_lut[len])
+		len++;
+
+	i = len;
+
+	while (100 <= value)
+	{
+		unsigned int	d = (unsigned int)(value % 100) * 2;
+
+		value /= 100;
+		buffer[--i] = digits_lut[d + 1];
+		buffer[--i] = digits_lut[d];
+	}
+
+	if (10 <= value)
+	{
+		buffer[--i] = digits_lut[value * 2 + 1];
+		buffer[--i] = digits_lut[value * 2];
+	}
+	else
+		buffer[--i] = (char)('0' + value);
+
+	return len;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_format_int64                                                  *
+ *                                                                            *
+ ******************************************************************************/
+size_t	lp_format_int64(char *buffer, zbx_int64_t value)
+{
+	if (0 > value)
+	{
+		*buffer = '-';
+		return 1 + lp_format_uint64(buffer + 1, -(zbx_uint64_t)value);
+	}
+
+	return lp_format_uint64(buffer, (zbx_uint64_t)value);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_format_timestamp                                              *
+ *                                                                            *
+ * Purpose: prints clock and nanoseconds as a timestamp of given precision,   *
+ *          the nanoseconds are truncated                                     *
+ *                                                                            *
+ * Parameters: precision - one of LP_PRECISION_* (number of sub-second digits)*
+ *                                                                            *
+ ******************************************************************************/
+size_t	lp_format_timestamp(char *buffer, int clock, int ns, int precision)
+{
+	size_t		len;
+	unsigned int	n = (unsigned int)ns / (unsigned int)pow10_lut[LP_PRECISION_NS - precision];
+	int		i;
+
+	/* nothing to pad before the epoch second is over */
+	if (0 == clock)
+		return lp_format_uint64(buffer, n);
+
+	len = lp_format_int64(buffer, clock);
+	buffer += len;
+
+	for (i = precision; 1 < i; i -= 2)
+	{
+		unsigned int	d = (n % 100) * 2;
+
+		n /= 100;
+		buffer[i - 1] = digits_lut[d + 1];
+		buffer[i - 2] = digits_lut[d];
+	}
+
+	if (1 == i)
+		buffer[0] = (char)('0' + n % 10);
+
+	return len + (size_t)precision;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Functions: lp_append_double                                                *
+ *            lp_append_uint64                                                *
+ *            lp_append_int64                                                 *
+ *            lp_append_timestamp                                             *
+ *                                                                            *
+ * Purpose: format directly at the end of the line buffer                     *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the value cannot be represented in line   *
+ *               protocol (NaN and infinity)                                  *
+ *                                                                            *
+ ******************************************************************************/
+int	lp_append_double(line_buffer_t *buf, double value)
+{
+	if (0 == isfinite(value))
+		return FAIL;
+
+	line_buffer_commit(buf, lp_format_double(line_buffer_reserve(buf, LP_NUMBER_MAX_LEN), value));
+
+	return SUCCEED;
+}
+
+void	lp_append_uint64(line_buffer_t *buf, zbx_uint64_t value)
+{
+	line_buffer_commit(buf, lp_format_uint64(line_buffer_reserve(buf, LP_NUMBER_MAX_LEN), value));
+}
+
+void	lp_append_int64(line_buffer_t *buf, zbx_int64_t value)
+{
+	line_buffer_commit(buf, lp_format_int64(line_buffer_reserve(buf, LP_NUMBER_MAX_LEN), value));
+}
+
+void	lp_append_timestamp(line_buffer_t *buf, int clock, int ns, int precision)
+{
+	line_buffer_commit(buf, lp_format_timestamp(line_buffer_reserve(buf, LP_NUMBER_MAX_LEN), clock, ns, precision));
+}
+
+static void	lp_special_init(lp_special_t *special, const char *chars)
+{
+	unsigned char	c;
+
+	memset(special, 0, sizeof(lp_special_t));
+
+	for (; '\0' != (c = (unsigned char)*chars) && LP_SPECIAL_MAX > special->num; chars++)
+	{
+		special->bits[c >> 6] |= __UINT64_C(1) << (c & 63);
+		special->chars[special->num++] = (char)c;
+	}
+}
+
+/* returns the first special character in [p, end) or end */
+static const char	*lp_scan_scalar(const char *p, const char *end, const lp_special_t *special)
+{
+	unsigned char	c;
+
+	for (; p < end; p++)
+	{
+		if (128 > (c = (unsigned char)*p) && 0 != (special->bits[c >> 6] & (__UINT64_C(1) << (c & 63))))
+			break;
+	}
+
+	return p;
+}
+
+#ifdef LP_SCAN_X86
+static const char	*lp_scan_sse2(const char *p, const char *end, const lp_special_t *special)
+{
+	__m128i	chars[LP_SPECIAL_MAX], block, match;
+	int	i, mask;
+
+	if (0 == special->num)
+		return end;
+
+	for (i = 0; i < special->num; i++)
+		chars[i] = _mm_set1_epi8(special->chars[i]);
+
+	for (; 16 <= end - p; p += 16)
+	{
+		block = _mm_loadu_si128((const __m128i *)p);
+		match = _mm_cmpeq_epi8(block, chars[0]);
+
+		for (i = 1; i < special->num; i++)
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(block, chars[i]));
+
+		if (0 != (mask = _mm_movemask_epi8(match)))
+			return p + __builtin_ctz((unsigned int)mask);
+	}
+
+	return lp_scan_scalar(p, end, special);
+}
+
+__attribute__((target("avx2")))
+static const char	*lp_scan_avx2(const char *p, const char *end, const lp_special_t *special)
+{
+	__m256i		chars[LP_SPECIAL_MAX], block, match;
+	unsigned int	mask;
+	int		i;
+
+	if (0 == special->num)
+		return end;
+
+	for (i = 0; i < special->num; i++)
+		chars[i] = _mm256_set1_epi8(special->chars[i]);
+
+	for (; 32 <= end - p; p += 32)
+	{
+		block = _mm256_loadu_si256((const __m256i *)p);
+		match = _mm256_cmpeq_epi8(block, chars[0]);
+
+		for (i = 1; i < special->num; i++)
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, chars[i]));
+
+		if (0 != (mask = (unsigned int)_mm256_movemask_epi8(match)))
+			return p + __builtin_ctz(mask);
+	}
+
+	return lp_scan_sse2(p, end, special);
+}
+#endif
+
+static const char	*lp_scan_resolve(const char *p, const char *end, const lp_special_t *special);
+
+/* the best kernel for this CPU once the first call picked it */
+static lp_scan_func_t	lp_scan = lp_scan_resolve;
+
+static const char	*lp_scan_resolve(const char *p, const char *end, const lp_special_t *special)
+{
+#ifdef LP_SCAN_X86
+	__builtin_cpu_init();
+	lp_scan = (__builtin_cpu_supports("avx2") ? lp_scan_avx2 : lp_scan_sse2);
+#else
+	lp_scan = lp_scan_scalar;
+#endif
+	return lp_scan(p, end, special);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_append_escaped                                                *
+ *                                                                            *
+ * Purpose: appends len bytes of str with backslash before each of the        *
+ *          special characters (LP_ESCAPE_MEASUREMENT, LP_ESCAPE_TAG)         *
+ *                                                                            *
+ ******************************************************************************/
+void	lp_append_escaped(line_buffer_t *buf, const char *str, size_t len, const char *special)
+{
+	const char	*end = str + len, *p;
+	char		*out, *start;
+	lp_special_t	set;
+
+	lp_special_init(&set, special);
+
+	/* nothing to escape, the common case */
+	if (end == (p = lp_scan(str, end, &set)))
+	{
+		line_buffer_append(buf, str, len);
+		return;
+	}
+
+	start = out = line_buffer_reserve(buf, len * 2);
+
+	for (; p < end; p = lp_scan(p + 1, end, &set))
+	{
+		memcpy(out, str, (size_t)(p - str));
+		out += p - str;
+		*out++ = '\\';
+		*out++ = *p;
+		str = p + 1;
+	}
+
+	memcpy(out, str, (size_t)(end - str));
+	out += end - str;
+	line_buffer_commit(buf, (size_t)(out - start));
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_append_string                                                 *
+ *                                                                            *
+ * Purpose: appends a string field value in double quotes, with '"' and '\'   *
+ *          escaped, newlines are kept                                        *
+ *                                                                            *
+ * Parameters: buf     - the buffer                                           *
+ *             str     - the value                                            *
+ *             max_len - bytes of the value written at most, 0 - no limit     *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the value was truncated                   *
+ *                                                                            *
+ * Comment: a value is truncated at a UTF-8 character boundary                *
+ *                                                                            *
+ ******************************************************************************/
+int	lp_append_string(line_buffer_t *buf, const char *str, size_t max_len)
+{
+	const char	*end, *p;
+	char		*out, *start;
+	size_t		len;
+	int		ret = SUCCEED;
+	lp_special_t	set;
+
+	len = (0 == max_len ? strlen(str) : strnlen(str, max_len + 1));
+
+	if (0 != max_len && len > max_len)
+	{
+		/* do not leave the lead bytes of a character without its continuation bytes */
+		for (len = max_len; 0 < len && 0x80 == ((unsigned char)str[len] & 0xc0); len--)
+			;
+
+		ret = FAIL;
+	}
+
+	start = out = line_buffer_reserve(buf, len * 2 + 2);
+	*out++ = '"';
+	lp_special_init(&set, "\"\\");
+
+	for (end = str + len, p = lp_scan(str, end, &set); p < end; p = lp_scan(p + 1, end, &set))
+	{
+		memcpy(out, str, (size_t)(p - str));
+		out += p - str;
+		*out++ = '\\';
+		*out++ = *p;
+		str = p + 1;
+	}
+
+	memcpy(out, str, (size_t)(end - str));
+	out += end - str;
+	*out++ = '"';
+	line_buffer_commit(buf, (size_t)(out - start));
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: lp_line_end                                                      *
+ *                                                                            *
+ * Purpose: finds the newline ending a line, skipping newlines inside string  *
+ *          field values                                                      *
+ *                                                                            *
+ * Parameters: line - start of the line                                       *
+ *             end  - end of the payload                                      *
+ *                                                                            *
+ * Return value: the newline or NULL if the line runs to the end              *
+ *                                                                            *
+ * Comment: a '"' only starts a string right after the '=' of a field, in     *
+ *          names and tags (e.g. item keys) it is an ordinary character       *
+ *                                                                            *
+ ******************************************************************************/
+const char	*lp_line_end(const char *line, const char *end)
+{
+	const char	*p;
+	int		fields = 0, value = 0, quoted = 0;
+
+	for (p = line; p < end; p++)
+	{
+		if (0 != quoted)
+		{
+			if ('\\' == *p && p + 1 < end)
+				p++;
+			else if ('"' == *p)
+				quoted = 0;
+
+			continue;
+		}
+
+		switch (*p)
+		{
+			case '\\':
+				if (p + 1 < end)
+					p++;
+				break;
+			case '\n':
+				return p;
+			case ' ':
+				fields = 1;
+				break;
+			case '=':
+				if (0 != fields)
+				{
+					value = 1;
+					continue;
+				}
+				break;
+			case '"':
+				quoted = value;
+				break;
+		}
+
+		value = 0;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef __ZABBIX_LP_FORMAT_H
+#define __ZABBIX_LP_FORMAT_H
+
+
+#include "common.h"
+#include "line_buffer.h"
+
+/* longest number any of the formatters below can produce */
+#define LP_NUMBER_MAX_LEN 32
+
+/* timestamp precision, as number of sub-second digits */
+#define LP_PRECISION_S  0
+#define LP_PRECISION_MS 3
+#define LP_PRECISION_US 6
+#define LP_PRECISION_NS 9
+
+/* characters escaped with a backslash in each part of a line */
+#define LP_ESCAPE_MEASUREMENT	", "
+#define LP_ESCAPE_TAG		",= "
+#define LP_ESCAPE_FIELD_KEY	",= "
+
+extern size_t lp_format_double(char *buffer, double value);
+extern size_t lp_format_uint64(char *buffer, zbx_uint64_t value);
+extern size_t lp_format_int64(char *buffer, zbx_int64_t value);
+extern size_t lp_format_timestamp(char *buffer, int clock, int ns, int precision);
+
+extern int lp_append_double(line_buffer_t *buf, double value);
+extern void lp_append_uint64(line_buffer_t *buf, zbx_uint64_t value);
+extern void lp_append_int64(line_buffer_t *buf, zbx_int64_t value);
+extern void lp_append_timestamp(line_buffer_t *buf, int clock, int ns, int precision);
+
+extern void lp_append_escaped(line_buffer_t *buf, const char *str, size_t len, const char *special);
+extern int lp_append_string(line_buffer_t *buf, const char *str, size_t max_len);
+
+extern const char *lp_line_end(const char *line, const char *end);
+
+
+#endif /* __ZABBIX_LP_FORMAT_H */
@@ -0,0 +1,381 @@
+// self-monitoring of the module, read by Zabbix through the module item keys
+// 1] the statistics live in an anonymous shared mapping created in zbx_module_init,
+//    so the pollers serving influxdb.module.* items see what the history syncers did
+// 2] every process claims a slot of its own on first use and only ever adds to it
+//    with relaxed atomics (threads of the process share the slot), there is no lock
+//    on the hot path and no cache line bouncing between syncers
+// 3] readers sum all slots, counters only grow so Zabbix can take the change per
+//    second, gauges (queue depth) are set by each process in its slot and summed too
+// 4] latencies go to histograms of power of two microsecond buckets, percentiles are
+//    interpolated within the bucket they fall into
+//
+// Should more processes than MODULE_STATS_SLOTS record statistics, the rest share the
+// last slot, counters stay right but gauges of those processes overwrite each other.
+
+#include "load_config.h"
+#include "module_stats.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define MODULE_STATS_SLOTS	1024
+#define MODULE_STATS_BUCKETS	32
+
+typedef struct
+{
+	zbx_uint64_t	buckets[MODULE_STATS_BUCKETS];	/* [2^(n-1), 2^n) us, first is [0, 1) */
+	zbx_uint64_t	count;
+	zbx_uint64_t	sum;				/* us */
+}
+module_stats_histogram_t;
+
+typedef struct
+{
+	pid_t				pid;
+	zbx_uint64_t			values[MODULE_STATS_SLOT_NUM];
+	module_stats_histogram_t	latency[MODULE_STATS_LATENCY_NUM];
+}
+module_stats_slot_t;
+
+typedef struct
+{
+	int		slots_used;
+	zbx_uint64_t	values[MODULE_STATS_NUM];	/* only the shared gauges are used */
+	module_stats_slot_t	slots[MODULE_STATS_SLOTS];
+}
+module_stats_t;
+
+static module_stats_t		*stats = NULL;
+
+static module_stats_slot_t	*stats_slot = NULL;
+static pid_t			stats_slot_pid = 0;
+static pthread_mutex_t		stats_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* item key parameters, in the order of MODULE_STATS_* */
+static const char	*stats_names[MODULE_STATS_NUM] =
+{
+	"values", "lines", "bytes", "writes", "write_failures", "retries", "http_2xx", "http_4xx", "http_5xx",
+	"http_errors", "cache_hits", "cache_misses", "db_lookups", "db_items", "queue_dropped", "spooled",
+	"spool_dropped", "filtered", "suppressed", "rollups", "coalesced", "truncated", "udp_dropped", "ring_overflows",
+	"queue_batches", "queue_bytes", "spool_bytes", "ring_bytes"
+};
+
+static const char	*latency_names[MODULE_STATS_LATENCY_NUM] = {"write", "db"};
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_init                                                *
+ *                                                                            *
+ * Purpose: maps the statistics, must be called before any process is forked  *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if the mapping cannot be created             *
+ *                                                                            *
+ ******************************************************************************/
+int	module_stats_init(void)
+{
+	if (MAP_FAILED == (stats = (module_stats_t *)mmap(NULL, sizeof(module_stats_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot map %zu bytes of shared memory for statistics: %s",
+				MODULE_NAME, sizeof(module_stats_t), zbx_strerror(errno));
+		stats = NULL;
+		return FAIL;
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_destroy                                             *
+ *                                                                            *
+ ******************************************************************************/
+void	module_stats_destroy(void)
+{
+	if (NULL == stats)
+		return;
+
+	munmap(stats, sizeof(module_stats_t));
+	stats = NULL;
+	stats_slot = NULL;
+	stats_slot_pid = 0;
+}
+
+/* returns the slot of the calling process, claiming one on first use */
+static module_stats_slot_t	*module_stats_slot(void)
+{
+	pid_t	pid = getpid();
+	int	i;
+
+	if (__atomic_load_n(&stats_slot_pid, __ATOMIC_ACQUIRE) == pid)
+		return stats_slot;
+
+	pthread_mutex_lock(&stats_slot_lock);
+
+	if (stats_slot_pid != pid)
+	{
+		if (MODULE_STATS_SLOTS <= (i = __atomic_fetch_add(&stats->slots_used, 1, __ATOMIC_RELAXED)))
+			i = MODULE_STATS_SLOTS - 1;
+
+		stats_slot = &stats->slots[i];
+		stats_slot->pid = pid;
+		__atomic_store_n(&stats_slot_pid, pid, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&stats_slot_lock);
+
+	return stats_slot;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_add                                                 *
+ *                                                                            *
+ * Purpose: adds to a counter of the calling process                          *
+ *                                                                            *
+ ******************************************************************************/
+void	module_stats_add(int stat, zbx_uint64_t value)
+{
+	if (NULL == stats || 0 == value)
+		return;
+
+	__atomic_fetch_add(&module_stats_slot()->values[stat], value, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_set                                                 *
+ *                                                                            *
+ * Purpose: sets a gauge of the calling process (or the shared one)           *
+ *                                                                            *
+ ******************************************************************************/
+void	module_stats_set(int stat, zbx_uint64_t value)
+{
+	if (NULL == stats)
+		return;
+
+	if (MODULE_STATS_SLOT_NUM <= stat)
+		__atomic_store_n(&stats->values[stat], value, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n(&module_stats_slot()->values[stat], value, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_latency                                             *
+ *                                                                            *
+ * Purpose: records a duration in a latency histogram                         *
+ *                                                                            *
+ * Parameters: latency - MODULE_STATS_*_LATENCY                               *
+ *             us      - duration in microseconds                             *
+ *                                                                            *
+ ******************************************************************************/
+void	module_stats_latency(int latency, zbx_uint64_t us)
+{
+	module_stats_histogram_t	*histogram;
+	int				bucket = 0;
+
+	if (NULL == stats)
+		return;
+
+	if (0 != us)
+		bucket = MIN(64 - __builtin_clzll(us), MODULE_STATS_BUCKETS - 1);
+
+	histogram = &module_stats_slot()->latency[latency];
+	__atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->sum, us, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_clock_us                                            *
+ *                                                                            *
+ * Purpose: returns monotonic time in microseconds to measure latencies with  *
+ *                                                                            *
+ ******************************************************************************/
+zbx_uint64_t	module_stats_clock_us(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (zbx_uint64_t)ts.tv_sec * 1000000 + (zbx_uint64_t)ts.tv_nsec / 1000;
+}
+
+static zbx_uint64_t	module_stats_sum(int stat)
+{
+	zbx_uint64_t	sum = 0;
+	int		i, slots_used;
+
+	if (MODULE_STATS_SLOT_NUM <= stat)
+		return __atomic_load_n(&stats->values[stat], __ATOMIC_RELAXED);
+
+	slots_used = MIN(__atomic_load_n(&stats->slots_used, __ATOMIC_RELAXED), MODULE_STATS_SLOTS);
+
+	for (i = 0; i < slots_used; i++)
+		sum += __atomic_load_n(&stats->slots[i].values[stat], __ATOMIC_RELAXED);
+
+	return sum;
+}
+
+static void	module_stats_histogram_sum(int latency, module_stats_histogram_t *histogram)
+{
+	const module_stats_histogram_t	*slot_histogram;
+	int				i, b, slots_used;
+
+	memset(histogram, 0, sizeof(module_stats_histogram_t));
+	slots_used = MIN(__atomic_load_n(&stats->slots_used, __ATOMIC_RELAXED), MODULE_STATS_SLOTS);
+
+	for (i = 0; i < slots_used; i++)
+	{
+		slot_histogram = &stats->slots[i].latency[latency];
+
+		for (b = 0; b < MODULE_STATS_BUCKETS; b++)
+			histogram->buckets[b] += __atomic_load_n(&slot_histogram->buckets[b], __ATOMIC_RELAXED);
+
+		histogram->sum += __atomic_load_n(&slot_histogram->sum, __ATOMIC_RELAXED);
+	}
+
+	/* counted from the buckets, so that it matches them even while being updated */
+	for (b = 0; b < MODULE_STATS_BUCKETS; b++)
+		histogram->count += histogram->buckets[b];
+}
+
+/* returns the duration in microseconds below which percentile % of the samples are */
+static double	module_stats_percentile(const module_stats_histogram_t *histogram, double percentile)
+{
+	double		target = histogram->count * percentile / 100, lower, upper;
+	zbx_uint64_t	cumulative = 0;
+	int		b;
+
+	for (b = 0; b < MODULE_STATS_BUCKETS; b++)
+	{
+		if (0 == histogram->buckets[b])
+			continue;
+
+		if (cumulative + histogram->buckets[b] >= target)
+		{
+			lower = (0 == b ? 0 : (double)((zbx_uint64_t)1 << (b - 1)));
+			upper = (double)((zbx_uint64_t)1 << b);
+
+			return lower + (upper - lower) * (target - cumulative) / histogram->buckets[b];
+		}
+
+		cumulative += histogram->buckets[b];
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_item                                                *
+ *                                                                            *
+ * Purpose: influxdb.module.stats[<name>] - a counter or gauge summed over    *
+ *          all processes, or cache_hit_ratio in %                            *
+ *                                                                            *
+ ******************************************************************************/
+int	module_stats_item(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	const char	*name;
+	zbx_uint64_t	hits, lookups;
+	int		stat;
+
+	if (NULL == stats)
+	{
+		SET_MSG_RESULT(result, zbx_strdup(NULL, "Statistics are not available."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (1 != request->nparam || NULL == (name = get_rparam(request, 0)))
+	{
+		SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid number of parameters."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (0 == strcmp(name, "cache_hit_ratio"))
+	{
+		hits = module_stats_sum(MODULE_STATS_CACHE_HITS);
+		lookups = hits + module_stats_sum(MODULE_STATS_CACHE_MISSES);
+		SET_DBL_RESULT(result, 0 == lookups ? 0 : 100.0 * hits / lookups);
+		return SYSINFO_RET_OK;
+	}
+
+	for (stat = 0; stat < MODULE_STATS_NUM; stat++)
+	{
+		if (0 == strcmp(name, stats_names[stat]))
+		{
+			SET_UI64_RESULT(result, module_stats_sum(stat));
+			return SYSINFO_RET_OK;
+		}
+	}
+
+	SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Unknown statistic \"%s\".", name));
+
+	return SYSINFO_RET_FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: module_stats_latency_item                                        *
+ *                                                                            *
+ * Purpose: influxdb.module.latency[<write|db>,<avg|percentile>] - average    *
+ *          or percentile latency in milliseconds over all processes since    *
+ *          startup                                                           *
+ *                                                                            *
+ ******************************************************************************/
+int	module_stats_latency_item(AGENT_REQUEST *request, AGENT_RESULT *result)
+{
+	module_stats_histogram_t	histogram;
+	const char			*name, *mode;
+	char				*end;
+	double				percentile;
+	int				latency;
+
+	if (NULL == stats)
+	{
+		SET_MSG_RESULT(result, zbx_strdup(NULL, "Statistics are not available."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	if (1 > request->nparam || 2 < request->nparam)
+	{
+		SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid number of parameters."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	name = get_rparam(request, 0);
+
+	for (latency = 0; latency < MODULE_STATS_LATENCY_NUM; latency++)
+	{
+		if (0 == strcmp(name, latency_names[latency]))
+			break;
+	}
+
+	if (MODULE_STATS_LATENCY_NUM == latency)
+	{
+		SET_MSG_RESULT(result, zbx_dsprintf(NULL, "Unknown latency \"%s\".", name));
+		return SYSINFO_RET_FAIL;
+	}
+
+	module_stats_histogram_sum(latency, &histogram);
+
+	if (NULL == (mode = get_rparam(request, 1)) || '\0' == *mode || 0 == strcmp(mode, "avg"))
+	{
+		SET_DBL_RESULT(result, 0 == histogram.count ? 0 : (double)histogram.sum / histogram.count / 1000);
+		return SYSINFO_RET_OK;
+	}
+
+	percentile = strtod(mode, &end);
+
+	if (end == mode || '\0' != *end || 0 > percentile || 100 < percentile)
+	{
+		SET_MSG_RESULT(result, zbx_strdup(NULL, "Invalid second parameter, expected avg or a percentile."));
+		return SYSINFO_RET_FAIL;
+	}
+
+	SET_DBL_RESULT(result, module_stats_percentile(&histogram, percentile) / 1000);
+
+	return SYSINFO_RET_OK;
+}
@@ -0,0 +1,59 @@
+#ifndef __ZABBIX_MODULE_STATS_H
+#define __ZABBIX_MODULE_STATS_H
+
+
+#include "common.h"
+#include "module.h"
+
+/* counters, added to by every process in its own slot */
+#define MODULE_STATS_VALUES		0
+#define MODULE_STATS_LINES		1
+#define MODULE_STATS_BYTES		2
+#define MODULE_STATS_WRITES		3
+#define MODULE_STATS_WRITE_FAILURES	4
+#define MODULE_STATS_RETRIES		5
+#define MODULE_STATS_HTTP_2XX		6
+#define MODULE_STATS_HTTP_4XX		7
+#define MODULE_STATS_HTTP_5XX		8
+#define MODULE_STATS_HTTP_ERRORS	9
+#define MODULE_STATS_CACHE_HITS		10
+#define MODULE_STATS_CACHE_MISSES	11
+#define MODULE_STATS_DB_LOOKUPS		12
+#define MODULE_STATS_DB_ITEMS		13
+#define MODULE_STATS_QUEUE_DROPPED	14
+#define MODULE_STATS_SPOOLED		15
+#define MODULE_STATS_SPOOL_DROPPED	16
+#define MODULE_STATS_FILTERED		17
+#define MODULE_STATS_SUPPRESSED		18
+#define MODULE_STATS_ROLLUPS		19
+#define MODULE_STATS_COALESCED		20
+#define MODULE_STATS_TRUNCATED		21
+#define MODULE_STATS_UDP_DROPPED	22
+#define MODULE_STATS_RING_OVERFLOWS	23
+/* gauges, set by every process in its own slot and summed */
+#define MODULE_STATS_QUEUE_BATCHES	24
+#define MODULE_STATS_QUEUE_BYTES	25
+#define MODULE_STATS_SLOT_NUM		26
+/* gauges of state shared by all processes, the last value set counts */
+#define MODULE_STATS_SPOOL_BYTES	26
+#define MODULE_STATS_RING_BYTES		27
+#define MODULE_STATS_NUM		28
+
+/* latency histograms */
+#define MODULE_STATS_WRITE_LATENCY	0
+#define MODULE_STATS_DB_LATENCY		1
+#define MODULE_STATS_LATENCY_NUM	2
+
+extern int module_stats_init(void);
+extern void module_stats_destroy(void);
+
+extern void module_stats_add(int stat, zbx_uint64_t value);
+extern void module_stats_set(int stat, zbx_uint64_t value);
+extern void module_stats_latency(int latency, zbx_uint64_t us);
+extern zbx_uint64_t module_stats_clock_us(void);
+
+extern int module_stats_item(AGENT_REQUEST *request, AGENT_RESULT *result);
+extern int module_stats_latency_item(AGENT_REQUEST *request, AGENT_RESULT *result);
+
+
+#endif /* __ZABBIX_MODULE_STATS_H */
@@ -0,0 +1,506 @@
+// downsampling of float and integer items to min, max, mean and count per time window
+// 1] RollupWindows lists window lengths, windows are aligned to the Unix epoch
+//    (a 5m window starts at :00, :05, ...), every exported float and integer
+//    value is added to the current window of each length, whether or not a
+//    DeadbandRule leaves it out
+// 2] a window is closed by the first value of the item in a later window, its
+//    point is then appended to the batch being built, so it is written, queued
+//    and spooled with the lines of the values; a window of an item that stops
+//    reporting is not written, nor are open windows at shutdown
+// 3] points go to the measurement of the item followed by RollupMeasurementSuffix,
+//    with the tags of the item and window=<length>, stamped with the window start:
+//    CPU\ load_rollup,host_name=db1,window=5m min=0.1,max=2.3,mean=0.72,count=30i 1700000100
+//    with InfluxDBSchema=host the fields are named after the field of the values:
+//    zabbix_rollup,host_name=db1,window=5m system.cpu.load_min=0.1,... 1700000100
+// 4] the running aggregates are kept per itemid in one shared open addressing
+//    table (linear probing, at most half full), created before the history
+//    syncers are forked, Zabbix hands an item to any of them and a window must
+//    collect the values from all of them
+//
+// An item is processed by one history syncer at a time, so its slot has a single
+// writer and no lock is needed, new slots are claimed with compare-and-swap.
+// When the table is full values of items without a slot are not rolled up.
+
+#include "load_config.h"
+#include "rollup.h"
+#include "lp_format.h"
+#include "zbxalgo.h"
+
+#include <math.h>
+#include <sys/mman.h>
+
+#define ROLLUP_FLOAT	1
+#define ROLLUP_INTEGER	2
+
+typedef struct
+{
+	zbx_uint64_t	itemid;		/* 0 - free slot */
+	unsigned char	type;		/* ROLLUP_* of the values, 0 - none yet */
+}
+rollup_slot_t;
+
+/* running aggregate, windows_num of them per slot */
+typedef struct
+{
+	zbx_uint64_t	min;		/* double or integer bits */
+	zbx_uint64_t	max;
+	double		sum;
+	int		start;
+	unsigned int	count;		/* 0 - no values */
+}
+rollup_window_t;
+
+typedef struct
+{
+	int		entries;
+	int		entries_max;
+	zbx_uint64_t	mask;
+}
+rollup_shm_t;
+
+static int		windows[ROLLUP_WINDOWS_MAX];
+static char		*window_tags[ROLLUP_WINDOWS_MAX];	/* ",window=5m" */
+static int		windows_num = 0;
+static line_buffer_t	suffix;					/* escaped RollupMeasurementSuffix */
+
+static rollup_shm_t	*shm = NULL;
+static size_t		shm_size = 0;
+static rollup_slot_t	*slots = NULL;
+static rollup_window_t	*aggregates = NULL;			/* windows_num per slot */
+
+/* parses a window length in seconds or with one of the s, m, h, d suffixes */
+static int	rollup_parse_window(const char *window, size_t len, int *seconds)
+{
+	static const char	suffixes[] = "smhd";
+	static const int	multipliers[] = {1, SEC_PER_MIN, SEC_PER_HOUR, SEC_PER_DAY};
+	const char		*end = window + len, *p;
+	zbx_uint64_t		value = 0;
+	int			multiplier = 1;
+
+	for (p = window; p < end && 0 != isdigit((unsigned char)*p); p++)
+	{
+		if ((value = value * 10 + (zbx_uint64_t)(*p - '0')) > ROLLUP_WINDOW_MAX)
+			return FAIL;
+	}
+
+	if (p == window)
+		return FAIL;
+
+	if (p < end)
+	{
+		if (p + 1 != end || NULL == strchr(suffixes, *p) || '\0' == *p)
+			return FAIL;
+
+		multiplier = multipliers[strchr(suffixes, *p) - suffixes];
+	}
+
+	if (0 == value || value * (zbx_uint64_t)multiplier > ROLLUP_WINDOW_MAX)
+		return FAIL;
+
+	*seconds = (int)value * multiplier;
+
+	return SUCCEED;
+}
+
+/* formats the window tag with the largest unit the length is a multiple of */
+static char	*rollup_window_tag(int seconds)
+{
+	if (0 == seconds % SEC_PER_DAY)
+		return zbx_dsprintf(NULL, ",window=%dd", seconds / SEC_PER_DAY);
+
+	if (0 == seconds % SEC_PER_HOUR)
+		return zbx_dsprintf(NULL, ",window=%dh", seconds / SEC_PER_HOUR);
+
+	if (0 == seconds % SEC_PER_MIN)
+		return zbx_dsprintf(NULL, ",window=%dm", seconds / SEC_PER_MIN);
+
+	return zbx_dsprintf(NULL, ",window=%ds", seconds);
+}
+
+static int	rollup_parse_windows(const char *list, char **error)
+{
+	const char	*p, *sep, *end;
+	int		seconds, i;
+
+	for (p = list; '\0' != *p; p = ('\0' == *sep ? sep : sep + 1))
+	{
+		p += strspn(p, " ");
+		sep = p + strcspn(p, ",");
+
+		for (end = sep; end > p && ' ' == end[-1]; end--)
+			;
+
+		if (SUCCEED != rollup_parse_window(p, (size_t)(end - p), &seconds))
+		{
+			*error = zbx_dsprintf(*error, "invalid RollupWindows \"%s\": expected window lengths of 1s to 7d"
+					" separated by ',', in seconds or with one of the s, m, h, d suffixes", list);
+			return FAIL;
+		}
+
+		for (i = 0; i < windows_num && seconds != windows[i]; i++)
+			;
+
+		if (i != windows_num)
+		{
+			*error = zbx_dsprintf(*error, "invalid RollupWindows \"%s\": window %.*s is listed twice", list,
+					(int)(end - p), p);
+			return FAIL;
+		}
+
+		if (ROLLUP_WINDOWS_MAX == windows_num)
+		{
+			*error = zbx_dsprintf(*error, "invalid RollupWindows \"%s\": at most %d windows can be used", list,
+					ROLLUP_WINDOWS_MAX);
+			return FAIL;
+		}
+
+		window_tags[windows_num] = rollup_window_tag(seconds);
+		windows[windows_num++] = seconds;
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_init                                                      *
+ *                                                                            *
+ * Purpose: parses RollupWindows and maps the table of running aggregates if  *
+ *          any windows are set, must be called before any process is forked  *
+ *                                                                            *
+ * Parameters: error - the error message of invalid windows                   *
+ *                                                                            *
+ * Return value: SUCCEED or FAIL if RollupWindows is invalid or the table     *
+ *               cannot be mapped                                             *
+ *                                                                            *
+ ******************************************************************************/
+int	rollup_init(char **error)
+{
+	zbx_uint64_t	capacity = 1;
+
+	if (NULL == CONFIG_ROLLUP_WINDOWS)
+		return SUCCEED;
+
+	if (SUCCEED != rollup_parse_windows(CONFIG_ROLLUP_WINDOWS, error))
+		return FAIL;
+
+	if (0 == windows_num)
+		return SUCCEED;
+
+	lp_append_escaped(&suffix, CONFIG_ROLLUP_MEASUREMENT_SUFFIX, strlen(CONFIG_ROLLUP_MEASUREMENT_SUFFIX),
+			LP_ESCAPE_MEASUREMENT);
+
+	while (capacity < (zbx_uint64_t)CONFIG_ROLLUP_SIZE * 2)
+		capacity *= 2;
+
+	shm_size = sizeof(rollup_shm_t) + capacity * (sizeof(rollup_slot_t) + windows_num * sizeof(rollup_window_t));
+
+	if (MAP_FAILED == (shm = (rollup_shm_t *)mmap(NULL, shm_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+	{
+		*error = zbx_dsprintf(*error, "cannot map " ZBX_FS_UI64 " bytes of shared memory for RollupSize %d: %s",
+				(zbx_uint64_t)shm_size, CONFIG_ROLLUP_SIZE, zbx_strerror(errno));
+		shm = NULL;
+		return FAIL;
+	}
+
+	slots = (rollup_slot_t *)(shm + 1);
+	aggregates = (rollup_window_t *)(slots + capacity);
+	shm->entries_max = CONFIG_ROLLUP_SIZE;
+	shm->mask = capacity - 1;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_destroy                                                   *
+ *                                                                            *
+ ******************************************************************************/
+void	rollup_destroy(void)
+{
+	int	i;
+
+	if (NULL != shm)
+	{
+		munmap(shm, shm_size);
+		shm = NULL;
+		slots = NULL;
+		aggregates = NULL;
+	}
+
+	for (i = 0; i < windows_num; i++)
+		zbx_free(window_tags[i]);
+
+	windows_num = 0;
+	line_buffer_free(&suffix);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_windows_num                                               *
+ *                                                                            *
+ * Return value: number of windows, 0 - nothing is rolled up                  *
+ *                                                                            *
+ ******************************************************************************/
+int	rollup_windows_num(void)
+{
+	return windows_num;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_windows_names                                             *
+ *                                                                            *
+ * Return value: window lengths separated by ", ", to be freed by the caller  *
+ *                                                                            *
+ ******************************************************************************/
+char	*rollup_windows_names(void)
+{
+	char	*names = NULL;
+	size_t	names_alloc = 0, names_offset = 0;
+	int	i;
+
+	for (i = 0; i < windows_num; i++)
+	{
+		zbx_snprintf_alloc(&names, &names_alloc, &names_offset, "%s%s", 0 == i ? "" : ", ",
+				window_tags[i] + ZBX_CONST_STRLEN(",window="));
+	}
+
+	return names;
+}
+
+/* finds the slot of an item, claiming a free one if the table is not full */
+static int	rollup_slot(zbx_uint64_t itemid)
+{
+	zbx_uint64_t	i, id, expected;
+
+	for (i = ZBX_DEFAULT_UINT64_HASH_FUNC(&itemid) & shm->mask;; i = (i + 1) & shm->mask)
+	{
+		if (itemid == (id = __atomic_load_n(&slots[i].itemid, __ATOMIC_ACQUIRE)))
+			return (int)i;
+
+		if (0 != id)
+			continue;
+
+		if (__atomic_load_n(&shm->entries, __ATOMIC_RELAXED) >= shm->entries_max)
+			return FAIL;
+
+		expected = 0;
+
+		if (__atomic_compare_exchange_n(&slots[i].itemid, &expected, itemid, 0, __ATOMIC_ACQ_REL,
+				__ATOMIC_ACQUIRE))
+		{
+			__atomic_fetch_add(&shm->entries, 1, __ATOMIC_RELAXED);
+			return (int)i;
+		}
+
+		/* another process claimed it, for this item or the next one in the probe */
+		if (itemid == expected)
+			return (int)i;
+	}
+}
+
+/* appends a field named after the field of the values with InfluxDBSchema=host, e.g. system.cpu.load_min */
+static void	rollup_append_name(line_buffer_t *lines, const char *field, size_t field_len, const char *name)
+{
+	if (0 != field_len)
+	{
+		line_buffer_append(lines, field, field_len);
+		line_buffer_append(lines, "_", 1);
+	}
+
+	line_buffer_append_str(lines, name);
+}
+
+/* appends min or max, formatted like the values of the item */
+static void	rollup_append_value(line_buffer_t *lines, unsigned char type, zbx_uint64_t bits)
+{
+	double	value;
+
+	if (ROLLUP_INTEGER == type)
+	{
+		lp_append_uint64(lines, bits);
+		return;
+	}
+
+	memcpy(&value, &bits, sizeof(value));
+	lp_append_double(lines, value);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_flush                                                     *
+ *                                                                            *
+ * Purpose: appends the point of a closed window                              *
+ *                                                                            *
+ * Parameters: lines  - the batch                                             *
+ *             series - series key of the item, with InfluxDBSchema=host      *
+ *                      followed by a space and the field name                *
+ *             len    - length of the series key                              *
+ *             type   - ROLLUP_* of the values                                *
+ *             window - index of the window length                            *
+ *             agg    - the aggregate                                         *
+ *                                                                            *
+ ******************************************************************************/
+static void	rollup_flush(line_buffer_t *lines, const char *series, size_t len, unsigned char type, int window,
+		const rollup_window_t *agg)
+{
+	const char	*measurement_end, *tags_end, *field, *end = series + len;
+
+	// the measurement ends at the first comma or space not escaped, the tags at the first space
+	for (tags_end = series, measurement_end = NULL; tags_end < end && ' ' != *tags_end; tags_end++)
+	{
+		if ('\\' == *tags_end && tags_end + 1 < end)
+			tags_end++;
+		else if (',' == *tags_end && NULL == measurement_end)
+			measurement_end = tags_end;
+	}
+
+	if (NULL == measurement_end)
+		measurement_end = tags_end;
+
+	field = (tags_end < end ? tags_end + 1 : end);
+
+	line_buffer_append(lines, series, (size_t)(measurement_end - series));
+	line_buffer_append(lines, suffix.data, suffix.offset);
+	line_buffer_append(lines, measurement_end, (size_t)(tags_end - measurement_end));
+	line_buffer_append_str(lines, window_tags[window]);
+	line_buffer_append(lines, " ", 1);
+	rollup_append_name(lines, field, (size_t)(end - field), "min=");
+	rollup_append_value(lines, type, agg->min);
+	line_buffer_append(lines, ",", 1);
+	rollup_append_name(lines, field, (size_t)(end - field), "max=");
+	rollup_append_value(lines, type, agg->max);
+	line_buffer_append(lines, ",", 1);
+	rollup_append_name(lines, field, (size_t)(end - field), "mean=");
+	lp_append_double(lines, agg->sum / agg->count);
+	line_buffer_append(lines, ",", 1);
+	rollup_append_name(lines, field, (size_t)(end - field), "count=");
+	lp_append_uint64(lines, agg->count);
+	line_buffer_append_str(lines, "i ");
+	lp_append_timestamp(lines, agg->start, 0, CONFIG_INFLUXDB_PRECISION);
+	line_buffer_append(lines, "\n", 1);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_add                                                       *
+ *                                                                            *
+ * Purpose: adds a value to the windows of its item, closing those it is past *
+ *                                                                            *
+ * Parameters: lines  - the batch points of closed windows are appended to    *
+ *             series - series key of the item                                *
+ *             len    - length of the series key                              *
+ *             itemid - the item                                              *
+ *             type   - ROLLUP_* of the value                                 *
+ *             clock  - time of the value                                     *
+ *             bits   - value bits                                            *
+ *             value  - the value                                             *
+ *             less   - compares values by their bits                         *
+ *                                                                            *
+ * Return value: number of points appended                                    *
+ *                                                                            *
+ ******************************************************************************/
+static int	rollup_add(line_buffer_t *lines, const char *series, size_t len, zbx_uint64_t itemid, unsigned char type,
+		int clock, zbx_uint64_t bits, double value, int (*less)(zbx_uint64_t a, zbx_uint64_t b))
+{
+	rollup_window_t	*agg;
+	int		slot, start, i, points = 0;
+
+	if (0 > clock || FAIL == (slot = rollup_slot(itemid)))
+		return 0;
+
+	agg = &aggregates[(size_t)slot * windows_num];
+
+	for (i = 0; i < windows_num; i++, agg++)
+	{
+		start = clock - clock % windows[i];
+
+		/* older values (e.g. from a proxy catching up) go to no window */
+		if (0 != agg->count && start < agg->start)
+			continue;
+
+		if (0 != agg->count && (start != agg->start || type != slots[slot].type))
+		{
+			rollup_flush(lines, series, len, slots[slot].type, i, agg);
+			points++;
+			agg->count = 0;
+		}
+
+		if (0 == agg->count)
+		{
+			agg->start = start;
+			agg->min = agg->max = bits;
+			agg->sum = 0;
+		}
+		else if (0 != less(bits, agg->min))
+			agg->min = bits;
+		else if (0 != less(agg->max, bits))
+			agg->max = bits;
+
+		agg->sum += value;
+		agg->count++;
+	}
+
+	slots[slot].type = type;
+
+	return points;
+}
+
+static int	rollup_less_double(zbx_uint64_t a, zbx_uint64_t b)
+{
+	double	value_a, value_b;
+
+	memcpy(&value_a, &a, sizeof(value_a));
+	memcpy(&value_b, &b, sizeof(value_b));
+
+	return value_a < value_b;
+}
+
+static int	rollup_less_uint64(zbx_uint64_t a, zbx_uint64_t b)
+{
+	return a < b;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_add_double                                                *
+ *                                                                            *
+ * Purpose: adds a float value to the windows of its item                     *
+ *                                                                            *
+ * Return value: number of points of closed windows appended to lines         *
+ *                                                                            *
+ * Comment: non-finite values are not added                                   *
+ *                                                                            *
+ ******************************************************************************/
+int	rollup_add_double(line_buffer_t *lines, const char *series, size_t len, zbx_uint64_t itemid, int clock,
+		double value)
+{
+	zbx_uint64_t	bits;
+
+	if (0 == windows_num || 0 == isfinite(value))
+		return 0;
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	return rollup_add(lines, series, len, itemid, ROLLUP_FLOAT, clock, bits, value, rollup_less_double);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: rollup_add_uint64                                                *
+ *                                                                            *
+ * Purpose: adds an integer value to the windows of its item                  *
+ *                                                                            *
+ * Return value: number of points of closed windows appended to lines         *
+ *                                                                            *
+ ******************************************************************************/
+int	rollup_add_uint64(line_buffer_t *lines, const char *series, size_t len, zbx_uint64_t itemid, int clock,
+		zbx_uint64_t value)
+{
+	if (0 == windows_num)
+		return 0;
+
+	return rollup_add(lines, series, len, itemid, ROLLUP_INTEGER, clock, value, (double)value, rollup_less_uint64);
+}
@@ -0,0 +1,23 @@
+#ifndef __ZABBIX_ROLLUP_H
+#define __ZABBIX_ROLLUP_H
+
+
+#include "common.h"
+#include "line_buffer.h"
+
+#define ROLLUP_WINDOWS_MAX	8
+#define ROLLUP_WINDOW_MAX	SEC_PER_WEEK
+
+extern int rollup_init(char **error);
+extern void rollup_destroy(void);
+
+extern int rollup_windows_num(void);
+extern char *rollup_windows_names(void);
+
+extern int rollup_add_double(line_buffer_t *lines, const char *series, size_t len, zbx_uint64_t itemid, int clock,
+		double value);
+extern int rollup_add_uint64(line_buffer_t *lines, const char *series, size_t len, zbx_uint64_t itemid, int clock,
+		zbx_uint64_t value);
+
+
+#endif /* __ZABBIX_ROLLUP_H */
@@ -0,0 +1,238 @@
+// bounded in-memory queue of formatted payloads drained by a sender thread
+// 1] history callbacks only format lines and push the payload, so history syncers
+//    don't wait for InfluxDB to answer
+// 2] the queue is limited by number of payloads (SendQueueMaxBatches) and their total
+//    size (SendQueueMaxSize), when full the syncer either waits for the sender or the
+//    oldest payloads are dropped (SendQueueFullPolicy)
+// 3] the sender thread is started on first push in every history syncer process, threads
+//    don't survive fork() so it can't be started in zbx_module_init
+// 4] with SpoolDir set, payloads that failed to be written or were dropped from a full
+//    queue go to the disk spool
+
+#include "load_config.h"
+#include "send_queue.h"
+#include "influxdb_writer.h"
+#include "spool.h"
+#include "module_stats.h"
+
+#include <pthread.h>
+
+typedef struct send_queue_entry
+{
+	char				*data;
+	size_t				size;
+	struct send_queue_entry		*next;
+}
+send_queue_entry_t;
+
+static pthread_mutex_t	queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	queue_not_full = PTHREAD_COND_INITIALIZER;
+
+static send_queue_entry_t	*queue_head = NULL;
+static send_queue_entry_t	*queue_tail = NULL;
+static int			queue_batches = 0;
+static zbx_uint64_t		queue_bytes = 0;
+static zbx_uint64_t		queue_dropped = 0;
+
+static pthread_t	sender_thread;
+static pid_t		sender_pid = 0;
+static int		sender_stop = 0;
+
+
+static send_queue_entry_t	*queue_pop(void)
+{
+	send_queue_entry_t	*entry = queue_head;
+
+	if (NULL == (queue_head = entry->next))
+		queue_tail = NULL;
+
+	queue_batches--;
+	queue_bytes -= entry->size;
+	module_stats_set(MODULE_STATS_QUEUE_BATCHES, queue_batches);
+	module_stats_set(MODULE_STATS_QUEUE_BYTES, queue_bytes);
+
+	return entry;
+}
+
+static void	*sender_thread_main(void *arg)
+{
+	send_queue_entry_t	*entry;
+	unsigned int		endpoints;
+
+	ZBX_UNUSED(arg);
+
+	pthread_mutex_lock(&queue_lock);
+
+	for (;;)
+	{
+		while (NULL == queue_head && 0 == sender_stop)
+			pthread_cond_wait(&queue_not_empty, &queue_lock);
+
+		// on stop the queue is still drained
+		if (NULL == queue_head)
+			break;
+
+		entry = queue_pop();
+		pthread_cond_broadcast(&queue_not_full);
+		pthread_mutex_unlock(&queue_lock);
+
+		endpoints = influxdb_endpoints_all();
+
+		if (SUCCEED != write_to_influxdb(entry->data, &endpoints))
+			spool_write(entry->data, endpoints);
+
+		zbx_free(entry->data);
+		zbx_free(entry);
+
+		pthread_mutex_lock(&queue_lock);
+	}
+
+	pthread_mutex_unlock(&queue_lock);
+	influxdb_writer_close();
+
+	return NULL;
+}
+
+static int	queue_full(size_t size)
+{
+	// a payload bigger than the whole queue is still accepted into an empty queue
+	if (NULL == queue_head)
+		return FAIL;
+
+	if (queue_batches >= CONFIG_SEND_QUEUE_MAX_BATCHES || queue_bytes + size > CONFIG_SEND_QUEUE_MAX_SIZE)
+		return SUCCEED;
+
+	return FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: send_queue_push                                                  *
+ *                                                                            *
+ * Purpose: hands a payload over to the sender thread of this process         *
+ *                                                                            *
+ * Parameters: data - line protocol payload, the queue takes ownership        *
+ *                                                                            *
+ ******************************************************************************/
+void	send_queue_push(char *data)
+{
+	send_queue_entry_t	*entry, *dropped, *dropped_head = NULL, *dropped_tail = NULL;
+	zbx_uint64_t		dropped_num = 0;
+	unsigned int		endpoints;
+	int			err;
+
+	entry = (send_queue_entry_t *)zbx_malloc(NULL, sizeof(send_queue_entry_t));
+	entry->data = data;
+	entry->size = strlen(data);
+	entry->next = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+
+	if (sender_pid != getpid())
+	{
+		sender_stop = 0;
+
+		if (0 != (err = pthread_create(&sender_thread, NULL, sender_thread_main, NULL)))
+		{
+			pthread_mutex_unlock(&queue_lock);
+			zabbix_log(LOG_LEVEL_ERR, "[%s] cannot start sender thread: %s, writing synchronously",
+					MODULE_NAME, zbx_strerror(err));
+			endpoints = influxdb_endpoints_all();
+
+			if (SUCCEED != write_to_influxdb(entry->data, &endpoints))
+				spool_write(entry->data, endpoints);
+
+			zbx_free(entry->data);
+			zbx_free(entry);
+			return;
+		}
+		sender_pid = getpid();
+	}
+
+	while (SUCCEED == queue_full(entry->size))
+	{
+		if (SEND_QUEUE_FULL_BLOCK == CONFIG_SEND_QUEUE_FULL_POLICY)
+		{
+			pthread_cond_wait(&queue_not_full, &queue_lock);
+			continue;
+		}
+
+		dropped = queue_pop();
+		dropped->next = NULL;
+
+		if (NULL != dropped_tail)
+			dropped_tail->next = dropped;
+		else
+			dropped_head = dropped;
+
+		dropped_tail = dropped;
+		dropped_num++;
+	}
+
+	if (NULL != queue_tail)
+		queue_tail->next = entry;
+	else
+		queue_head = entry;
+
+	queue_tail = entry;
+	queue_batches++;
+	queue_bytes += entry->size;
+	queue_dropped += dropped_num;
+	module_stats_set(MODULE_STATS_QUEUE_BATCHES, queue_batches);
+	module_stats_set(MODULE_STATS_QUEUE_BYTES, queue_bytes);
+	module_stats_add(MODULE_STATS_QUEUE_DROPPED, dropped_num);
+
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+
+	if (0 != dropped_num)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] send queue full, %s " ZBX_FS_UI64 " oldest batches",
+				MODULE_NAME, NULL != CONFIG_SPOOL_DIR ? "spooled" : "dropped", dropped_num);
+	}
+
+	// spooled outside of the queue lock, the sender thread may go on meanwhile
+	while (NULL != (dropped = dropped_head))
+	{
+		dropped_head = dropped->next;
+		spool_write(dropped->data, influxdb_endpoints_all());
+		zbx_free(dropped->data);
+		zbx_free(dropped);
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: send_queue_destroy                                               *
+ *                                                                            *
+ * Purpose: lets the sender thread write out what is queued and stops it      *
+ *                                                                            *
+ ******************************************************************************/
+void	send_queue_destroy(void)
+{
+	if (sender_pid != getpid())
+		return;
+
+	pthread_mutex_lock(&queue_lock);
+	sender_stop = 1;
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_join(sender_thread, NULL);
+	sender_pid = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: send_queue_get_stats                                             *
+ *                                                                            *
+ ******************************************************************************/
+void	send_queue_get_stats(int *batches, zbx_uint64_t *bytes, zbx_uint64_t *dropped)
+{
+	pthread_mutex_lock(&queue_lock);
+	*batches = queue_batches;
+	*bytes = queue_bytes;
+	*dropped = queue_dropped;
+	pthread_mutex_unlock(&queue_lock);
+}
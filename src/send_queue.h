@@ -0,0 +1,17 @@
+#ifndef __ZABBIX_SEND_QUEUE_H
+#define __ZABBIX_SEND_QUEUE_H
+
+
+#include "common.h"
+
+#define SEND_QUEUE_FULL_BLOCK       1
+#define SEND_QUEUE_FULL_DROP_OLDEST 2
+
+extern void send_queue_destroy(void);
+
+extern void send_queue_push(char *data);
+
+extern void send_queue_get_stats(int *batches, zbx_uint64_t *bytes, zbx_uint64_t *dropped);
+
+
+#endif /* __ZABBIX_SEND_QUEUE_H */
@@ -0,0 +1,357 @@
+// one writer for all history syncers, fed through a ring in shared memory
+// 1] the ring is an anonymous shared mapping created in zbx_module_init, so every
+//    history syncer forked afterwards appends the payloads of its batches to it
+//    instead of writing them to InfluxDB itself
+// 2] producers claim space by compare-and-swap on the reserved position, copy the
+//    payload after a record header and publish it by setting the state of the
+//    header last; a record that would not fit before the end of the ring is
+//    preceded by a padding record, so a payload is always contiguous
+// 3] the first syncer to push starts a writer thread and records its pid, the
+//    others check once a second that it is alive and take over if it is not
+//    (threads don't survive fork() so it can't be started in zbx_module_init)
+// 4] the writer takes records in order, copies them into one batch and zeroes
+//    them before giving the space back, the batch is written once it reaches
+//    SharedWriterBatchSize bytes or its first record waited SharedWriterLinger
+//    milliseconds; failed writes go to the spool as usual
+// 5] when the ring has no room a syncer writes its batch itself, as without
+//    SharedWriter, rather than wait for the writer (ring_overflows)
+//
+// A syncer killed between claiming and publishing a record would stop the writer
+// at that record, Zabbix server shuts down when any of its processes dies anyway.
+
+#include "load_config.h"
+#include "shared_writer.h"
+#include "influxdb_writer.h"
+#include "line_buffer.h"
+#include "spool.h"
+#include "module_stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#define RECORD_EMPTY	0
+#define RECORD_DATA	1
+#define RECORD_PADDING	2
+
+/* records start at multiples of the header size */
+#define RECORD_ALIGN(len)	(((len) + sizeof(shared_writer_record_t) - 1) & ~(sizeof(shared_writer_record_t) - 1))
+
+/* how often an idle writer looks into the ring, ms */
+#define SHARED_WRITER_POLL	10
+
+/* producers and the writer don't share a cache line */
+#define SHARED_WRITER_CACHE_LINE	64
+
+typedef struct
+{
+	uint32_t	len;		/* of the payload, of the whole record for padding */
+	uint32_t	state;		/* RECORD_* */
+}
+shared_writer_record_t;
+
+/* positions only grow, the offset in the ring is position modulo size */
+typedef struct
+{
+	zbx_uint64_t	reserved;
+	char		pad1[SHARED_WRITER_CACHE_LINE - sizeof(zbx_uint64_t)];
+	zbx_uint64_t	consumed;
+	char		pad2[SHARED_WRITER_CACHE_LINE - sizeof(zbx_uint64_t)];
+	pid_t		writer_pid;
+	zbx_uint64_t	size;
+}
+shared_writer_ring_t;
+
+static shared_writer_ring_t	*ring = NULL;
+static char			*ring_data = NULL;
+static size_t			ring_map_size = 0;
+
+static pthread_t	writer_thread;
+static pid_t		writer_pid = 0;
+static int		writer_stop = 0;
+static time_t		writer_checked = 0;
+
+static zbx_uint64_t	shared_writer_time_ms(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (zbx_uint64_t)ts.tv_sec * 1000 + (zbx_uint64_t)ts.tv_nsec / 1000000;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: shared_writer_take                                               *
+ *                                                                            *
+ * Purpose: moves published records from the ring to the batch                *
+ *                                                                            *
+ * Parameters: batch    - lines to write                                      *
+ *             max_size - records are taken until the batch is this big       *
+ *                                                                            *
+ * Return value: number of payloads taken                                     *
+ *                                                                            *
+ ******************************************************************************/
+static int	shared_writer_take(line_buffer_t *batch, size_t max_size)
+{
+	shared_writer_record_t	*record;
+	zbx_uint64_t		consumed, reserved, size;
+	uint32_t		state;
+	int			taken = 0;
+
+	consumed = ring->consumed;
+	reserved = __atomic_load_n(&ring->reserved, __ATOMIC_ACQUIRE);
+
+	while (consumed < reserved && batch->offset < max_size)
+	{
+		record = (shared_writer_record_t *)(ring_data + consumed % ring->size);
+
+		// claimed, but the payload is still being copied
+		if (RECORD_EMPTY == (state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE)))
+			break;
+
+		if (RECORD_DATA == state)
+		{
+			line_buffer_append(batch, (const char *)(record + 1), record->len);
+			size = sizeof(shared_writer_record_t) + RECORD_ALIGN(record->len);
+			taken++;
+		}
+		else
+			size = record->len;
+
+		// a record of the next lap may start anywhere in this one, it must find zeroes there
+		memset(record, 0, size);
+		consumed += size;
+		__atomic_store_n(&ring->consumed, consumed, __ATOMIC_RELEASE);
+	}
+
+	module_stats_set(MODULE_STATS_RING_BYTES, reserved - consumed);
+
+	return taken;
+}
+
+static void	shared_writer_flush(line_buffer_t *batch)
+{
+	unsigned int	endpoints = influxdb_endpoints_all();
+
+	if (0 == batch->offset)
+		return;
+
+	zabbix_log(MODULE_LOG_LEVEL, "[%s]     shared writer writing %zu bytes", MODULE_NAME, batch->offset);
+
+	if (SUCCEED != write_to_influxdb(batch->data, &endpoints))
+		spool_write(batch->data, endpoints);
+
+	line_buffer_reset(batch);
+}
+
+static void	*shared_writer_main(void *arg)
+{
+	line_buffer_t	batch;
+	zbx_uint64_t	now, first = 0;
+	struct timespec	ts = {0, SHARED_WRITER_POLL * 1000000L};
+	int		stop;
+
+	ZBX_UNUSED(arg);
+
+	memset(&batch, 0, sizeof(batch));
+
+	for (;;)
+	{
+		stop = __atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE);
+
+		if (0 != shared_writer_take(&batch, (size_t)CONFIG_SHARED_WRITER_BATCH_SIZE) && 0 == first)
+			first = shared_writer_time_ms();
+
+		now = shared_writer_time_ms();
+
+		if (0 != batch.offset && (batch.offset >= (size_t)CONFIG_SHARED_WRITER_BATCH_SIZE || 0 != stop ||
+				now - first >= (zbx_uint64_t)CONFIG_SHARED_WRITER_LINGER))
+		{
+			shared_writer_flush(&batch);
+			first = 0;
+			continue;
+		}
+
+		// on stop the ring is still drained
+		if (0 != stop && __atomic_load_n(&ring->reserved, __ATOMIC_ACQUIRE) == ring->consumed)
+			break;
+
+		nanosleep(&ts, NULL);
+	}
+
+	line_buffer_free(&batch);
+	influxdb_writer_close();
+
+	return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: shared_writer_elect                                              *
+ *                                                                            *
+ * Purpose: starts the writer thread in this process if no live process runs  *
+ *          one                                                               *
+ *                                                                            *
+ ******************************************************************************/
+static void	shared_writer_elect(void)
+{
+	pid_t	pid;
+	time_t	now = time(NULL);
+	int	err;
+
+	if (writer_pid == getpid() || now == writer_checked)
+		return;
+
+	writer_checked = now;
+	pid = __atomic_load_n(&ring->writer_pid, __ATOMIC_ACQUIRE);
+
+	if (0 != pid && (0 == kill(pid, 0) || ESRCH != errno))
+		return;
+
+	if (!__atomic_compare_exchange_n(&ring->writer_pid, &pid, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+
+	writer_stop = 0;
+
+	if (0 != (err = pthread_create(&writer_thread, NULL, shared_writer_main, NULL)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot start shared writer thread: %s", MODULE_NAME, zbx_strerror(err));
+		__atomic_store_n(&ring->writer_pid, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	writer_pid = getpid();
+
+	if (0 != pid)
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] shared writer process %d is gone, taking over", MODULE_NAME, (int)pid);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: shared_writer_init                                               *
+ *                                                                            *
+ * Purpose: maps the ring, must be called before any process is forked        *
+ *                                                                            *
+ ******************************************************************************/
+int	shared_writer_init(void)
+{
+	zbx_uint64_t	size = RECORD_ALIGN(CONFIG_SHARED_WRITER_RING_SIZE);
+
+	ring_map_size = sizeof(shared_writer_ring_t) + size;
+
+	if (MAP_FAILED == (ring = (shared_writer_ring_t *)mmap(NULL, ring_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot map " ZBX_FS_UI64 " bytes of shared memory for the shared writer:"
+				" %s", MODULE_NAME, (zbx_uint64_t)ring_map_size, zbx_strerror(errno));
+		ring = NULL;
+		return FAIL;
+	}
+
+	ring->size = size;
+	ring_data = (char *)(ring + 1);
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: shared_writer_destroy                                            *
+ *                                                                            *
+ * Purpose: lets the writer thread of this process write out the ring and     *
+ *          stops it, what a writer that is gone left is written from here    *
+ *                                                                            *
+ ******************************************************************************/
+void	shared_writer_destroy(void)
+{
+	line_buffer_t	batch;
+	pid_t		pid;
+
+	if (NULL == ring)
+		return;
+
+	if (writer_pid == getpid())
+	{
+		__atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+		pthread_join(writer_thread, NULL);
+		writer_pid = 0;
+		__atomic_store_n(&ring->writer_pid, 0, __ATOMIC_RELEASE);
+	}
+	else if ((0 == (pid = __atomic_load_n(&ring->writer_pid, __ATOMIC_ACQUIRE)) ||
+			(0 != kill(pid, 0) && ESRCH == errno)) &&
+			__atomic_compare_exchange_n(&ring->writer_pid, &pid, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		// the ring has one reader at a time, this process is the writer while draining it
+		memset(&batch, 0, sizeof(batch));
+
+		while (0 != shared_writer_take(&batch, (size_t)CONFIG_SHARED_WRITER_BATCH_SIZE))
+			shared_writer_flush(&batch);
+
+		shared_writer_flush(&batch);
+		line_buffer_free(&batch);
+		__atomic_store_n(&ring->writer_pid, 0, __ATOMIC_RELEASE);
+	}
+
+	munmap(ring, ring_map_size);
+	ring = NULL;
+	ring_data = NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: shared_writer_push                                               *
+ *                                                                            *
+ * Purpose: hands a payload over to the shared writer                         *
+ *                                                                            *
+ * Parameters: data - line protocol payload, copied into the ring             *
+ *             len  - its length                                              *
+ *                                                                            *
+ * Return value: SUCCEED - the payload is in the ring                         *
+ *               FAIL - the ring has no room for it, it is left to the caller *
+ *                                                                            *
+ ******************************************************************************/
+int	shared_writer_push(const char *data, size_t len)
+{
+	shared_writer_record_t	*record;
+	zbx_uint64_t		reserved, consumed, offset, padding, size;
+
+	shared_writer_elect();
+
+	size = sizeof(shared_writer_record_t) + RECORD_ALIGN(len);
+
+	if (size > ring->size || len > UINT32_MAX)
+		goto full;
+
+	do
+	{
+		reserved = __atomic_load_n(&ring->reserved, __ATOMIC_RELAXED);
+		consumed = __atomic_load_n(&ring->consumed, __ATOMIC_ACQUIRE);
+		offset = reserved % ring->size;
+		padding = (ring->size - offset < size ? ring->size - offset : 0);
+
+		if (reserved + padding + size - consumed > ring->size)
+			goto full;
+	}
+	while (!__atomic_compare_exchange_n(&ring->reserved, &reserved, reserved + padding + size, 1,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	if (0 != padding)
+	{
+		record = (shared_writer_record_t *)(ring_data + offset);
+		record->len = (uint32_t)padding;
+		__atomic_store_n(&record->state, RECORD_PADDING, __ATOMIC_RELEASE);
+		offset = 0;
+	}
+
+	record = (shared_writer_record_t *)(ring_data + offset);
+	record->len = (uint32_t)len;
+	memcpy(record + 1, data, len);
+	__atomic_store_n(&record->state, RECORD_DATA, __ATOMIC_RELEASE);
+
+	return SUCCEED;
+full:
+	module_stats_add(MODULE_STATS_RING_OVERFLOWS, 1);
+
+	return FAIL;
+}
@@ -0,0 +1,13 @@
+#ifndef __ZABBIX_SHARED_WRITER_H
+#define __ZABBIX_SHARED_WRITER_H
+
+
+#include "common.h"
+
+extern int shared_writer_init(void);
+extern void shared_writer_destroy(void);
+
+extern int shared_writer_push(const char *data, size_t len);
+
+
+#endif /* __ZABBIX_SHARED_WRITER_H */
@@ -0,0 +1,669 @@
+// disk spool for payloads that could not be written to InfluxDB
+// 1] every history syncer appends failed (or overflowing, see send_queue.c) payloads to its
+//    own segment file SpoolDir/seg-<time>-<pid>.wip, holding flock() on it while writing,
+//    it is created as .new and renamed once locked so it is never taken for a dead one
+// 2] segments are closed when they reach SpoolSegmentSize or get SPOOL_SEGMENT_MAX_AGE old
+//    and renamed to .seg, .wip segments left by a process that died are adopted the same way
+// 3] one process at a time (whoever holds flock() on SpoolDir/spool.lock) replays closed
+//    segments oldest first, at most SpoolReplayRate bytes per second, the others only
+//    sum up the size of the spool so SpoolMaxSize applies to what is really there
+// 4] every segment starts with a header holding the offset of the first record not yet
+//    replayed, it is updated after each record written, so a restart neither loses nor
+//    repeats spooled data
+//
+// Segment layout: SPOOL_MAGIC, offset (8 bytes) and records of 4 byte size, 4 byte set of
+// InfluxDB nodes the payload is still to be written to (see influxdb_writer.c) plus payload.
+// The set is updated in place when some nodes take a record and others don't. Segments
+// of the older layout (SPOOL_MAGIC_V1, no node set) are replayed to all nodes.
+// A record cut short by a crash is ignored.
+
+#include "load_config.h"
+#include "spool.h"
+#include "influxdb_writer.h"
+#include "module_stats.h"
+
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+
+#define SPOOL_MAGIC		"ZBXINFL2"
+#define SPOOL_MAGIC_V1		"ZBXINFL1"
+#define SPOOL_MAGIC_LEN		8
+#define SPOOL_HEADER_SIZE	(SPOOL_MAGIC_LEN + sizeof(zbx_uint64_t))
+#define SPOOL_LOCK_FILE		"spool.lock"
+#define SPOOL_SEGMENT_PREFIX	"seg-"
+#define SPOOL_SEGMENT_NEW	".new"
+#define SPOOL_SEGMENT_WIP	".wip"
+#define SPOOL_SEGMENT_READY	".seg"
+
+/* segments being written are closed after this many seconds so they can be replayed */
+#define SPOOL_SEGMENT_MAX_AGE	60
+/* seconds to wait before replaying again after InfluxDB refused a write */
+#define SPOOL_RETRY_INTERVAL	10
+
+static pthread_mutex_t	spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	spool_wakeup = PTHREAD_COND_INITIALIZER;
+
+/* segment written by this process */
+static int		segment_fd = -1;
+static char		*segment_path = NULL;
+static pid_t		segment_pid = 0;
+static zbx_uint64_t	segment_size = 0;
+static time_t		segment_created = 0;
+
+/* total size of SpoolDir as of last scan plus what was written since */
+static zbx_uint64_t	spool_size = 0;
+static zbx_uint64_t	spool_dropped = 0;
+
+static pthread_t	spool_thread;
+static pid_t		spool_pid = 0;
+static int		spool_stop = 0;
+
+
+static int	spool_has_suffix(const char *name, const char *suffix)
+{
+	size_t	len = strlen(name), suffix_len = strlen(suffix);
+
+	return len > suffix_len && 0 == strcmp(name + len - suffix_len, suffix) ? SUCCEED : FAIL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_segment_ready_path                                         *
+ *                                                                            *
+ * Purpose: returns path of a closed segment for a .wip segment path          *
+ *                                                                            *
+ ******************************************************************************/
+static char	*spool_segment_ready_path(const char *path)
+{
+	char	*ready;
+
+	ready = zbx_strdup(NULL, path);
+	zbx_strlcpy(ready + strlen(ready) - ZBX_CONST_STRLEN(SPOOL_SEGMENT_WIP), SPOOL_SEGMENT_READY,
+			ZBX_CONST_STRLEN(SPOOL_SEGMENT_READY) + 1);
+
+	return ready;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_segment_open                                               *
+ *                                                                            *
+ * Purpose: starts a new segment of this process, spool_lock must be held     *
+ *                                                                            *
+ ******************************************************************************/
+static int	spool_segment_open(void)
+{
+	struct timeval	tv;
+	char		header[SPOOL_HEADER_SIZE], *new_path;
+	zbx_uint64_t	offset = SPOOL_HEADER_SIZE;
+
+	gettimeofday(&tv, NULL);
+	segment_path = zbx_dsprintf(segment_path, "%s/" SPOOL_SEGMENT_PREFIX "%010ld%06ld-%d" SPOOL_SEGMENT_WIP,
+			CONFIG_SPOOL_DIR, (long)tv.tv_sec, (long)tv.tv_usec, (int)getpid());
+	new_path = zbx_dsprintf(NULL, "%.*s" SPOOL_SEGMENT_NEW,
+			(int)(strlen(segment_path) - ZBX_CONST_STRLEN(SPOOL_SEGMENT_WIP)), segment_path);
+
+	if (-1 == (segment_fd = open(new_path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0640)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot create spool segment \"%s\": %s", MODULE_NAME, new_path,
+				zbx_strerror(errno));
+		zbx_free(new_path);
+		return FAIL;
+	}
+
+	memcpy(header, SPOOL_MAGIC, SPOOL_MAGIC_LEN);
+	memcpy(header + SPOOL_MAGIC_LEN, &offset, sizeof(offset));
+
+	// visible as .wip only once locked, spool_scan() adopts unlocked ones
+	if (0 != flock(segment_fd, LOCK_EX | LOCK_NB) || sizeof(header) != write(segment_fd, header, sizeof(header)) ||
+			0 != rename(new_path, segment_path))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot initialise spool segment \"%s\": %s", MODULE_NAME, new_path,
+				zbx_strerror(errno));
+		close(segment_fd);
+		unlink(new_path);
+		zbx_free(new_path);
+		segment_fd = -1;
+		return FAIL;
+	}
+
+	zbx_free(new_path);
+
+	segment_pid = getpid();
+	segment_size = SPOOL_HEADER_SIZE;
+	segment_created = time(NULL);
+	spool_size += SPOOL_HEADER_SIZE;
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_segment_close                                              *
+ *                                                                            *
+ * Purpose: makes the segment of this process available for replay,           *
+ *          spool_lock must be held                                           *
+ *                                                                            *
+ ******************************************************************************/
+static void	spool_segment_close(void)
+{
+	char	*ready_path;
+
+	if (-1 == segment_fd || segment_pid != getpid())
+	{
+		segment_fd = -1;
+		return;
+	}
+
+	if (SPOOL_FSYNC_NEVER != CONFIG_SPOOL_FSYNC && 0 != fsync(segment_fd))
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] cannot fsync spool segment \"%s\": %s", MODULE_NAME, segment_path,
+				zbx_strerror(errno));
+	}
+
+	// renamed while still locked, nobody can start replaying it before close()
+	ready_path = spool_segment_ready_path(segment_path);
+
+	if (0 != rename(segment_path, ready_path))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot close spool segment \"%s\": %s", MODULE_NAME, segment_path,
+				zbx_strerror(errno));
+	}
+
+	zbx_free(ready_path);
+	close(segment_fd);
+	segment_fd = -1;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_write                                                      *
+ *                                                                            *
+ * Purpose: appends a payload to the spool, to be replayed later              *
+ *                                                                            *
+ * Parameters: data      - line protocol payload                              *
+ *             endpoints - InfluxDB nodes to replay the payload to            *
+ *                                                                            *
+ * Comment: payloads not fitting within SpoolMaxSize are dropped              *
+ *                                                                            *
+ ******************************************************************************/
+void	spool_write(const char *data, unsigned int endpoints)
+{
+	struct iovec	iov[3];
+	uint32_t	size, set = endpoints;
+	ssize_t		written;
+
+	if (NULL == CONFIG_SPOOL_DIR)
+		return;
+
+	size = (uint32_t)strlen(data);
+
+	pthread_mutex_lock(&spool_lock);
+
+	if (spool_size + sizeof(size) + sizeof(set) + size > CONFIG_SPOOL_MAX_SIZE)
+	{
+		spool_dropped++;
+		module_stats_add(MODULE_STATS_SPOOL_DROPPED, 1);
+		pthread_mutex_unlock(&spool_lock);
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] spool is full, dropped %u bytes of history", MODULE_NAME,
+				(unsigned int)size);
+		return;
+	}
+
+	if (segment_pid != getpid())
+		segment_fd = -1;
+
+	if (-1 == segment_fd && SUCCEED != spool_segment_open())
+	{
+		spool_dropped++;
+		module_stats_add(MODULE_STATS_SPOOL_DROPPED, 1);
+		pthread_mutex_unlock(&spool_lock);
+		return;
+	}
+
+	iov[0].iov_base = &size;
+	iov[0].iov_len = sizeof(size);
+	iov[1].iov_base = &set;
+	iov[1].iov_len = sizeof(set);
+	iov[2].iov_base = (void *)data;
+	iov[2].iov_len = size;
+
+	if ((ssize_t)(sizeof(size) + sizeof(set) + size) != (written = writev(segment_fd, iov, 3)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot write to spool segment \"%s\": %s", MODULE_NAME, segment_path,
+				-1 == written ? zbx_strerror(errno) : "short write");
+		spool_dropped++;
+		module_stats_add(MODULE_STATS_SPOOL_DROPPED, 1);
+		// a partial record at the end of the segment is ignored on replay
+		spool_segment_close();
+		pthread_mutex_unlock(&spool_lock);
+		return;
+	}
+
+	segment_size += written;
+	spool_size += written;
+	module_stats_set(MODULE_STATS_SPOOL_BYTES, spool_size);
+	module_stats_add(MODULE_STATS_SPOOLED, 1);
+
+	if (SPOOL_FSYNC_ALWAYS == CONFIG_SPOOL_FSYNC)
+		fsync(segment_fd);
+
+	if (segment_size >= (zbx_uint64_t)CONFIG_SPOOL_SEGMENT_SIZE)
+		spool_segment_close();
+
+	pthread_mutex_unlock(&spool_lock);
+
+	zabbix_log(MODULE_LOG_LEVEL, "[%s]     spooled %u bytes", MODULE_NAME, (unsigned int)size);
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_sleep                                                      *
+ *                                                                            *
+ * Purpose: waits in the spool thread, waking up early on shutdown            *
+ *                                                                            *
+ * Return value: SUCCEED - waited, FAIL - spool thread is stopping            *
+ *                                                                            *
+ ******************************************************************************/
+static int	spool_sleep(double seconds)
+{
+	struct timespec	ts;
+	int		ret;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += (time_t)seconds;
+	ts.tv_nsec += (long)((seconds - (time_t)seconds) * 1000000000);
+
+	if (1000000000 <= ts.tv_nsec)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&spool_lock);
+
+	while (0 == spool_stop && 0 == pthread_cond_timedwait(&spool_wakeup, &spool_lock, &ts))
+		;
+
+	ret = (0 == spool_stop ? SUCCEED : FAIL);
+	pthread_mutex_unlock(&spool_lock);
+
+	return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_scan                                                       *
+ *                                                                            *
+ * Purpose: finds the oldest closed segment and sums up size of the spool,    *
+ *          segments left behind by dead processes are closed on the way      *
+ *                                                                            *
+ * Parameters: oldest - [OUT] path of the oldest closed segment or NULL,      *
+ *                      NULL - only sum up the size                           *
+ *             total  - [OUT] size of all segments                            *
+ *                                                                            *
+ ******************************************************************************/
+static void	spool_scan(char **oldest, zbx_uint64_t *total)
+{
+	DIR		*dir;
+	struct dirent	*d;
+	struct stat	st;
+	char		*path = NULL, *ready_path, *oldest_name = NULL;
+	int		fd;
+
+	if (NULL != oldest)
+		*oldest = NULL;
+
+	*total = 0;
+
+	if (NULL == (dir = opendir(CONFIG_SPOOL_DIR)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot open spool directory \"%s\": %s", MODULE_NAME, CONFIG_SPOOL_DIR,
+				zbx_strerror(errno));
+		return;
+	}
+
+	while (NULL != (d = readdir(dir)))
+	{
+		if (0 != strncmp(d->d_name, SPOOL_SEGMENT_PREFIX, ZBX_CONST_STRLEN(SPOOL_SEGMENT_PREFIX)))
+			continue;
+
+		path = zbx_dsprintf(path, "%s/%s", CONFIG_SPOOL_DIR, d->d_name);
+
+		if (0 != stat(path, &st))
+			continue;
+
+		*total += st.st_size;
+
+		if (NULL == oldest)
+			continue;
+
+		// a segment still being created is renamed within moments of it, unless its process died
+		if (SUCCEED == spool_has_suffix(d->d_name, SPOOL_SEGMENT_NEW))
+		{
+			if (time(NULL) - st.st_mtime < SPOOL_SEGMENT_MAX_AGE || -1 == (fd = open(path, O_RDONLY)))
+				continue;
+
+			if (0 == flock(fd, LOCK_EX | LOCK_NB))
+				unlink(path);
+
+			close(fd);
+			continue;
+		}
+
+		if (SUCCEED == spool_has_suffix(d->d_name, SPOOL_SEGMENT_WIP))
+		{
+			// a segment being written is locked by its process
+			if (-1 == (fd = open(path, O_RDONLY)))
+				continue;
+
+			if (0 == flock(fd, LOCK_EX | LOCK_NB))
+			{
+				ready_path = spool_segment_ready_path(path);
+
+				if (0 == rename(path, ready_path))
+				{
+					zabbix_log(LOG_LEVEL_INFORMATION, "[%s] adopted spool segment \"%s\"", MODULE_NAME,
+							path);
+				}
+
+				zbx_free(ready_path);
+			}
+			close(fd);
+			continue;
+		}
+
+		if (SUCCEED != spool_has_suffix(d->d_name, SPOOL_SEGMENT_READY))
+			continue;
+
+		// names start with creation time, so the smallest is the oldest
+		if (NULL == oldest_name || 0 > strcmp(d->d_name, oldest_name))
+			oldest_name = zbx_strdup(oldest_name, d->d_name);
+	}
+
+	closedir(dir);
+	zbx_free(path);
+
+	if (NULL != oldest_name)
+	{
+		*oldest = zbx_dsprintf(NULL, "%s/%s", CONFIG_SPOOL_DIR, oldest_name);
+		zbx_free(oldest_name);
+	}
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_replay_segment                                             *
+ *                                                                            *
+ * Purpose: writes records of a closed segment to InfluxDB, removes the       *
+ *          segment once all of them are written                              *
+ *                                                                            *
+ * Return value: SUCCEED - segment replayed (or taken by other process)       *
+ *               FAIL - InfluxDB refused a write or spool is stopping         *
+ *                                                                            *
+ ******************************************************************************/
+static int	spool_replay_segment(const char *path)
+{
+	char		header[SPOOL_HEADER_SIZE], *data = NULL;
+	zbx_uint64_t	offset;
+	uint32_t	size, set;
+	size_t		record_header;
+	unsigned int	endpoints;
+	int		fd, ret = FAIL;
+
+	if (-1 == (fd = open(path, O_RDWR)))
+		return SUCCEED;
+
+	if (0 != flock(fd, LOCK_EX | LOCK_NB))
+	{
+		close(fd);
+		return SUCCEED;
+	}
+
+	if (sizeof(header) != pread(fd, header, sizeof(header), 0))
+		record_header = 0;
+	else if (0 == memcmp(header, SPOOL_MAGIC, SPOOL_MAGIC_LEN))
+		record_header = sizeof(size) + sizeof(set);
+	else if (0 == memcmp(header, SPOOL_MAGIC_V1, SPOOL_MAGIC_LEN))
+		record_header = sizeof(size);
+	else
+		record_header = 0;
+
+	if (0 == record_header)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] removing invalid spool segment \"%s\"", MODULE_NAME, path);
+		unlink(path);
+		close(fd);
+		return SUCCEED;
+	}
+
+	memcpy(&offset, header + SPOOL_MAGIC_LEN, sizeof(offset));
+	zabbix_log(MODULE_LOG_LEVEL, "[%s] replaying spool segment \"%s\" from offset " ZBX_FS_UI64, MODULE_NAME,
+			path, offset);
+
+	for (;;)
+	{
+		if (sizeof(size) != pread(fd, &size, sizeof(size), offset))
+		{
+			ret = SUCCEED;
+			break;
+		}
+
+		set = (uint32_t)influxdb_endpoints_all();
+
+		if (sizeof(size) != record_header && sizeof(set) != pread(fd, &set, sizeof(set), offset + sizeof(size)))
+		{
+			ret = SUCCEED;
+			break;
+		}
+
+		data = (char *)zbx_realloc(data, (size_t)size + 1);
+
+		if (size != pread(fd, data, size, offset + record_header))
+		{
+			ret = SUCCEED;
+			break;
+		}
+		data[size] = '\0';
+
+		endpoints = set;
+
+		if (SUCCEED != write_to_influxdb(data, &endpoints))
+		{
+			// nodes which took the record are not written to again
+			if (sizeof(size) != record_header && endpoints != set)
+			{
+				set = endpoints;
+				pwrite(fd, &set, sizeof(set), offset + sizeof(size));
+			}
+			break;
+		}
+
+		offset += record_header + size;
+
+		if (sizeof(offset) != pwrite(fd, &offset, sizeof(offset), SPOOL_MAGIC_LEN))
+		{
+			zabbix_log(LOG_LEVEL_ERR, "[%s] cannot update spool segment \"%s\": %s", MODULE_NAME, path,
+					zbx_strerror(errno));
+			break;
+		}
+
+		if (SPOOL_FSYNC_ALWAYS == CONFIG_SPOOL_FSYNC)
+			fsync(fd);
+
+		if (0 != CONFIG_SPOOL_REPLAY_RATE && SUCCEED != spool_sleep((double)size / CONFIG_SPOOL_REPLAY_RATE))
+			break;
+	}
+
+	zbx_free(data);
+
+	if (SUCCEED == ret)
+	{
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] replayed spool segment \"%s\"", MODULE_NAME, path);
+		unlink(path);
+	}
+	else if (SPOOL_FSYNC_NEVER != CONFIG_SPOOL_FSYNC)
+		fsync(fd);
+
+	close(fd);
+
+	return ret;
+}
+
+static void	*spool_thread_main(void *arg)
+{
+	char		*lock_path, *oldest;
+	zbx_uint64_t	total;
+	int		lock_fd = -1, replay;
+	time_t		next_replay = 0;
+
+	ZBX_UNUSED(arg);
+
+	lock_path = zbx_dsprintf(NULL, "%s/%s", CONFIG_SPOOL_DIR, SPOOL_LOCK_FILE);
+
+	while (SUCCEED == spool_sleep(1))
+	{
+		pthread_mutex_lock(&spool_lock);
+
+		if (-1 != segment_fd && segment_pid == getpid() && time(NULL) - segment_created >= SPOOL_SEGMENT_MAX_AGE)
+			spool_segment_close();
+
+		pthread_mutex_unlock(&spool_lock);
+
+		// replay only in the process holding the lock, others just close their segments
+		if (-1 == lock_fd && -1 != (lock_fd = open(lock_path, O_RDWR | O_CREAT, 0640)) &&
+				0 != flock(lock_fd, LOCK_EX | LOCK_NB))
+		{
+			close(lock_fd);
+			lock_fd = -1;
+		}
+
+		replay = (-1 != lock_fd && time(NULL) >= next_replay);
+
+		// every process refreshes the size, it is checked by spool_write() of each
+		spool_scan(0 != replay ? &oldest : NULL, &total);
+
+		pthread_mutex_lock(&spool_lock);
+		spool_size = total;
+		module_stats_set(MODULE_STATS_SPOOL_BYTES, spool_size);
+		pthread_mutex_unlock(&spool_lock);
+
+		if (0 == replay || NULL == oldest)
+			continue;
+
+		if (SUCCEED != spool_replay_segment(oldest))
+			next_replay = time(NULL) + SPOOL_RETRY_INTERVAL;
+
+		zbx_free(oldest);
+	}
+
+	if (-1 != lock_fd)
+		close(lock_fd);
+
+	zbx_free(lock_path);
+	influxdb_writer_close();
+
+	return NULL;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_init                                                       *
+ *                                                                            *
+ * Purpose: checks that SpoolDir can be used, creating it if missing          *
+ *                                                                            *
+ ******************************************************************************/
+int	spool_init(void)
+{
+	char	*oldest;
+
+	if (NULL == CONFIG_SPOOL_DIR)
+		return SUCCEED;
+
+	if (0 != mkdir(CONFIG_SPOOL_DIR, 0750) && EEXIST != errno)
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot create spool directory \"%s\": %s", MODULE_NAME,
+				CONFIG_SPOOL_DIR, zbx_strerror(errno));
+		return FAIL;
+	}
+
+	if (0 != access(CONFIG_SPOOL_DIR, R_OK | W_OK | X_OK))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot use spool directory \"%s\": %s", MODULE_NAME,
+				CONFIG_SPOOL_DIR, zbx_strerror(errno));
+		return FAIL;
+	}
+
+	spool_scan(&oldest, &spool_size);
+	module_stats_set(MODULE_STATS_SPOOL_BYTES, spool_size);
+
+	if (NULL != oldest)
+	{
+		zabbix_log(LOG_LEVEL_INFORMATION, "[%s] spool holds " ZBX_FS_UI64 " bytes to replay", MODULE_NAME,
+				spool_size);
+		zbx_free(oldest);
+	}
+
+	return SUCCEED;
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_start_thread                                               *
+ *                                                                            *
+ * Purpose: starts the spool thread of the calling process if not running     *
+ *                                                                            *
+ ******************************************************************************/
+void	spool_start_thread(void)
+{
+	int	err;
+
+	if (NULL == CONFIG_SPOOL_DIR || spool_pid == getpid())
+		return;
+
+	spool_stop = 0;
+
+	if (0 != (err = pthread_create(&spool_thread, NULL, spool_thread_main, NULL)))
+	{
+		zabbix_log(LOG_LEVEL_ERR, "[%s] cannot start spool thread: %s", MODULE_NAME, zbx_strerror(err));
+		return;
+	}
+
+	spool_pid = getpid();
+}
+
+/******************************************************************************
+ *                                                                            *
+ * Function: spool_destroy                                                    *
+ *                                                                            *
+ * Purpose: stops the spool thread and closes the segment of this process     *
+ *                                                                            *
+ ******************************************************************************/
+void	spool_destroy(void)
+{
+	if (NULL == CONFIG_SPOOL_DIR)
+		return;
+
+	if (spool_pid == getpid())
+	{
+		pthread_mutex_lock(&spool_lock);
+		spool_stop = 1;
+		pthread_cond_broadcast(&spool_wakeup);
+		pthread_mutex_unlock(&spool_lock);
+
+		pthread_join(spool_thread, NULL);
+		spool_pid = 0;
+	}
+
+	pthread_mutex_lock(&spool_lock);
+	spool_segment_close();
+	pthread_mutex_unlock(&spool_lock);
+
+	if (0 != spool_dropped)
+	{
+		zabbix_log(LOG_LEVEL_WARNING, "[%s] " ZBX_FS_UI64 " batches could not be spooled", MODULE_NAME,
+				spool_dropped);
+	}
+}
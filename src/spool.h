@@ -0,0 +1,18 @@
+#ifndef __ZABBIX_SPOOL_H
+#define __ZABBIX_SPOOL_H
+
+
+#include "common.h"
+
+#define SPOOL_FSYNC_NEVER   1
+#define SPOOL_FSYNC_SEGMENT 2
+#define SPOOL_FSYNC_ALWAYS  3
+
+extern int spool_init(void);
+extern void spool_destroy(void);
+extern void spool_start_thread(void);
+
+extern void spool_write(const char *data, unsigned int endpoints);
+
+
+#endif /* __ZABBIX_SPOOL_H */